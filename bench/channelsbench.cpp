@@ -0,0 +1,72 @@
+// Four ink separations stippled one after another against
+// LBGStippling::stipple(channels), which runs them concurrently, with the
+// CPU engine.
+//
+//   channelsbench [width] [points]
+
+#include <QImage>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <omp.h>
+#include <vector>
+
+#include "densitymap.h"
+#include "lbgstippling.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double seconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const int width = argc > 1 ? std::atoi(argv[1]) : 800;
+  const int height = width * 3 / 4;
+  const size_t points = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 5000;
+
+  // hue across, brightness down
+  QImage image(width, height, QImage::Format_RGB32);
+  for (int y = 0; y < height; ++y) {
+    QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+    for (int x = 0; x < width; ++x)
+      line[x] = qRgb(255 * x / width, 255 * y / height,
+                     255 * (width - x) / width);
+  }
+  const DensityMap::Inks inks = DensityMap::separate(image);
+  const std::vector<std::shared_ptr<const DensityMap>> channels(inks.begin(),
+                                                                inks.end());
+
+  LBGStippling::Params params;
+  params.engine = CellEngineType::CPU;
+  params.initialPointSize = 2.0f;
+  params.targetPoints = points;
+  params.maxIterations = 30;
+  params.seed = 1;
+  const LBGStippling engine;
+
+  Clock::time_point start = Clock::now();
+  size_t sequentialPoints = 0;
+  for (const auto& channel : channels)
+    sequentialPoints += engine.stipple(channel, params).size();
+  const double sequential = seconds(start);
+
+  start = Clock::now();
+  size_t concurrentPoints = 0;
+  for (const StippleSet& layer : engine.stipple(channels, params))
+    concurrentPoints += layer.size();
+  const double concurrent = seconds(start);
+
+  std::printf("%dx%d, %d threads\n", width, height, omp_get_max_threads());
+  std::printf("one by one: %6.2f s, %zu stipples\n", sequential,
+              sequentialPoints);
+  std::printf("concurrent: %6.2f s, %zu stipples\n", concurrent,
+              concurrentPoints);
+  return 0;
+}
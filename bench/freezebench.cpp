@@ -0,0 +1,94 @@
+// Runs with and without freezing stable cells, on the CPU and the analytic
+// engine: the time and iterations a run takes, the share of cells frozen
+// in its last iteration, and how evenly its cells split the density, as the
+// relative standard deviation of the density of the final cells.
+//
+//   freezebench [width] [initial points]
+
+#include <QImage>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+#include "densitymap.h"
+#include "fusedcellengine.h"
+#include "lbgstippling.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double seconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Standard deviation of the cell densities over their mean.
+double densitySpread(std::shared_ptr<const DensityMap> density,
+                     const StippleSet& stipples) {
+  FusedCellEngine engine(std::move(density));
+  CellQuery query;
+  query.orientation = false;
+  const CellResult result = engine.compute(stipples.view(), query);
+  double sum = 0.0;
+  double sumSquares = 0.0;
+  for (const VoronoiCell& cell : result.cells) {
+    sum += cell.sumDensity;
+    sumSquares += double(cell.sumDensity) * cell.sumDensity;
+  }
+  const double count = static_cast<double>(result.cells.size());
+  const double mean = sum / count;
+  return std::sqrt(std::max(0.0, sumSquares / count - mean * mean)) / mean;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const int width = argc > 1 ? std::atoi(argv[1]) : 800;
+  const int height = width * 3 / 4;
+  const size_t points = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000;
+
+  // radial gradient, dark in the center
+  QImage image(width, height, QImage::Format_Grayscale8);
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x) {
+      const double dx = x - width / 2.0;
+      const double dy = y - height / 2.0;
+      image.scanLine(y)[x] = static_cast<uint8_t>(
+          std::min(255.0, 400.0 * std::hypot(dx, dy) / width));
+    }
+  const auto density = std::make_shared<const DensityMap>(image);
+
+  LBGStippling::Params params;
+  params.initialPoints = points;
+  params.initialPointSize = 2.0f;
+  params.maxIterations = 50;
+  params.seed = 1;
+
+  std::printf("%dx%d, %zu initial points\n", width, height, points);
+  std::printf("engine    freeze  time s  iterations  frozen  stipples  "
+              "spread\n");
+  for (const CellEngineType engine :
+       {CellEngineType::CPU, CellEngineType::Analytic}) {
+    params.engine = engine;
+    for (const size_t freeze : {0, 2, 5}) {
+      params.freezeIterations = freeze;
+      LBGStippling stippling;
+      LBGStippling::Status last{};
+      stippling.setStatusCallback(
+          [&](const LBGStippling::Status& status) { last = status; });
+      const Clock::time_point start = Clock::now();
+      const StippleSet stipples = stippling.stipple(density, params);
+      const double time = seconds(start);
+      std::printf("%-8s  %6zu  %6.2f  %10zu  %5.1f%%  %8zu  %6.3f\n",
+                  engine == CellEngineType::CPU ? "cpu" : "analytic", freeze,
+                  time, last.iteration + 1,
+                  100.0 * last.frozen / std::max<size_t>(1, stipples.size()),
+                  stipples.size(), densitySpread(density, stipples));
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,78 @@
+// The linear and adaptive hysteresis schedules on the bundled input images:
+// iterations until no cell splits or merges any more (or maxIterations),
+// the time that takes, and the stipples the run ends with.
+//
+//   hysteresisbench [point size] [image...]
+
+#include <QString>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "densitymap.h"
+#include "lbgstippling.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double seconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const float pointSize = argc > 1 ? std::strtof(argv[1], nullptr) : 3.0f;
+  std::vector<std::string> paths(argv + std::min(argc, 2), argv + argc);
+  if (paths.empty())
+    for (const char* name : {"input1", "input2", "input3", "input4"})
+      paths.push_back(std::string(LBG_INPUT_DIR) + "/" + name + ".jpg");
+
+  LBGStippling::Params params;
+  params.engine = CellEngineType::CPU;
+  params.initialPoints = 100;
+  params.initialPointSize = pointSize;
+  params.maxIterations = 100;
+  params.seed = 1;
+
+  std::printf("point size %.1f, hysteresis %.2f + %.3f, at most %zu "
+              "iterations\n",
+              pointSize, params.hysteresis, params.hysteresisDelta,
+              params.maxIterations);
+  std::printf("image       schedule  iterations  time s  stipples  "
+              "hysteresis\n");
+  for (const std::string& path : paths) {
+    const auto density =
+        DensityMap::read(QString::fromStdString(path));
+    if (!density) {
+      std::fprintf(stderr, "cannot read %s\n", path.c_str());
+      return 1;
+    }
+    const std::string name = path.substr(path.find_last_of('/') + 1);
+    for (const HysteresisSchedule schedule :
+         {HysteresisSchedule::Linear, HysteresisSchedule::Adaptive}) {
+      params.hysteresisSchedule = schedule;
+      LBGStippling stippling;
+      LBGStippling::Status last{};
+      stippling.setStatusCallback(
+          [&](const LBGStippling::Status& status) { last = status; });
+      const Clock::time_point start = Clock::now();
+      const StippleSet stipples = stippling.stipple(density, params);
+      const double time = seconds(start);
+      // a run cut off by maxIterations is marked
+      const bool settled = last.splits == 0 && last.merges == 0;
+      std::printf("%-10s  %-8s  %9zu%c  %6.2f  %8zu  %10.2f\n", name.c_str(),
+                  schedule == HysteresisSchedule::Linear ? "linear"
+                                                         : "adaptive",
+                  last.iteration + 1, settled ? ' ' : '+', time,
+                  stipples.size(), last.hysteresis);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,117 @@
+// The accumulation kernels specialized per feature set: accumulateCells on
+// an index map and one pass of the CPU cell engine, with and without
+// supersampling, mask and orientation. "twice" is what a second pass for
+// orientations would add on top of a pass without them, "neighbours" a
+// pass that also collects adjacent cells, as a run that stops before
+// maxIterations takes for its neighbour graph.
+//
+//   kernelsbench [width] [stipples]
+
+#include <QImage>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+
+#include "fusedcellengine.h"
+#include "sitegrid.h"
+#include "stippleset.h"
+#include "voronoicell.h"
+#include "voronoidiagram.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double milliseconds(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// Best of `runs`, the first run also warms the caches.
+template <class F>
+double best(int runs, F&& f) {
+  double time = 1e300;
+  for (int run = 0; run < runs; ++run) {
+    const Clock::time_point start = Clock::now();
+    f();
+    time = std::min(time, milliseconds(start));
+  }
+  return time;
+}
+
+// Index map of the nearest sites, as the GPU engine reads it back.
+IndexMap nearestSites(const StippleView& sites, int width, int height,
+                      int superSampling) {
+  const int w = width * superSampling;
+  const int h = height * superSampling;
+  const SiteGrid grid(sites, w, h, 16.0f);
+  IndexMap map(w, h, static_cast<int32_t>(sites.size()));
+  for (int y = 0; y < h; ++y)
+    for (int x = 0; x < w; ++x) {
+      float dist = 0.0f;
+      map.set(x, y, grid.nearest(x + 0.5f, y + 0.5f, dist));
+    }
+  return map;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const int width = argc > 1 ? std::atoi(argv[1]) : 2000;
+  const int height = width * 3 / 4;
+  const size_t count = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 20000;
+
+  QImage image(width, height, QImage::Format_Grayscale8);
+  QImage mask(width, height, QImage::Format_Grayscale8);
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x) {
+      image.scanLine(y)[x] = static_cast<uint8_t>(255 * x / width);
+      mask.scanLine(y)[x] = x + y < width ? 255 : 0;
+    }
+  const auto plain = std::make_shared<const DensityMap>(image);
+  const auto masked = plain->masked(mask);
+
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+  StippleSet stipples;
+  for (size_t i = 0; i < count; ++i) {
+    const float x = dis(gen);
+    stipples.push_back(QVector2D(x, dis(gen)), 3.0f);
+  }
+  const StippleView sites = stipples.view();
+
+  std::printf("%dx%d, %zu stipples, best of 5, ms\n", width, height, count);
+  std::printf(
+      "ss  mask  accumulate  no orient  engine  no orient  twice  "
+      "neighbours\n");
+  for (const int superSampling : {1, 2}) {
+    const IndexMap map = nearestSites(sites, width, height, superSampling);
+    for (const bool withMask : {false, true}) {
+      const DensityMap& density = withMask ? *masked : *plain;
+      const double accumulate = best(5, [&] {
+        accumulateCells(map, density, sites, superSampling, nullptr, true);
+      });
+      const double accumulatePlain = best(5, [&] {
+        accumulateCells(map, density, sites, superSampling, nullptr, false);
+      });
+
+      FusedCellEngine engine(withMask ? masked : plain, superSampling);
+      CellQuery query;
+      const double fused = best(5, [&] { engine.compute(sites, query); });
+      query.orientation = false;
+      const double fusedPlain = best(5, [&] { engine.compute(sites, query); });
+      query.adjacency = true;
+      const double neighbours = best(5, [&] { engine.compute(sites, query); });
+
+      std::printf("%2d  %4s  %10.1f  %9.1f  %6.1f  %9.1f  %5.1f  %10.1f\n",
+                  superSampling, withMask ? "yes" : "no", accumulate,
+                  accumulatePlain, fused, fusedPlain, fusedPlain + fused,
+                  neighbours);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,91 @@
+// Per-iteration cost of the stipple representation: the former array of
+// structs with a colour per stipple against StippleSet. Each iteration
+// builds the next set, hands it to the stipple callback (which used to get
+// a copy) and extracts the sites for the cell engine.
+//
+//   stipplesetbench [stipples] [iterations]
+
+#include <QColor>
+#include <QVector2D>
+#include <QVector>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "stippleset.h"
+
+namespace {
+
+// The stipple as it was stored before StippleSet.
+struct LegacyStipple {
+  QVector2D pos;
+  float size;
+  QColor color;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double milliseconds(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+  const int iterations = argc > 2 ? std::atoi(argv[2]) : 10;
+
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+  std::vector<float> x(count), y(count);
+  for (size_t i = 0; i < count; ++i) {
+    x[i] = dis(gen);
+    y[i] = dis(gen);
+  }
+
+  double legacyTime = 0.0;
+  size_t legacyBytes = 0;
+  float checksum = 0.0f;
+  for (int n = 0; n < iterations; ++n) {
+    const Clock::time_point start = Clock::now();
+    std::vector<LegacyStipple> stipples;
+    for (size_t i = 0; i < count; ++i)
+      stipples.push_back({QVector2D(x[i], y[i]), 2.0f, QColor(Qt::black)});
+    const std::vector<LegacyStipple> reported = stipples;
+    QVector<QVector2D> sites(static_cast<int>(stipples.size()));
+    std::transform(stipples.begin(), stipples.end(), sites.begin(),
+                   [](const LegacyStipple& s) { return s.pos; });
+    legacyTime += milliseconds(start);
+    legacyBytes = stipples.capacity() * sizeof(LegacyStipple) +
+                  reported.capacity() * sizeof(LegacyStipple) +
+                  sites.size() * sizeof(QVector2D);
+    checksum += reported.back().size + sites.back().x();
+  }
+
+  double setTime = 0.0;
+  size_t setBytes = 0;
+  for (int n = 0; n < iterations; ++n) {
+    const Clock::time_point start = Clock::now();
+    StippleSet stipples;
+    for (size_t i = 0; i < count; ++i)
+      stipples.push_back(QVector2D(x[i], y[i]), 2.0f);
+    const StippleView reported = stipples.view();
+    const float* sites = reported.x();
+    setTime += milliseconds(start);
+    setBytes = count * (3 * sizeof(float));
+    checksum += reported.sizes()[count - 1] + sites[count - 1];
+  }
+
+  std::printf("%zu stipples, %d iterations (checksum %g)\n", count,
+              iterations, checksum);
+  std::printf("structs:    %8.2f ms per iteration, %6.1f MB\n",
+              legacyTime / iterations, legacyBytes / 1e6);
+  std::printf("StippleSet: %8.2f ms per iteration, %6.1f MB\n",
+              setTime / iterations, setBytes / 1e6);
+  return 0;
+}
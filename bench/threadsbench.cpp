@@ -0,0 +1,78 @@
+// Thread sweep of the parallel stages: one pass of the CPU cell engine and
+// the banded rendering of the output, at 1, 2, 4, ... threads up to the
+// given maximum.
+//
+//   threadsbench [max threads] [width] [stipples]
+
+#include <QImage>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <omp.h>
+#include <random>
+
+#include "fusedcellengine.h"
+#include "stippleexport.h"
+#include "stippleset.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double milliseconds(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// Best of `runs`, the first run also warms the caches.
+template <class F>
+double best(int runs, F&& f) {
+  double time = 1e300;
+  for (int run = 0; run < runs; ++run) {
+    const Clock::time_point start = Clock::now();
+    f();
+    time = std::min(time, milliseconds(start));
+  }
+  return time;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const int maxThreads =
+      argc > 1 ? std::atoi(argv[1]) : omp_get_max_threads();
+  const int width = argc > 2 ? std::atoi(argv[2]) : 4000;
+  const int height = width * 3 / 4;
+  const size_t count = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 200000;
+
+  QImage image(width, height, QImage::Format_Grayscale8);
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x)
+      image.scanLine(y)[x] = static_cast<uint8_t>(255 * x / width);
+  const auto density = std::make_shared<const DensityMap>(image);
+
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+  StippleSet stipples;
+  for (size_t i = 0; i < count; ++i) {
+    const float x = dis(gen);
+    stipples.push_back(QVector2D(x, dis(gen)), 3.0f);
+  }
+
+  std::printf("%dx%d, %zu stipples\n", width, height, count);
+  std::printf("threads  cells ms  render ms\n");
+  for (int threads = 1; threads <= maxThreads; threads *= 2) {
+    omp_set_num_threads(threads);
+    FusedCellEngine engine(density, 1);
+    const double cells =
+        best(3, [&] { engine.compute(stipples.view(), CellQuery()); });
+    const double render = best(3, [&] {
+      renderStipples(stipples.view(), QSize(width, height));
+    });
+    std::printf("%7d  %8.1f  %9.1f\n", threads, cells, render);
+  }
+  return 0;
+}
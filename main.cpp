@@ -13,26 +13,417 @@
 #include <QApplication>
 #include <QCommandLineParser>
 #include <QCommandLineOption>
+#include <QDir>
+#include <QHash>
 #include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QString>
+#include <QStringList>
 #include <QVector2D>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <functional>
 #include <iostream>
-#include <fstream>
+#include <omp.h>
+#include <string>
 
+#include "densitycache.h"
+#include "distributedcellengine.h"
 #include "mainwindow.h"
-#include "stippleviewer.h"
-
-// Binary save function for stipples
-bool binarySaveRaw(const std::string &path, const std::vector<QVector2D> &pts) {
-    std::ofstream out(path, std::ios::binary);
-    if (!out) return false;
-    uint64_t n = pts.size();
-    out.write(reinterpret_cast<const char*>(&n), sizeof(n));
-    out.write(reinterpret_cast<const char*>(pts.data()), n * sizeof(QVector2D));
-    return out.good();
-}
+#include "resultcache.h"
+#include "stippleexport.h"
 
 using Params = LBGStippling::Params;
+
+namespace {
+
+// Looks up an option of a job by its long name.
+using OptionValue = std::function<QString(const QString &)>;
+using OptionFlag = std::function<bool(const QString &)>;
+
+struct Job {
+    QString inPath;
+    QString outPath;
+    QString maskPath;
+    bool alphaMask = false;
+    bool cmyk = false;
+    bool graph = false;
+    bool stipples = false;  // served jobs only
+    int width = 0;
+    PlotSettings plot;
+    Params params;
+};
+
+// What a job produced.
+struct JobResult {
+    std::vector<StippleSet> layers;  // one per ink
+    QStringList outputs;             // files written
+    QStringList stipples;            // binary stipple file per ink
+};
+
+// JSON type of every option a served job may set.
+enum class JobField { Flag, Text, Integer, Number };
+
+const QHash<QString, JobField> &jobFields() {
+    static const QHash<QString, JobField> fields = {
+        {"input", JobField::Text},           {"output", JobField::Text},
+        {"engine", JobField::Text},          {"hystSchedule", JobField::Text},
+        {"mask", JobField::Text},            {"checkpoint", JobField::Text},
+        {"alphaMask", JobField::Flag},       {"cmyk", JobField::Flag},
+        {"graph", JobField::Flag},           {"invert", JobField::Flag},
+        {"resume", JobField::Flag},          {"stipples", JobField::Flag},
+        {"width", JobField::Integer},        {"points", JobField::Integer},
+        {"ss", JobField::Integer},           {"iter", JobField::Integer},
+        {"targetPoints", JobField::Integer}, {"freeze", JobField::Integer},
+        {"seed", JobField::Integer},         {"checkpointEvery", JobField::Integer},
+        {"pointSize", JobField::Number},     {"sizeMin", JobField::Number},
+        {"sizeMax", JobField::Number},       {"gamma", JobField::Number},
+        {"contrast", JobField::Number},      {"hyst", JobField::Number},
+        {"hystDelta", JobField::Number},     {"targetTol", JobField::Number},
+        {"coneRadius", JobField::Number},    {"pointChange", JobField::Number},
+        {"meanDisp", JobField::Number},      {"maxDisp", JobField::Number},
+        {"stableFrac", JobField::Number},    {"stableDisp", JobField::Number},
+        {"timeBudget", JobField::Number},    {"freezeDisp", JobField::Number},
+        {"freezeDensity", JobField::Number}, {"plotWidth", JobField::Number},
+        {"plotTime", JobField::Number},
+    };
+    return fields;
+}
+
+// Integers beyond this are not exact in a JSON number.
+const double MaxJsonInteger = 9007199254740992.0;
+
+// Checks that a JSON job only sets known options, each with a value of its
+// type: "true" as a string or 1 for a flag would otherwise read as false.
+bool checkJobFields(const QJsonObject &object, std::string &error) {
+    for (auto it = object.begin(); it != object.end(); ++it) {
+        if (it.key() == "id") continue;
+        const auto field = jobFields().constFind(it.key());
+        if (field == jobFields().constEnd()) {
+            error = "Unknown job option: " + it.key().toStdString();
+            return false;
+        }
+        const QJsonValue value = it.value();
+        const double number = value.toDouble();
+        bool valid = false;
+        const char *expected = "";
+        switch (*field) {
+        case JobField::Flag:
+            valid = value.isBool();
+            expected = "true or false";
+            break;
+        case JobField::Text:
+            valid = value.isString();
+            expected = "a string";
+            break;
+        case JobField::Integer:
+            valid = value.isDouble() && number >= 0.0 && number <= MaxJsonInteger &&
+                    number == std::floor(number);
+            expected = "a non-negative integer";
+            break;
+        case JobField::Number:
+            valid = value.isDouble();
+            expected = "a number";
+            break;
+        }
+        if (!valid) {
+            error = "Job option " + it.key().toStdString() + " must be " + expected;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Text of a checked JSON option as the command line would give it, integers
+// without exponent.
+QString jobText(const QJsonValue &value) {
+    if (value.isString()) return value.toString();
+    const double number = value.toDouble();
+    if (number == std::floor(number) && std::abs(number) <= MaxJsonInteger)
+        return QString::number(static_cast<qint64>(number));
+    return QString::number(number, 'g', 17);
+}
+
+// Reads and validates a job, on failure `error` says why.
+bool readJob(const OptionValue &value, const OptionFlag &flag, Job &job, std::string &error) {
+    job.inPath = value("input");
+    job.outPath = value("output");
+    if (job.inPath.isEmpty() || job.outPath.isEmpty()) {
+        error = "Both --input and --output are required.";
+        return false;
+    }
+    if (!QFileInfo::exists(job.inPath)) {
+        error = "Input file not found: " + job.inPath.toStdString();
+        return false;
+    }
+
+    const QString ext = QFileInfo(job.outPath).suffix().toLower();
+    if (ext != "png" && ext != "jpg" && ext != "jpeg" && ext != "raw" && ext != "bin" &&
+        ext != "gcode" && ext != "hpgl" && ext != "plt") {
+        error = "Unsupported output format: ." + ext.toStdString() +
+                "\nSupported extensions: .png, .jpg, .jpeg, .raw, .bin, .gcode, .hpgl, .plt";
+        return false;
+    }
+
+    const QString engineName = value("engine").toLower();
+    if (engineName != "gpu" && engineName != "cpu" && engineName != "analytic" &&
+        engineName != "distributed") {
+        error = "Unknown engine: " + engineName.toStdString() +
+                "\nSupported engines: gpu, cpu, analytic, distributed";
+        return false;
+    }
+    if (engineName == "distributed" && stripWorkers().empty()) {
+        error = "The distributed engine needs --workers";
+        return false;
+    }
+
+    const QString scheduleName = value("hystSchedule").toLower();
+    if (scheduleName != "linear" && scheduleName != "adaptive") {
+        error = "Unknown hysteresis schedule: " + scheduleName.toStdString() +
+                "\nSupported schedules: linear, adaptive";
+        return false;
+    }
+
+    job.maskPath = value("mask");
+    job.alphaMask = flag("alphaMask");
+    job.cmyk = flag("cmyk");
+    job.graph = flag("graph");
+    job.width = value("width").toInt();
+    job.plot.width = value("plotWidth").toFloat();
+    job.plot.timeBudget = value("plotTime").toFloat();
+    if (job.width < 0) {
+        error = "The input width must not be negative";
+        return false;
+    }
+    if (job.plot.width <= 0.0f) {
+        error = "The plot width must be positive";
+        return false;
+    }
+
+    Params &params = job.params;
+    params.engine = engineName == "cpu"           ? CellEngineType::CPU
+                    : engineName == "analytic"    ? CellEngineType::Analytic
+                    : engineName == "distributed" ? CellEngineType::Distributed
+                                                  : CellEngineType::GPU;
+    params.initialPoints       = value("points").toULongLong();
+    params.initialPointSize    = value("pointSize").toFloat();
+    params.pointSizeMin        = value("sizeMin").toFloat();
+    params.pointSizeMax        = value("sizeMax").toFloat();
+    if (params.pointSizeMin > 0.0f && params.pointSizeMax> 0.0f)
+        params.adaptivePointSize = true;
+    params.superSamplingFactor = value("ss").toULongLong();
+    params.preprocessing.gamma    = value("gamma").toFloat();
+    params.preprocessing.contrast = value("contrast").toFloat();
+    params.preprocessing.invert   = flag("invert");
+    params.maxIterations       = value("iter").toULongLong();
+    params.hysteresis          = value("hyst").toFloat();
+    params.hysteresisDelta     = value("hystDelta").toFloat();
+    params.hysteresisSchedule  = scheduleName == "adaptive" ? HysteresisSchedule::Adaptive
+                                                            : HysteresisSchedule::Linear;
+    params.targetPoints        = value("targetPoints").toULongLong();
+    params.targetTolerance     = value("targetTol").toFloat();
+    params.coneRadiusFactor    = value("coneRadius").toFloat();
+    params.minPointChange      = value("pointChange").toFloat();
+    params.maxMeanDisplacement = value("meanDisp").toFloat();
+    params.maxMaxDisplacement  = value("maxDisp").toFloat();
+    params.minStableFraction   = value("stableFrac").toFloat();
+    params.stableDisplacement  = value("stableDisp").toFloat();
+    params.timeBudget          = value("timeBudget").toFloat();
+    params.freezeIterations    = value("freeze").toULongLong();
+    params.freezeDisplacement  = value("freezeDisp").toFloat();
+    params.freezeDensityChange = value("freezeDensity").toFloat();
+    params.seed                = value("seed").toULongLong();
+    params.checkpointPath      = value("checkpoint").toStdString();
+    params.checkpointInterval  = value("checkpointEvery").toULongLong();
+    params.resume              = flag("resume");
+    if (params.freezeIterations > LBGStippling::MaxFreezeIterations) {
+        error = "Cells can only be frozen after at most " +
+                std::to_string(LBGStippling::MaxFreezeIterations) +
+                " stable iterations";
+        return false;
+    }
+    return true;
+}
+
+// Stipples a job, unless all its layers are in the result cache, and writes
+// its output. `result` receives the layers and the files written.
+bool runJob(const Job &job, DensityCache &densityCache, ResultCache &resultCache,
+            bool verbose, JobResult &result, std::string &error) {
+    const Params &params = job.params;
+    const bool cmyk = job.cmyk;
+
+    // Decode straight into the density planes, the decoded image is never
+    // kept.
+    std::vector<std::shared_ptr<const DensityMap>> channels;
+    if (cmyk) {
+        const DensityCache::Inks inks = densityCache.readSeparated(job.inPath, params.preprocessing, job.width);
+        channels.assign(inks.begin(), inks.end());
+    } else {
+        channels.push_back(densityCache.read(job.inPath, params.preprocessing, job.width));
+    }
+    if (!channels.front()) {
+        error = "Failed to load input image: " + job.inPath.toStdString();
+        return false;
+    }
+    const QSize outputSize(channels.front()->width(), channels.front()->height());
+
+    const QString maskPath = job.alphaMask ? job.inPath : job.maskPath;
+    if (!maskPath.isEmpty()) {
+        const QImage mask(maskPath);
+        if (mask.isNull()) {
+            error = "Failed to load mask: " + maskPath.toStdString();
+            return false;
+        }
+        if (job.alphaMask && !mask.hasAlphaChannel()) {
+            error = "Input image has no alpha channel to mask with";
+            return false;
+        }
+        for (std::shared_ptr<const DensityMap> &channel : channels)
+            channel = channel->masked(mask);
+    }
+
+    // Seeded runs are looked up by the final density maps, so a changed mask
+    // or preprocessing gives a different key.
+    std::vector<uint64_t> keys(channels.size(), 0);
+    std::vector<StippleSet> layers(channels.size());
+    std::vector<LBGStippling::Graph> graphs(channels.size());
+    // Every layer is looked up, so the hit and miss counts cover all of them.
+    // The cache keeps no graphs, a run that writes one is only stored.
+    bool cached = resultCache.enabled() && !job.graph;
+    for (size_t i = 0; resultCache.enabled() && i < channels.size(); ++i) {
+        keys[i] = ResultCache::key(*channels[i], params, i);
+        if (job.graph) continue;
+        const bool loaded = resultCache.load(keys[i], layers[i]);
+        cached = cached && loaded;
+    }
+
+    LBGStippling engine;
+    LBGStippling::Status last = {0, 0, 0, 0, 0.0f};
+    engine.setStatusCallback([&last, verbose, cmyk](const LBGStippling::Status &status) {
+        last = status;
+        if (!verbose) return;
+        if (cmyk) std::cerr << "ink " << "cmyk"[status.channel] << " ";
+        std::cerr << "iteration " << status.iteration + 1
+                  << " points " << status.size
+                  << " splits " << status.splits
+                  << " merges " << status.merges
+                  << " frozen " << status.frozen
+                  << " hysteresis " << status.hysteresis
+                  << " threshold scale " << status.thresholdScale
+                  << " mean move " << status.meanDisplacement
+                  << " max move " << status.maxDisplacement
+                  << " stable " << status.stableFraction
+                  << " time " << status.elapsed << "s\n";
+    });
+    if (cached) {
+        // all layers were loaded above
+    } else if (cmyk) {
+        // all inks are stippled concurrently
+        layers = engine.stipple(channels, params, job.graph ? &graphs : nullptr);
+    } else {
+        // the density plane is released together with the engine, unless
+        // the cache keeps it
+        layers.front() = engine.stipple(std::move(channels.front()), params,
+                                        job.graph ? &graphs.front() : nullptr);
+    }
+    for (size_t i = 0; !cached && i < keys.size(); ++i)
+        resultCache.store(keys[i], layers[i].view());
+    if (verbose && cached) {
+        std::cerr << "taken from the result cache\n";
+    } else if (verbose && cmyk) {
+        std::cerr << "finished with";
+        for (size_t i = 0; i < layers.size(); ++i)
+            std::cerr << " " << "cmyk"[i] << " " << layers[i].size();
+        std::cerr << " points\n";
+    } else if (verbose) {
+        std::cerr << "finished after " << last.iteration + 1 << " iterations, "
+                  << layers.front().size() << " points, " << last.elapsed << "s\n";
+    }
+
+    result.outputs.clear();
+    std::vector<StippleView> views;
+    for (const StippleSet &layer : layers) views.push_back(layer.view());
+
+    const QFileInfo outInfo(job.outPath);
+    // output file of a layer, cmyk runs write one per ink
+    auto inkPath = [&](size_t i, const QString &suffix) {
+        const QString name = cmyk ? QString("%1-%2").arg(outInfo.completeBaseName()).arg(QChar("cmyk"[i]))
+                                  : outInfo.completeBaseName();
+        return outInfo.dir().filePath(name + "." + suffix);
+    };
+
+    // the neighbour graphs came with the stipples
+    for (size_t i = 0; job.graph && i < views.size(); ++i) {
+        const QString graphPath = inkPath(i, "edges");
+        if (!writeStippleGraph(graphPath.toStdString(), graphs[i])) {
+            error = "Failed to save the neighbour graph to: " + graphPath.toStdString();
+            return false;
+        }
+        result.outputs.append(graphPath);
+        if (verbose) {
+            if (cmyk) std::cerr << "ink " << "cmyk"[i] << " ";
+            std::cerr << "neighbour graph " << graphs[i].size() << " edges\n";
+        }
+    }
+    channels.clear();
+
+    const QString ext = outInfo.suffix().toLower();
+    if (ext == "png" || ext == "jpg" || ext == "jpeg") {
+        const QImage outputImage =
+            cmyk ? renderLayers(views, {Qt::cyan, Qt::magenta, Qt::yellow, Qt::black}, outputSize)
+                 : renderStipples(views.front(), outputSize);
+        if (!outputImage.save(job.outPath)) {
+            error = "Failed to save output image to: " + job.outPath.toStdString();
+            return false;
+        }
+        result.outputs.append(job.outPath);
+    } else {
+        const bool plot = ext == "gcode" || ext == "hpgl" || ext == "plt";
+        for (size_t i = 0; i < views.size(); ++i) {
+            const QString layerPath = cmyk ? inkPath(i, outInfo.suffix()) : job.outPath;
+            if (plot) {
+                PlotPath path;
+                if (!writePlot(layerPath.toStdString(), ext == "gcode" ? PlotFormat::GCode : PlotFormat::HPGL,
+                               views[i], outputSize, job.plot, &path)) {
+                    error = "Failed to save plot to: " + layerPath.toStdString();
+                    return false;
+                }
+                if (verbose) {
+                    if (cmyk) std::cerr << "ink " << "cmyk"[i] << " ";
+                    std::cerr << "pen travel " << path.initialTravel / 1000.0 << "m in point order, "
+                              << path.nearestTravel / 1000.0 << "m nearest neighbour, "
+                              << path.travel / 1000.0 << "m optimised, " << path.seconds << "s\n";
+                }
+            } else if (!writeStipplesBinary(layerPath.toStdString(), views[i])) {
+                error = "Failed to save binary stipple data to: " + layerPath.toStdString();
+                return false;
+            } else {
+                result.stipples.append(layerPath);
+            }
+            result.outputs.append(layerPath);
+        }
+    }
+    // a served job asking for its stipples gets them in binary even if the
+    // output is an image or a plot
+    if (job.stipples && result.stipples.isEmpty()) {
+        for (size_t i = 0; i < views.size(); ++i) {
+            const QString layerPath = inkPath(i, "bin");
+            if (!writeStipplesBinary(layerPath.toStdString(), views[i])) {
+                error = "Failed to save binary stipple data to: " + layerPath.toStdString();
+                return false;
+            }
+            result.stipples.append(layerPath);
+        }
+    }
+    result.layers = std::move(layers);
+    return true;
+}
+
+}  // namespace
+
 int main(int argc, char *argv[]) {
     QApplication app(argc, argv);
     app.setApplicationName("Weighted LBG Stippling");
@@ -42,7 +433,7 @@ int main(int argc, char *argv[]) {
     parser.addHelpOption();
 
     QCommandLineOption inputOpt({"i", "input"}, "Input image file path", "input");
-    QCommandLineOption outputOpt({"o", "output"}, "Output file path (.png, .jpg, .raw)", "output");
+    QCommandLineOption outputOpt({"o", "output"}, "Output file path (.png, .jpg, .raw, .bin, or plotter commands .gcode, .hpgl, .plt)", "output");
 
     parser.addOption(inputOpt);
     parser.addOption(outputOpt);
@@ -52,76 +443,198 @@ int main(int argc, char *argv[]) {
     parser.addOption({"pointSize", "Initial point size. Fixed unless sizeMin and SizeMax are set > 0.0", "int", "2"});
     parser.addOption({"sizeMin", "Min point size", "float", "-1.0"});
     parser.addOption({"sizeMax", "Max point size", "float", "-1.0"});
-    parser.addOption({"ss", "Supersampling factor", "int", "1"});
+    parser.addOption({"width", "Scale the input down or up to this width while decoding (0 = original size)", "int", "0"});
+    parser.addOption({"ss", "Supersampling factor (the gpu engine needs ss^2 times the memory for its index map)", "int", "1"});
     parser.addOption({"iter", "Max iterations", "int", "50"});
+    parser.addOption({"engine", "Cell engine: gpu (OpenGL cones), cpu (fused tile engine), analytic (exact polygons) "
+                                "or distributed (cpu engine on image strips in worker processes, see --workers)", "name", "gpu"});
+    parser.addOption({"workers", "Comma-separated host:port addresses of the worker processes of the distributed engine", "list", ""});
+    parser.addOption({"worker", "Run as a worker for the distributed engine, listening on this port (0 = any free port)", "port"});
+    parser.addOption({"listen", "Address the worker listens on, :: or 0.0.0.0 for all interfaces. Workers do not authenticate coordinators, only listen beyond loopback on trusted networks", "address", "127.0.0.1"});
+    parser.addOption({"gamma", "Gamma applied to the image brightness", "float", "1.0"});
+    parser.addOption({"contrast", "Contrast factor around mid gray", "float", "1.0"});
+    QCommandLineOption invertOpt("invert", "Invert the image brightness");
+    parser.addOption(invertOpt);
+    QCommandLineOption cmykOpt("cmyk", "Separate the image into cyan, magenta, yellow and black and stipple one layer per ink, "
+                                       "concurrently except with the gpu engine. Images show the overprinted layers, binary and plotter output write one file per ink (name-c.bin, ...)");
+    parser.addOption(cmykOpt);
+    QCommandLineOption graphOpt("graph", "Also write the neighbour graph of the stipples next to the output (name.edges, "
+                                         "the pair count followed by uint32 index pairs), collected in the last iteration, or in one more pass when the run stops before --iter");
+    parser.addOption(graphOpt);
+    parser.addOption({"mask", "Only stipple where this image is white (or opaque, if it has an alpha channel)", "path", ""});
+    QCommandLineOption alphaMaskOpt("alphaMask", "Only stipple where the input image is opaque");
+    parser.addOption(alphaMaskOpt);
+    parser.addOption({"plotWidth", "Width of plotter output in mm, the height follows the image", "float", "200.0"});
+    parser.addOption({"plotTime", "Seconds spent shortening the pen travel of plotter output (0 = nearest neighbour only)", "float", "10.0"});
+    parser.addOption({"cacheDir", "Directory for cached density maps (empty = memory only)", "path", ""});
+    parser.addOption({"seed", "Seed of the random initial points, runs with the same seed repeat (0 = random)", "int", "0"});
+    parser.addOption({"resultCacheDir", "Directory for cached results of seeded runs without time budget (empty = off)", "path", ""});
+    parser.addOption({"resultCacheSize", "Size limit of the result cache in MB, least recently used results are evicted", "int", "1024"});
+    parser.addOption({"checkpoint", "Save the state of the run to this file while it runs, cmyk runs append .0 to .3 (empty = off)", "path", ""});
+    parser.addOption({"checkpointEvery", "Iterations between checkpoints", "int", "10"});
+    QCommandLineOption resumeOpt("resume", "Continue from the checkpoint file, if it belongs to the same image and parameters");
+    parser.addOption(resumeOpt);
     parser.addOption({"hyst", "Hysteresis factor", "float", "0.6"});
     parser.addOption({"hystDelta", "Hysteresis delta", "float", "0.01"});
+    parser.addOption({"hystSchedule", "Hysteresis schedule: linear (add hystDelta every iteration) or adaptive (add it once splits and merges oscillate)", "name", "linear"});
+    parser.addOption({"targetPoints", "Steer the split/merge thresholds towards this many points (0 = off)", "int", "0"});
+    parser.addOption({"targetTol", "Relative deviation from targetPoints that counts as reached", "float", "0.01"});
+    parser.addOption({"coneRadius", "Bound Voronoi cones to this multiple of the previous cell radius (0 = full-size cones)", "float", "0.0"});
+
+    // Convergence criteria, all enabled ones must hold to stop early
+    parser.addOption({"pointChange", "Stop when the relative change of the point count is below this (0 = off)", "float", "0.0"});
+    parser.addOption({"meanDisp", "Stop when the mean centroid movement in pixels is below this (0 = off)", "float", "0.0"});
+    parser.addOption({"maxDisp", "Stop when the largest centroid movement in pixels is below this (0 = off)", "float", "0.0"});
+    parser.addOption({"stableFrac", "Stop when this fraction of cells is stable (0 = off)", "float", "0.0"});
+    parser.addOption({"stableDisp", "Movement in pixels below which a kept cell counts as stable", "float", "0.5"});
+    parser.addOption({"timeBudget", "Wall-clock budget in seconds (0 = unlimited)", "float", "0.0"});
+
+    // Freezing of converged cells
+    parser.addOption({"freeze", "Freeze cells that were stable for this many iterations (0 = off, at most 255)", "int", "0"});
+    parser.addOption({"freezeDisp", "Movement in pixels below which a cell counts towards freezing", "float", "0.1"});
+    parser.addOption({"freezeDensity", "Relative density change below which a cell counts towards freezing", "float", "0.01"});
+
+    parser.addOption({"threads", "Number of threads shared by all stages (0 = one per core)", "int", "0"});
+
+    QCommandLineOption verboseOpt({"v", "verbose"}, "Print the status of every iteration");
+    parser.addOption(verboseOpt);
+    QCommandLineOption serveOpt("serve", "Keep running and read jobs from stdin, one JSON object per line with the option names "
+                                         "above as keys (missing ones default to the command line), flags as true or false, "
+                                         "and an optional \"id\". Every job is answered with one JSON line on stdout holding "
+                                         "the point counts and the files written, or an error. With \"stipples\": true the "
+                                         "reply also lists a binary stipple file per layer, the output itself if it is "
+                                         "binary, else name.bin (name-c.bin, ...) next to it");
+    parser.addOption(serveOpt);
 
     parser.process(app);
 
-    const QString inPath = parser.value(inputOpt);
-    const QString outPath = parser.value(outputOpt);
+    const OptionValue cliValue = [&parser](const QString &name) { return parser.value(name); };
+    const OptionFlag cliFlag = [&parser](const QString &name) { return parser.isSet(name); };
+    const bool verbose = parser.isSet(verboseOpt);
+    if (parser.value("threads").toInt() > 0) omp_set_num_threads(parser.value("threads").toInt());
+    if (verbose) {
+        // Memory is spread over the nodes by first touch, which only holds
+        // with threads that stay on their node.
+        const int nodes = QDir("/sys/devices/system/node").entryList({"node[0-9]*"}, QDir::Dirs).size();
+        std::cerr << omp_get_max_threads() << " threads, "
+                  << (DensityMap::pinnedThreads() ? "pinned" : "not pinned");
+        if (nodes > 1) std::cerr << ", " << nodes << " NUMA nodes";
+        std::cerr << "\n";
+        if (nodes > 1 && !DensityMap::pinnedThreads())
+            std::cerr << "set OMP_PROC_BIND=spread and OMP_PLACES=cores to spread memory over the nodes\n";
+    }
+    ResultCache resultCache(parser.value("resultCacheDir"),
+                            parser.value("resultCacheSize").toLongLong() << 20);
 
-    if (parser.isSet(inputOpt)) {     
-        if (!QFileInfo::exists(inPath)) {
-            std::cerr << "Input file not found: " << inPath.toStdString() << "\n";
-            return 1;
-        }
+    std::vector<std::string> workers;
+    for (const QString &address : parser.value("workers").split(',', QString::SkipEmptyParts))
+        workers.push_back(address.trimmed().toStdString());
+    setStripWorkers(workers);
 
-        if (inPath.isEmpty() || outPath.isEmpty()) {
-            std::cerr << "Both --input and --output are required.\n";
+    if (parser.isSet("worker")) {
+        // Serves strips of the distributed engine until killed.
+        const std::string address = parser.value("listen").toStdString();
+        const std::unique_ptr<Listener> listener = Listener::open(parser.value("worker").toUShort(), address);
+        if (!listener) {
+            std::cerr << "Cannot listen on " << address << " port " << parser.value("worker").toStdString() << "\n";
             return 1;
         }
+        std::cerr << "worker listening on " << address << " port " << listener->port() << "\n";
+        serveStrips(*listener);
+        return 1;
+    }
 
-        QFileInfo outInfo(outPath);
-        QString ext = outInfo.suffix().toLower();
+    if (parser.isSet(serveOpt)) {
+        // Everything that can outlive a job stays warm: recent density maps
+        // in memory and, for the GPU engine, the OpenGL context with its
+        // compiled shaders. Jobs run one after another, each engine uses all
+        // threads.
+        DensityCache densityCache;
+        densityCache.setDirectory(parser.value("cacheDir"));
+        prepareCellEngine(parser.value("engine").toLower() == "gpu" ? CellEngineType::GPU
+                                                                    : CellEngineType::CPU);
 
-        if (ext != "png" && ext != "jpg" && ext != "jpeg" && ext != "raw" && ext != "bin") {
-            std::cerr << "Unsupported output format: ." << ext.toStdString() << "\n";
-            std::cerr << "Supported extensions: .png, .jpg, .jpeg, .raw, .bin\n";
-            return 1;
-        }
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+            const auto start = std::chrono::steady_clock::now();
 
-        QImage input(inPath);
-        if (input.isNull()) {
-            std::cerr << "Failed to load input image: " << inPath.toStdString() << "\n";
-            return 1;
-        }
+            QJsonParseError parseError;
+            const QJsonDocument document =
+                QJsonDocument::fromJson(QByteArray::fromStdString(line), &parseError);
+            const QJsonObject object = document.object();
 
-        Params params;
-        params.initialPoints       = parser.value("points").toULongLong();
-        params.initialPointSize    = parser.value("pointSize").toFloat();
-        params.pointSizeMin        = parser.value("sizeMin").toFloat();
-        params.pointSizeMax        = parser.value("sizeMax").toFloat();
-        if (params.pointSizeMin > 0.0f && params.pointSizeMax> 0.0f)
-            params.adaptivePointSize = true;
-        params.superSamplingFactor = parser.value("ss").toULongLong();
-        params.maxIterations       = parser.value("iter").toULongLong();
-        params.hysteresis          = parser.value("hyst").toFloat();
-        params.hysteresisDelta     = parser.value("hystDelta").toFloat();
-
-        LBGStippling engine;
-        auto pts = engine.stipple(input, params);
-
-        StippleViewer viewer(input, nullptr);
-        viewer.displayPoints(pts);
-        if (ext == "png" || ext == "jpg" || ext == "jpeg") {
-            QPixmap outputImage = viewer.getImage();
-            if (!outputImage.save(outPath)) {
-                std::cerr << "Failed to save output image to: " << outPath.toStdString() << "\n";
-                return 1;
+            QJsonObject reply;
+            reply["id"] = object.value("id");
+            Job job;
+            job.stipples = object.value("stipples").toBool();
+            JobResult result;
+            std::string error;
+            bool ok = false;
+            if (!document.isObject()) {
+                error = "Invalid job: " + parseError.errorString().toStdString();
+            } else {
+                // a failing job must not take the server down
+                try {
+                    ok = checkJobFields(object, error) &&
+                         readJob([&](const QString &name) {
+                                     return object.contains(name) ? jobText(object.value(name))
+                                                                  : parser.value(name);
+                                 },
+                                 [&](const QString &name) {
+                                     return object.contains(name) ? object.value(name).toBool()
+                                                                  : parser.isSet(name);
+                                 },
+                                 job, error) &&
+                         runJob(job, densityCache, resultCache, verbose, result, error);
+                } catch (const std::exception &e) {
+                    ok = false;
+                    error = std::string("Job failed: ") + e.what();
+                } catch (...) {
+                    ok = false;
+                    error = "Job failed";
+                }
             }
-        } else {
-            std::vector<QVector2D> positions;
-            positions.reserve(pts.size()); // avoid reallocations
-
-            std::transform(pts.begin(), pts.end(), std::back_inserter(positions),
-                [](const Stipple& s) { return s.pos; });
-            if (!binarySaveRaw(outPath.toStdString(), positions)) {
-                std::cerr << "Failed to save binary stipple data to: " << outPath.toStdString() << "\n";
-                return 1;
+
+            reply["ok"] = ok;
+            if (ok) {
+                QJsonArray counts;
+                for (const StippleSet &layer : result.layers)
+                    counts.append(static_cast<qint64>(layer.size()));
+                reply["points"] = counts;
+                reply["outputs"] = QJsonArray::fromStringList(result.outputs);
+                if (job.stipples) reply["stipples"] = QJsonArray::fromStringList(result.stipples);
+            } else {
+                reply["error"] = QString::fromStdString(error);
             }
+            if (resultCache.enabled()) {
+                // totals since the server started
+                reply["resultCache"] = QJsonObject{{"hits", static_cast<qint64>(resultCache.hits())},
+                                                   {"misses", static_cast<qint64>(resultCache.misses())}};
+            }
+            reply["seconds"] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << QJsonDocument(reply).toJson(QJsonDocument::Compact).toStdString() << std::endl;
+        }
+        releaseCellEngines();
+        return 0;
+    }
+
+    if (parser.isSet(inputOpt)) {
+        Job job;
+        std::string error;
+        JobResult result;
+        // The cache only goes to disk, a single run has no use for a copy in
+        // memory.
+        DensityCache densityCache(0);
+        densityCache.setDirectory(parser.value("cacheDir"));
+        if (!readJob(cliValue, cliFlag, job, error) ||
+            !runJob(job, densityCache, resultCache, verbose, result, error)) {
+            std::cerr << error << "\n";
+            return 1;
         }
+        if (verbose && resultCache.enabled())
+            std::cerr << "result cache: " << resultCache.hits() << " hits, "
+                      << resultCache.misses() << " misses\n";
         return 0;
     }
     else
@@ -133,4 +646,4 @@ int main(int argc, char *argv[]) {
 
         return app.exec();
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,179 @@
+// Python bindings of the stippling engine, built with -DLBG_PYTHON=ON.
+//
+//   import numpy as np, lbgstippling
+//   params = lbgstippling.Params()
+//   params.initialPoints = 1000
+//   stipples = lbgstippling.stipple(gray, params)  # gray: uint8 (h, w)
+//   stipples["x"], stipples["y"], stipples["size"]
+//   lbgstippling.stipple(gray, params, graph=True)["edges"]  # (m, 2) pairs
+//
+// Contiguous uint8 images are read in place and the stipples are returned
+// in the memory the engine produced them in. Runs release the GIL, so runs
+// on several Python threads proceed in parallel.
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <QGuiApplication>
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "densitymap.h"
+#include "distributedcellengine.h"
+#include "lbgstippling.h"
+#include "stippleset.h"
+
+namespace py = pybind11;
+
+namespace {
+
+using Params = LBGStippling::Params;
+using GrayImage = py::array_t<uint8_t, py::array::c_style>;
+using Edges = LBGStippling::Graph;
+
+struct Result {
+  StippleSet stipples;
+  Edges edges;
+};
+
+// Density map over the pixels of `image`, which stays referenced until the
+// map is gone, wherever that happens.
+std::shared_ptr<const DensityMap> borrowDensity(const GrayImage& image,
+                                                const DensityTransform& tf) {
+  if (image.ndim() != 2)
+    throw py::value_error("expected a grayscale image of shape (h, w)");
+  const int height = static_cast<int>(image.shape(0));
+  const int width = static_cast<int>(image.shape(1));
+  if (width == 0 || height == 0) throw py::value_error("empty image");
+
+  std::shared_ptr<const void> owner(new py::object(image),
+                                    [](const py::object* object) {
+                                      py::gil_scoped_acquire gil;
+                                      delete object;
+                                    });
+  return std::make_shared<DensityMap>(width, height, image.data(),
+                                      std::move(owner), tf);
+}
+
+// Arrays x, y and size, and edges if a graph was asked for, over the memory
+// of `result`, which they own together.
+py::dict resultArrays(Result result, bool graph) {
+  auto* owned = new Result(std::move(result));
+  const py::capsule owner(
+      owned, [](void* pointer) { delete static_cast<Result*>(pointer); });
+  const StippleView view = owned->stipples.view();
+  const py::ssize_t count = static_cast<py::ssize_t>(view.size());
+
+  py::dict arrays;
+  arrays["x"] = py::array_t<float>(count, view.x(), owner);
+  arrays["y"] = py::array_t<float>(count, view.y(), owner);
+  arrays["size"] = py::array_t<float>(count, view.sizes(), owner);
+  if (graph) {
+    static_assert(sizeof(Edges::value_type) == 2 * sizeof(uint32_t),
+                  "edges are read as (m, 2) uint32");
+    const py::ssize_t edges = static_cast<py::ssize_t>(owned->edges.size());
+    arrays["edges"] = py::array_t<uint32_t>(
+        {edges, py::ssize_t(2)},
+        reinterpret_cast<const uint32_t*>(owned->edges.data()), owner);
+  }
+  return arrays;
+}
+
+// The GPU engine needs a Qt GUI application, so Python starts on the CPU.
+Params defaultParams() {
+  Params params;
+  params.engine = CellEngineType::CPU;
+  return params;
+}
+
+Result stipple(const GrayImage& image, const Params& params, bool graph) {
+  if (params.engine == CellEngineType::GPU && !qGuiApp)
+    throw std::runtime_error(
+        "the gpu engine needs a QGuiApplication, use the cpu or analytic "
+        "engine");
+  std::shared_ptr<const DensityMap> density =
+      borrowDensity(image, params.preprocessing);
+
+  py::gil_scoped_release release;
+  const LBGStippling engine;
+  Result result;
+  result.stipples = engine.stipple(std::move(density), params,
+                                   graph ? &result.edges : nullptr);
+  return result;
+}
+
+}  // namespace
+
+PYBIND11_MODULE(lbgstippling, m) {
+  m.doc() = "Weighted Linde-Buzo-Gray stippling";
+
+  py::enum_<CellEngineType>(m, "CellEngine")
+      .value("GPU", CellEngineType::GPU)
+      .value("CPU", CellEngineType::CPU)
+      .value("Analytic", CellEngineType::Analytic)
+      .value("Distributed", CellEngineType::Distributed);
+
+  py::enum_<HysteresisSchedule>(m, "HysteresisSchedule")
+      .value("Linear", HysteresisSchedule::Linear)
+      .value("Adaptive", HysteresisSchedule::Adaptive);
+
+  py::class_<DensityTransform>(m, "DensityTransform")
+      .def(py::init<>())
+      .def_readwrite("gamma", &DensityTransform::gamma)
+      .def_readwrite("contrast", &DensityTransform::contrast)
+      .def_readwrite("invert", &DensityTransform::invert);
+
+  // Same names and defaults as LBGStippling::Params, except for the engine.
+  py::class_<Params>(m, "Params")
+      .def(py::init(&defaultParams))
+      .def_readwrite("initialPoints", &Params::initialPoints)
+      .def_readwrite("initialPointSize", &Params::initialPointSize)
+      .def_readwrite("adaptivePointSize", &Params::adaptivePointSize)
+      .def_readwrite("pointSizeMin", &Params::pointSizeMin)
+      .def_readwrite("pointSizeMax", &Params::pointSizeMax)
+      .def_readwrite("superSamplingFactor", &Params::superSamplingFactor)
+      .def_readwrite("maxIterations", &Params::maxIterations)
+      .def_readwrite("targetPoints", &Params::targetPoints)
+      .def_readwrite("targetTolerance", &Params::targetTolerance)
+      .def_readwrite("engine", &Params::engine)
+      .def_readwrite("preprocessing", &Params::preprocessing)
+      .def_readwrite("coneRadiusFactor", &Params::coneRadiusFactor)
+      .def_readwrite("hysteresis", &Params::hysteresis)
+      .def_readwrite("hysteresisDelta", &Params::hysteresisDelta)
+      .def_readwrite("hysteresisSchedule", &Params::hysteresisSchedule)
+      .def_readwrite("minPointChange", &Params::minPointChange)
+      .def_readwrite("maxMeanDisplacement", &Params::maxMeanDisplacement)
+      .def_readwrite("maxMaxDisplacement", &Params::maxMaxDisplacement)
+      .def_readwrite("minStableFraction", &Params::minStableFraction)
+      .def_readwrite("stableDisplacement", &Params::stableDisplacement)
+      .def_readwrite("freezeIterations", &Params::freezeIterations)
+      .def_readwrite("freezeDisplacement", &Params::freezeDisplacement)
+      .def_readwrite("freezeDensityChange", &Params::freezeDensityChange)
+      .def_readwrite("timeBudget", &Params::timeBudget)
+      .def_readwrite("seed", &Params::seed)
+      .def_readwrite("checkpointPath", &Params::checkpointPath)
+      .def_readwrite("checkpointInterval", &Params::checkpointInterval)
+      .def_readwrite("resume", &Params::resume);
+
+  m.def(
+      "stipple",
+      [](const GrayImage& image, const Params& params, bool graph) {
+        return resultArrays(stipple(image, params, graph), graph);
+      },
+      py::arg("image"), py::arg("params") = defaultParams(),
+      py::arg("graph") = false,
+      "Stipples a uint8 grayscale image of shape (h, w), dark is dense, and "
+      "returns a dict of float32 arrays x, y (normalized to [0, 1]) and "
+      "size. C-contiguous images are not copied. With graph, edges holds "
+      "the index pairs of neighbouring stipples, collected in the last "
+      "iteration, or in one more pass if the run stops before "
+      "maxIterations.");
+
+  m.def("setWorkers", &setStripWorkers, py::arg("addresses"),
+        "host:port addresses of the workers of the distributed engine");
+}
@@ -0,0 +1,72 @@
+# Tests of the Python module, run by ctest when built with -DLBG_PYTHON=ON:
+#
+#   PYTHONPATH=<build dir> python -m pytest python
+
+import numpy as np
+import pytest
+
+import lbgstippling
+
+
+def gradient(width=64, height=48):
+    x = np.arange(width, dtype=np.uint32)
+    y = np.arange(height, dtype=np.uint32)[:, None]
+    return ((x * 255 // width) ^ (y & 15)).astype(np.uint8)
+
+
+def small_params():
+    params = lbgstippling.Params()
+    params.initialPoints = 20
+    params.maxIterations = 10
+    params.seed = 3
+    return params
+
+
+def test_stipple():
+    image = gradient()
+    before = image.copy()
+    stipples = lbgstippling.stipple(image, small_params())
+
+    count = len(stipples["x"])
+    assert count > 0
+    for name in ("x", "y", "size"):
+        assert stipples[name].dtype == np.float32
+        assert stipples[name].shape == (count,)
+    assert np.all((stipples["x"] >= 0) & (stipples["x"] <= 1))
+    assert np.all((stipples["y"] >= 0) & (stipples["y"] <= 1))
+    assert np.all(stipples["size"] > 0)
+    # the image is read in place, never written
+    assert np.array_equal(image, before)
+
+
+def test_seeded_runs_repeat():
+    first = lbgstippling.stipple(gradient(), small_params())
+    second = lbgstippling.stipple(gradient(), small_params())
+    for name in ("x", "y", "size"):
+        assert np.array_equal(first[name], second[name])
+
+
+def test_strided_image_is_copied():
+    wide = np.repeat(gradient(), 2, axis=1)
+    strided = wide[:, ::2]
+    assert not strided.flags["C_CONTIGUOUS"]
+    stipples = lbgstippling.stipple(strided, small_params())
+    expected = lbgstippling.stipple(gradient(), small_params())
+    assert np.array_equal(stipples["x"], expected["x"])
+
+
+def test_graph():
+    stipples = lbgstippling.stipple(gradient(), small_params(), graph=True)
+    edges = stipples["edges"]
+    assert edges.dtype == np.uint32
+    assert edges.ndim == 2 and edges.shape[1] == 2
+    assert len(edges) > 0
+    assert np.all(edges[:, 0] < edges[:, 1])
+    assert np.all(edges[:, 1] < len(stipples["x"]))
+
+
+def test_rejects_other_shapes():
+    with pytest.raises(ValueError):
+        lbgstippling.stipple(np.zeros((4, 4, 3), np.uint8), small_params())
+    with pytest.raises(ValueError):
+        lbgstippling.stipple(np.zeros((0, 4), np.uint8), small_params())
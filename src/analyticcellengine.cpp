@@ -0,0 +1,353 @@
+#include "analyticcellengine.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <omp.h>
+
+#include "sitegrid.h"
+
+// Polygon vertex relative to its site. `edge` is the site whose bisector
+// forms the edge to the next vertex, or -1 for the image border.
+struct AnalyticCellEngine::Vertex {
+  double x;
+  double y;
+  int32_t edge;
+};
+
+namespace {
+
+using Vertex = AnalyticCellEngine::Vertex;
+
+struct Neighbour {
+  uint32_t index;
+  double x;  // relative to the site
+  double y;
+  double dist;
+};
+
+// Keeps the part of the convex polygon closer to the site (at the origin)
+// than to the neighbour at (nx, ny).
+void clip(const std::vector<Vertex>& polygon, double nx, double ny,
+          int32_t neighbour, std::vector<Vertex>& out) {
+  const double c = 0.5 * (nx * nx + ny * ny);
+  out.clear();
+  for (size_t i = 0; i < polygon.size(); ++i) {
+    const Vertex& p = polygon[i];
+    const Vertex& q = polygon[(i + 1) % polygon.size()];
+    const double fp = nx * p.x + ny * p.y - c;
+    const double fq = nx * q.x + ny * q.y - c;
+
+    if (fp <= 0.0) {
+      out.push_back(p);
+      if (fq > 0.0) {
+        const double t = fp / (fp - fq);
+        out.push_back({p.x + t * (q.x - p.x), p.y + t * (q.y - p.y),
+                       neighbour});
+      }
+    } else if (fq <= 0.0) {
+      const double t = fp / (fp - fq);
+      out.push_back({p.x + t * (q.x - p.x), p.y + t * (q.y - p.y), p.edge});
+    }
+  }
+}
+
+// Appends the parameters t in (0, 1) at which a + t * delta crosses an
+// integer, in increasing order.
+void pushCrossings(double a, double delta, std::vector<double>& ts) {
+  if (delta > 0.0) {
+    for (double k = std::floor(a) + 1.0; k < a + delta; k += 1.0)
+      ts.push_back((k - a) / delta);
+  } else if (delta < 0.0) {
+    for (double k = std::ceil(a) - 1.0; k > a + delta; k -= 1.0)
+      ts.push_back((k - a) / delta);
+  }
+}
+
+double maxVertexDistance(const std::vector<Vertex>& polygon) {
+  double r2 = 0.0;
+  for (const Vertex& v : polygon) r2 = std::max(r2, v.x * v.x + v.y * v.y);
+  return std::sqrt(r2);
+}
+
+}  // namespace
+
+AnalyticCellEngine::AnalyticCellEngine(
+    std::shared_ptr<const DensityMap> density)
+    : m_density(std::move(density)),
+      m_prefix(m_density->rowPrefix()),
+      m_width(m_density->width()),
+      m_height(m_density->height()) {}
+
+Moments AnalyticCellEngine::integrate(const std::vector<Vertex>& polygon,
+                                      double sx, double sy, bool orientation,
+                                      std::vector<double>& ts) const {
+  // Green's theorem: the integral of g over the cell equals the integral of
+  // G(x, y) dy along its border, with G the integral of g along x. For
+  // g = x^m y^k d we get G = y^k * P_m(x), where P_m is the row prefix of
+  // x^m * d, exact up to a polynomial within a pixel. Every edge is split
+  // at pixel borders and each piece (degree <= 3 in y) is integrated
+  // exactly with two-point Gauss-Legendre quadrature.
+  static const double gauss = 0.5 / std::sqrt(3.0);
+  const size_t stride = m_width + 1;
+  // with a mask the area is integrated like the density, from the prefix of
+  // the inside indicator
+  const bool masked = !m_prefix[3].empty();
+
+  double m00 = 0.0, m10 = 0.0, m01 = 0.0, m11 = 0.0, m20 = 0.0, m02 = 0.0;
+  double area = 0.0;
+  double insideArea = 0.0;
+
+  for (size_t i = 0; i < polygon.size(); ++i) {
+    const Vertex& a = polygon[i];
+    const Vertex& b = polygon[(i + 1) % polygon.size()];
+    area += a.x * b.y - b.x * a.y;
+
+    const double xa = sx + a.x, ya = sy + a.y;
+    const double dx = b.x - a.x, dy = b.y - a.y;
+    if (dy == 0.0) continue;  // horizontal edges do not contribute
+
+    // edge parameters of all pixel border crossings, in increasing order
+    ts.clear();
+    ts.push_back(0.0);
+    pushCrossings(xa, dx, ts);
+    const auto middle = ts.end() - ts.begin();
+    pushCrossings(ya, dy, ts);
+    std::inplace_merge(ts.begin() + 1, ts.begin() + middle, ts.end());
+    ts.push_back(1.0);
+
+    for (size_t k = 0; k + 1 < ts.size(); ++k) {
+      const double len = ts[k + 1] - ts[k];
+      if (len <= 0.0) continue;
+      const double tm = 0.5 * (ts[k] + ts[k + 1]);
+      const int c = std::min(m_width - 1,
+                             std::max(0, static_cast<int>(xa + tm * dx)));
+      const int r = std::min(m_height - 1,
+                             std::max(0, static_cast<int>(ya + tm * dy)));
+
+      const bool in = !masked || m_density->inside(c, r);
+      const double d = in ? m_density->at(c, r) : 0.0;
+      const size_t base = r * stride + c;
+      const double s0 = m_prefix[0][base];
+      const double s1 = m_prefix[1][base] - d * c * c / 2.0;
+      const double s2 = m_prefix[2][base] - d * c * c * c / 3.0;
+      const double s3 = masked ? m_prefix[3][base] : 0.0;
+      const double weight = 0.5 * len * dy;
+
+      for (const double t : {tm - gauss * len, tm + gauss * len}) {
+        const double x = xa + t * dx;
+        const double y = ya + t * dy;
+        const double p0 = s0 + d * (x - c);
+        const double p1 = s1 + d * x * x / 2.0;
+        const double p2 = s2 + d * x * x * x / 3.0;
+        m00 += weight * p0;
+        m10 += weight * p1;
+        m01 += weight * y * p0;
+        if (orientation) {
+          m20 += weight * p2;
+          m11 += weight * y * p1;
+          m02 += weight * y * y * p0;
+        }
+        insideArea += weight * (s3 + in * (x - c));
+      }
+    }
+  }
+
+  // about the site, before the precision of doubles is given up
+  Moments m;
+  m.area = static_cast<float>(masked ? insideArea : 0.5 * area);
+  m.moment00 = static_cast<float>(m00);
+  m.moment10 = static_cast<float>(m10 - sx * m00);
+  m.moment01 = static_cast<float>(m01 - sy * m00);
+  m.moment20 = static_cast<float>(m20 - 2.0 * sx * m10 + sx * sx * m00);
+  m.moment02 = static_cast<float>(m02 - 2.0 * sy * m01 + sy * sy * m00);
+  m.moment11 = static_cast<float>(m11 - sx * m01 - sy * m10 + sx * sy * m00);
+  return m;
+}
+
+CellResult AnalyticCellEngine::compute(const StippleView& sites,
+                                       const CellQuery& query) {
+  assert(!sites.empty());
+
+  const float spacing = std::sqrt(
+      static_cast<float>(std::max<size_t>(1, m_density->area())) /
+      sites.size());
+  const SiteGrid grid(sites, m_width, m_height, spacing);
+  const double diagonal = std::hypot(m_width, m_height);
+  const QRect bounds = m_density->bounds();
+  const double left = bounds.left();
+  const double top = bounds.top();
+  const double right = bounds.right() + 1.0;
+  const double bottom = bounds.bottom() + 1.0;
+
+  std::vector<Moments> moments(sites.size());
+  CellResult result;
+  result.skipped.assign(sites.size(), 0);
+  // pairs of neighbouring cells of all threads, packed
+  std::vector<uint64_t> packed;
+  // frozen cells skipped although on a border
+  std::vector<uint32_t> missed;
+
+  #pragma omp parallel
+  {
+    std::vector<uint32_t> indices;
+    std::vector<Neighbour> neighbours;
+    std::vector<Vertex> polygon;
+    std::vector<Vertex> clipped;
+    std::vector<double> ts;
+    std::vector<std::pair<uint32_t, uint32_t>> borders;
+    std::vector<uint64_t> edges;
+
+    // Clips the bounding box of the mask down to the cell of site i.
+    auto cellPolygon = [&](uint32_t i) {
+      const double sx = grid.x(i);
+      const double sy = grid.y(i);
+
+      // cells start as the bounding box of the mask, nothing outside it
+      // has density or area
+      polygon = {{left - sx, top - sy, -1},
+                 {right - sx, top - sy, -1},
+                 {right - sx, bottom - sy, -1},
+                 {left - sx, bottom - sy, -1}};
+      double reach = maxVertexDistance(polygon);
+
+      // Clip by neighbours in order of distance. A neighbour further than
+      // twice the furthest vertex cannot cut the cell any more; if the
+      // gathered ones run out before that, gather a larger ring.
+      double done = -1.0;
+      double radius = 2.5 * spacing;
+      bool complete = false;
+      while (!complete && !polygon.empty()) {
+        indices.clear();
+        grid.gather(sx, sy, radius, indices);
+        neighbours.clear();
+        for (uint32_t j : indices) {
+          if (j == i) continue;
+          const double nx = grid.x(j) - sx;
+          const double ny = grid.y(j) - sy;
+          const double dist = std::hypot(nx, ny);
+          if (dist > done) neighbours.push_back({j, nx, ny, dist});
+        }
+        std::sort(neighbours.begin(), neighbours.end(),
+                  [](const Neighbour& a, const Neighbour& b) {
+                    return a.dist < b.dist;
+                  });
+
+        for (const Neighbour& n : neighbours) {
+          if (n.dist > 2.0 * reach) {
+            complete = true;
+            break;
+          }
+          if (n.dist == 0.0) {
+            // coincident sites: the lower index owns the cell
+            if (n.index < i) polygon.clear();
+            if (polygon.empty()) break;
+            continue;
+          }
+          clip(polygon, n.x, n.y, static_cast<int32_t>(n.index), clipped);
+          polygon.swap(clipped);
+          if (polygon.empty()) break;
+          reach = maxVertexDistance(polygon);
+        }
+
+        complete |= 2.0 * reach <= radius || radius >= diagonal;
+        done = radius;
+        radius *= 2.0;
+      }
+    };
+    // Integrates the polygon of site i, unless it is entirely outside the
+    // mask and has nothing to integrate.
+    auto integrateCell = [&](uint32_t i) {
+      const double sx = grid.x(i);
+      const double sy = grid.y(i);
+      if (m_density->isMasked()) {
+        double x0 = right, y0 = bottom, x1 = left, y1 = top;
+        for (const Vertex& v : polygon) {
+          x0 = std::min(x0, sx + v.x);
+          y0 = std::min(y0, sy + v.y);
+          x1 = std::max(x1, sx + v.x);
+          y1 = std::max(y1, sy + v.y);
+        }
+        if (!m_density->occupied(static_cast<int>(x0), static_cast<int>(y0),
+                                 static_cast<int>(std::ceil(x1)),
+                                 static_cast<int>(std::ceil(y1))))
+          return;
+      }
+      moments[i] = integrate(polygon, sx, sy, query.orientation, ts);
+    };
+
+    #pragma omp for schedule(dynamic, 64) nowait
+    for (int64_t s = 0; s < static_cast<int64_t>(sites.size()); ++s) {
+      const uint32_t i = static_cast<uint32_t>(s);
+      cellPolygon(i);
+      if (polygon.size() < 3) {
+        // a cell without a polygon borders nothing either
+        if (query.frozen) result.skipped[i] = (*query.frozen)[i];
+        continue;
+      }
+
+      if (query.adjacency) {
+        // every neighbour cutting the cell shares an edge with it, both
+        // cells report the pair in case one of them rounds the edge away
+        for (const Vertex& v : polygon) {
+          if (v.edge < 0) continue;
+          const uint32_t j = static_cast<uint32_t>(v.edge);
+          edges.push_back(packPair(std::min(i, j), std::max(i, j)));
+        }
+      }
+
+      if (query.frozen) {
+        // Both cells of a border report it, as with the neighbours. A
+        // frozen cell is recomputed only next to a non-frozen one.
+        const bool frozen = (*query.frozen)[i];
+        bool border = false;
+        for (const Vertex& v : polygon) {
+          if (v.edge < 0 || (*query.frozen)[v.edge] == frozen) continue;
+          const uint32_t j = static_cast<uint32_t>(v.edge);
+          borders.push_back(frozen ? std::make_pair(i, j)
+                                   : std::make_pair(j, i));
+          border = true;
+        }
+        if (frozen && !border) {
+          result.skipped[i] = 1;
+          continue;
+        }
+      }
+
+      integrateCell(i);
+    }
+
+    #pragma omp critical
+    {
+      result.frozenBorders.insert(result.frozenBorders.end(), borders.begin(),
+                                  borders.end());
+      packed.insert(packed.end(), edges.begin(), edges.end());
+    }
+
+    if (query.frozen) {
+      // frozen cells only their non-frozen neighbour found the border with
+      #pragma omp barrier
+      #pragma omp single
+      {
+        std::vector<std::pair<uint32_t, uint32_t>>& all = result.frozenBorders;
+        std::sort(all.begin(), all.end());
+        all.erase(std::unique(all.begin(), all.end()), all.end());
+        for (const auto& border : all) {
+          if (!result.skipped[border.first]) continue;
+          result.skipped[border.first] = 0;
+          missed.push_back(border.first);
+        }
+      }
+      #pragma omp for schedule(dynamic, 64)
+      for (int64_t k = 0; k < static_cast<int64_t>(missed.size()); ++k) {
+        cellPolygon(missed[k]);
+        if (polygon.size() >= 3) integrateCell(missed[k]);
+      }
+    }
+  }
+  if (query.adjacency) result.adjacency = unpackPairs(packed);
+
+  result.cells = cellsFromMoments(moments, sites, m_width, m_height, 1.0f,
+                                  query.orientation);
+  return result;
+}
@@ -0,0 +1,35 @@
+#ifndef ANALYTICCELLENGINE_H
+#define ANALYTICCELLENGINE_H
+
+#include "cellengine.h"
+#include "densitymap.h"
+
+// CPU engine that computes the exact Voronoi polygon of every site by
+// half-plane clipping and integrates the piecewise constant density over
+// it with Green's theorem. The integrals along the polygon edges are
+// looked up in the per-row prefix sums of d, x * d and x^2 * d of the
+// density map, built once per map, so the cost of an iteration grows with
+// the number of sites and the length of the cell borders, not with the
+// image area. Cells outside the mask of a masked map are not integrated.
+class AnalyticCellEngine : public CellEngine {
+ public:
+  explicit AnalyticCellEngine(std::shared_ptr<const DensityMap> density);
+
+  CellResult compute(const StippleView& sites,
+                     const CellQuery& query) override;
+
+  struct Vertex;  // polygon vertex, defined with the engine
+
+ private:
+  std::shared_ptr<const DensityMap> m_density;
+  const std::array<std::vector<double>, 4>& m_prefix;
+  int m_width;
+  int m_height;
+
+  // Moments of a polygon given relative to the site at (sx, sy), taken about
+  // the site, without the second order ones unless `orientation` is set.
+  Moments integrate(const std::vector<Vertex>& polygon, double sx, double sy,
+                    bool orientation, std::vector<double>& ts) const;
+};
+
+#endif  // ANALYTICCELLENGINE_H
@@ -0,0 +1,107 @@
+#include "cellengine.h"
+
+#include "analyticcellengine.h"
+#include "distributedcellengine.h"
+#include "fusedcellengine.h"
+#include "voronoidiagram.h"
+
+namespace {
+
+// Diagram of the last finished GPU engine while prepareCellEngine() is in
+// effect, so that the next one skips the context creation and shader
+// compilation. Kept per thread, a context is bound to the thread that
+// created it.
+thread_local bool keepDiagrams = false;
+thread_local std::unique_ptr<VoronoiDiagram> idleDiagram;
+
+std::unique_ptr<VoronoiDiagram> takeDiagram(const QSize& size) {
+  if (!idleDiagram) return std::make_unique<VoronoiDiagram>(size);
+  std::unique_ptr<VoronoiDiagram> diagram = std::move(idleDiagram);
+  diagram->resize(size);
+  return diagram;
+}
+
+}  // namespace
+
+// Renders the Voronoi diagram with OpenGL at the supersampled resolution
+// and accumulates the cells from the resulting index map. Unlike the CPU
+// engine it does not benefit from sampling the density in place: the
+// framebuffer and the index map (4 bytes per sample) grow with the square
+// of the supersampling factor.
+class GPUCellEngine : public CellEngine {
+ public:
+  GPUCellEngine(std::shared_ptr<const DensityMap> density, int superSampling)
+      : m_density(std::move(density)),
+        m_superSampling(superSampling),
+        m_voronoi(takeDiagram(
+            QSize(m_density->width(), m_density->height()) * superSampling)) {
+  }
+
+  ~GPUCellEngine() override {
+    if (keepDiagrams) idleDiagram = std::move(m_voronoi);
+  }
+
+  CellResult compute(const StippleView& sites,
+                     const CellQuery& query) override {
+    // the diagram measures radii in its own, supersampled pixels
+    std::vector<float> radii;
+    if (query.radii) {
+      radii.reserve(query.radii->size());
+      for (const float radius : *query.radii)
+        radii.push_back(radius * m_superSampling);
+    }
+    auto indexMap = m_voronoi->calculate(sites, radii, m_superSampling);
+
+    CellResult result;
+    result.skipped.assign(sites.size(), 0);
+    if (query.frozen) {
+      // frozen cells next to non-frozen ones still have to be recomputed
+      result.frozenBorders = findFrozenBorders(indexMap, *query.frozen);
+      result.skipped = *query.frozen;
+      for (const auto& border : result.frozenBorders)
+        result.skipped[border.first] = 0;
+    }
+
+    result.cells = accumulateCells(indexMap, *m_density, sites,
+                                   m_superSampling,
+                                   query.frozen ? &result.skipped : nullptr,
+                                   query.orientation,
+                                   query.adjacency ? &result.adjacency
+                                                   : nullptr);
+    return result;
+  }
+
+ private:
+  std::shared_ptr<const DensityMap> m_density;
+  int m_superSampling;
+  std::unique_ptr<VoronoiDiagram> m_voronoi;
+};
+
+void prepareCellEngine(CellEngineType type) {
+  keepDiagrams = true;
+  if (type == CellEngineType::GPU && !idleDiagram)
+    idleDiagram = std::make_unique<VoronoiDiagram>(QSize(1, 1));
+}
+
+void releaseCellEngines() {
+  keepDiagrams = false;
+  idleDiagram.reset();
+}
+
+std::unique_ptr<CellEngine> createCellEngine(
+    CellEngineType type, std::shared_ptr<const DensityMap> density,
+    int superSampling) {
+  switch (type) {
+    case CellEngineType::CPU:
+      return std::make_unique<FusedCellEngine>(density, superSampling);
+    case CellEngineType::Analytic:
+      // integrates exactly, there is nothing to supersample
+      return std::make_unique<AnalyticCellEngine>(density);
+    case CellEngineType::Distributed:
+      return std::make_unique<DistributedCellEngine>(density, superSampling,
+                                                     stripWorkers());
+    case CellEngineType::GPU:
+    default:
+      return std::make_unique<GPUCellEngine>(density, superSampling);
+  }
+}
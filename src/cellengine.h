@@ -0,0 +1,73 @@
+#ifndef CELLENGINE_H
+#define CELLENGINE_H
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "densitymap.h"
+#include "stippleset.h"
+#include "voronoicell.h"
+
+enum class CellEngineType {
+  GPU,  // cones rendered with OpenGL, then accumulated from the index map
+  CPU,  // fused nearest-site search and accumulation, tile by tile
+  Analytic,  // exact Voronoi polygons integrated with prefix sums
+  Distributed  // CPU engine on strips of the image in worker processes
+};
+
+struct CellQuery {
+  // Optional cone radii per site (in pixels of the input image), a hint
+  // for engines that rasterize distance cones.
+  const std::vector<float>* radii = nullptr;
+
+  // Optional frozen flags per site. Engines may skip the accumulation of
+  // frozen cells that do not border a non-frozen cell.
+  const std::vector<uint8_t>* frozen = nullptr;
+
+  // Whether cell orientations are needed. Engines may skip the second order
+  // moments otherwise and leave all orientations at zero.
+  bool orientation = true;
+
+  // Whether to collect the pairs of neighbouring cells, the Delaunay graph
+  // of the sites as far as the cells are resolved.
+  bool adjacency = false;
+};
+
+struct CellResult {
+  // One cell per site, in the order of the sites. Areas and densities are
+  // given in pixels of the input image, whatever the supersampling.
+  std::vector<VoronoiCell> cells;
+  // Frozen cells whose moments were not recomputed.
+  std::vector<uint8_t> skipped;
+  // (frozen, non-frozen) pairs of neighbouring cells found while skipping.
+  std::vector<std::pair<uint32_t, uint32_t>> frozenBorders;
+  // (i, j) pairs of neighbouring cells with i < j, sorted, if asked for.
+  std::vector<std::pair<uint32_t, uint32_t>> adjacency;
+};
+
+// Computes the Voronoi cells of a set of sites on a grayscale density map.
+// Engines that sample the image take `superSampling` x `superSampling`
+// samples per pixel, interpolated from the image at its own resolution.
+class CellEngine {
+ public:
+  virtual ~CellEngine() = default;
+
+  virtual CellResult compute(const StippleView& sites,
+                             const CellQuery& query) = 0;
+};
+
+std::unique_ptr<CellEngine> createCellEngine(
+    CellEngineType type, std::shared_ptr<const DensityMap> density,
+    int superSampling = 1);
+
+// From now on, engines on the calling thread keep what can be reused
+// between runs (the OpenGL context and shaders of the GPU engine) instead
+// of tearing it down, and what engines of the given type need is set up
+// right away. releaseCellEngines() frees it again, it has to be called
+// while the application object still exists.
+void prepareCellEngine(CellEngineType type);
+void releaseCellEngines();
+
+#endif  // CELLENGINE_H
@@ -0,0 +1,174 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+const char fileMagic[4] = {'L', 'B', 'G', 'C'};
+// Status and VoronoiCell are stored as they are in memory, a file only
+// resumes runs of the same build
+const uint32_t fileVersion = 1;
+const uint32_t layout[2] = {sizeof(LBGStippling::Status), sizeof(VoronoiCell)};
+
+template <class T>
+void put(std::ostream& file, const T& value) {
+  file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <class T>
+void putArray(std::ostream& file, const T* data, uint64_t count) {
+  put(file, count);
+  file.write(reinterpret_cast<const char*>(data), count * sizeof(T));
+}
+
+template <class T>
+bool get(std::istream& file, T& value) {
+  return static_cast<bool>(
+      file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+// Bytes between the read position and the end of `file`.
+uint64_t remainingBytes(std::istream& file) {
+  const std::streamoff start = file.tellg();
+  file.seekg(0, std::ios::end);
+  const std::streamoff end = file.tellg();
+  file.seekg(start);
+  return file && end >= start ? static_cast<uint64_t>(end - start) : 0;
+}
+
+// The count is checked against the rest of the file before it sizes the
+// array, a damaged count cannot ask for more memory than the file holds.
+template <class T>
+bool getArray(std::istream& file, std::vector<T>& values) {
+  uint64_t count = 0;
+  if (!get(file, count) || count > remainingBytes(file) / sizeof(T))
+    return false;
+  values.resize(count);
+  return static_cast<bool>(file.read(reinterpret_cast<char*>(values.data()),
+                                     count * sizeof(T)));
+}
+
+}  // namespace
+
+bool Checkpoint::read(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  char magic[4];
+  uint32_t version = 0;
+  uint32_t sizes[2] = {0, 0};
+  file.read(magic, sizeof(magic));
+  if (!get(file, version) || !get(file, sizes) ||
+      std::memcmp(magic, fileMagic, sizeof(magic)) != 0 ||
+      version != fileVersion || std::memcmp(sizes, layout, sizeof(layout)))
+    return false;
+
+  std::vector<float> x, y, size;
+  std::vector<char> randomState;
+  const bool ok = get(file, key) && get(file, status) &&
+                  get(file, thresholdScale) && get(file, thresholdTrim) &&
+                  get(file, hysteresis) &&
+                  get(file, direction) && get(file, stalls) &&
+                  getArray(file, x) && getArray(file, y) &&
+                  getArray(file, size) && getArray(file, stableIterations) &&
+                  getArray(file, cells) && getArray(file, radii) &&
+                  getArray(file, randomState);
+  // the per-stipple arrays are either left out or cover every stipple
+  auto covers = [&x](size_t count) { return count == 0 || count == x.size(); };
+  if (!ok || y.size() != x.size() || size.size() != x.size() ||
+      stableIterations.size() != cells.size() ||
+      !covers(stableIterations.size()) || !covers(radii.size()))
+    return false;
+
+  stipples.clear();
+  stipples.reserve(x.size());
+  for (size_t i = 0; i < x.size(); ++i)
+    stipples.push_back(QVector2D(x[i], y[i]), size[i]);
+  random.assign(randomState.begin(), randomState.end());
+  return true;
+}
+
+bool Checkpoint::fits(const LBGStippling::Params& params) const {
+  const size_t count = stipples.size();
+  const size_t tracked = params.freezeIterations > 0 ? count : 0;
+  const size_t bounded = params.coneRadiusFactor > 0.0f ? count : 0;
+  return stableIterations.size() == tracked && cells.size() == tracked &&
+         radii.size() == bounded;
+}
+
+bool Checkpoint::write(const std::string& path) const {
+  // write next to the target and rename, a run killed while writing keeps
+  // the previous checkpoint
+  const std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file) return false;
+    const StippleView view = stipples.view();
+    file.write(fileMagic, sizeof(fileMagic));
+    put(file, fileVersion);
+    put(file, layout);
+    put(file, key);
+    put(file, status);
+    put(file, thresholdScale);
+    put(file, thresholdTrim);
+    put(file, hysteresis);
+    put(file, direction);
+    put(file, stalls);
+    putArray(file, view.x(), view.size());
+    putArray(file, view.y(), view.size());
+    putArray(file, view.sizes(), view.size());
+    putArray(file, stableIterations.data(), stableIterations.size());
+    putArray(file, cells.data(), cells.size());
+    putArray(file, radii.data(), radii.size());
+    putArray(file, random.data(), random.size());
+    if (!file) {
+      file.close();
+      std::remove(tmpPath.c_str());
+      return false;
+    }
+  }
+  return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+CheckpointWriter::CheckpointWriter(const std::string& path)
+    : m_path(path), m_thread(&CheckpointWriter::run, this) {}
+
+CheckpointWriter::~CheckpointWriter() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_one();
+  m_thread.join();
+}
+
+void CheckpointWriter::write(std::unique_ptr<Checkpoint> checkpoint) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending = std::move(checkpoint);
+  }
+  m_wake.notify_one();
+}
+
+void CheckpointWriter::remove() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_pending.reset();
+  m_idle.wait(lock, [this]() { return !m_writing; });
+  std::remove(m_path.c_str());
+}
+
+void CheckpointWriter::run() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (;;) {
+    m_wake.wait(lock, [this]() { return m_stop || m_pending; });
+    // a pending checkpoint is still written when stopping
+    if (!m_pending) return;
+    std::unique_ptr<Checkpoint> checkpoint = std::move(m_pending);
+    m_writing = true;
+    lock.unlock();
+    checkpoint->write(m_path);
+    lock.lock();
+    m_writing = false;
+    m_idle.notify_all();
+  }
+}
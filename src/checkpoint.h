@@ -0,0 +1,67 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lbgstippling.h"
+#include "stippleset.h"
+#include "voronoicell.h"
+
+// State of a stippling run between two iterations, enough to continue it
+// exactly where it stopped.
+struct Checkpoint {
+  uint64_t key = 0;  // density map and parameters the run belongs to
+  LBGStippling::Status status = {0, 0, 0, 0, 0.0f};
+  float thresholdScale = 1.0f;
+  float thresholdTrim = 1.0f;  // target mode
+  // adaptive hysteresis schedule
+  float hysteresis = 0.0f;
+  int32_t direction = 0;
+  uint64_t stalls = 0;
+  StippleSet stipples;
+  std::vector<uint8_t> stableIterations;  // with freezing only
+  std::vector<VoronoiCell> cells;         // with freezing only
+  std::vector<float> radii;               // with bounded cones only
+  std::string random;                     // state of the generator
+
+  // Returns false if the file is missing, damaged or from another version.
+  bool read(const std::string& path);
+  // Whether the per-stipple arrays are there exactly for the freezing and
+  // bounded cone modes of `params`.
+  bool fits(const LBGStippling::Params& params) const;
+  bool write(const std::string& path) const;
+};
+
+// Writes checkpoints of one run on a background thread, so the iterations
+// never wait for the disk. A checkpoint handed over while the previous one
+// is still being written replaces any older pending one.
+class CheckpointWriter {
+ public:
+  explicit CheckpointWriter(const std::string& path);
+  // Finishes the pending write.
+  ~CheckpointWriter();
+
+  void write(std::unique_ptr<Checkpoint> checkpoint);
+  // Drops the pending write and deletes the file, once a run has finished.
+  void remove();
+
+ private:
+  std::string m_path;
+  std::unique_ptr<Checkpoint> m_pending;
+  bool m_stop = false;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_idle;
+  bool m_writing = false;
+  std::thread m_thread;
+
+  void run();
+};
+
+#endif  // CHECKPOINT_H
@@ -0,0 +1,142 @@
+#include "connection.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+namespace {
+
+void setNoDelay(int socket) {
+  // requests and replies are single messages, do not hold them back
+  const int on = 1;
+  setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+}  // namespace
+
+Connection::Connection(int socket) : m_socket(socket) {}
+
+Connection::~Connection() {
+  if (m_socket >= 0) close(m_socket);
+}
+
+std::unique_ptr<Connection> Connection::open(const std::string& host,
+                                             uint16_t port) {
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addresses = nullptr;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                  &addresses) != 0)
+    return nullptr;
+
+  int socket = -1;
+  for (addrinfo* a = addresses; a && socket < 0; a = a->ai_next) {
+    socket = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (socket >= 0 && ::connect(socket, a->ai_addr, a->ai_addrlen) != 0) {
+      close(socket);
+      socket = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (socket < 0) return nullptr;
+
+  setNoDelay(socket);
+  return std::make_unique<Connection>(socket);
+}
+
+bool Connection::send(const void* data, size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0 && m_socket >= 0) {
+    const ssize_t sent = ::send(m_socket, bytes, size, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) continue;
+    if (sent <= 0) {
+      close(m_socket);
+      m_socket = -1;
+      break;
+    }
+    bytes += sent;
+    size -= sent;
+  }
+  return m_socket >= 0;
+}
+
+bool Connection::receive(void* data, size_t size) {
+  char* bytes = static_cast<char*>(data);
+  while (size > 0 && m_socket >= 0) {
+    const ssize_t received = ::recv(m_socket, bytes, size, 0);
+    if (received < 0 && errno == EINTR) continue;
+    if (received <= 0) {
+      close(m_socket);
+      m_socket = -1;
+      break;
+    }
+    bytes += received;
+    size -= received;
+  }
+  return m_socket >= 0;
+}
+
+Listener::Listener(int socket, uint16_t port)
+    : m_socket(socket), m_port(port) {}
+
+Listener::~Listener() { close(m_socket); }
+
+std::unique_ptr<Listener> Listener::open(uint16_t port,
+                                         const std::string& host) {
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+  addrinfo* addresses = nullptr;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                  &addresses) != 0)
+    return nullptr;
+
+  int socket = -1;
+  for (addrinfo* a = addresses; a && socket < 0; a = a->ai_next) {
+    socket = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (socket < 0) continue;
+    // the IPv6 wildcard accepts IPv4 as well, and rebind right after a
+    // restart
+    const int off = 0;
+    const int on = 1;
+    if (a->ai_family == AF_INET6)
+      setsockopt(socket, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(socket, a->ai_addr, a->ai_addrlen) != 0 ||
+        listen(socket, 16) != 0) {
+      close(socket);
+      socket = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (socket < 0) return nullptr;
+
+  sockaddr_storage address = {};
+  socklen_t length = sizeof(address);
+  if (getsockname(socket, reinterpret_cast<sockaddr*>(&address), &length) !=
+      0) {
+    close(socket);
+    return nullptr;
+  }
+  const uint16_t bound =
+      address.ss_family == AF_INET6
+          ? reinterpret_cast<const sockaddr_in6*>(&address)->sin6_port
+          : reinterpret_cast<const sockaddr_in*>(&address)->sin_port;
+  return std::unique_ptr<Listener>(new Listener(socket, ntohs(bound)));
+}
+
+std::unique_ptr<Connection> Listener::accept() {
+  int socket = -1;
+  do {
+    socket = ::accept(m_socket, nullptr, nullptr);
+  } while (socket < 0 && errno == EINTR);
+  if (socket < 0) return nullptr;
+  setNoDelay(socket);
+  return std::make_unique<Connection>(socket);
+}
@@ -0,0 +1,76 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Blocking TCP connection that sends and receives whole buffers. Any
+// failure leaves the connection broken, every later call fails as well.
+class Connection {
+ public:
+  explicit Connection(int socket);
+  ~Connection();
+  Connection(const Connection&) = delete;
+  Connection& operator=(const Connection&) = delete;
+
+  // Null if nothing accepts connections at host:port.
+  static std::unique_ptr<Connection> open(const std::string& host,
+                                          uint16_t port);
+
+  bool send(const void* data, size_t size);
+  bool receive(void* data, size_t size);
+
+  template <class T>
+  bool send(const T& value) {
+    return send(&value, sizeof(T));
+  }
+  template <class T>
+  bool receive(T& value) {
+    return receive(&value, sizeof(T));
+  }
+  // Arrays go with their element count in front. A count above `maxCount`
+  // fails before anything is allocated for it.
+  template <class T>
+  bool sendArray(const T* data, uint64_t count) {
+    return send(count) && send(data, count * sizeof(T));
+  }
+  template <class T>
+  bool receiveArray(std::vector<T>& values, uint64_t maxCount) {
+    uint64_t count = 0;
+    if (!receive(count) || count > maxCount) return false;
+    values.resize(count);
+    return receive(values.data(), count * sizeof(T));
+  }
+
+ private:
+  int m_socket;
+};
+
+// Listening TCP socket.
+class Listener {
+ public:
+  ~Listener();
+  Listener(const Listener&) = delete;
+  Listener& operator=(const Listener&) = delete;
+
+  // Listens on the local address `host`, loopback unless another address
+  // is given explicitly ("::" or "0.0.0.0" for all interfaces). Port zero
+  // picks a free port. Null if the address cannot be bound.
+  static std::unique_ptr<Listener> open(uint16_t port,
+                                        const std::string& host = "127.0.0.1");
+
+  uint16_t port() const { return m_port; }
+  // Waits for the next connection, null on failure.
+  std::unique_ptr<Connection> accept();
+
+ private:
+  int m_socket;
+  uint16_t m_port;
+
+  Listener(int socket, uint16_t port);
+};
+
+#endif  // CONNECTION_H
@@ -0,0 +1,18 @@
+#ifndef CONTENTHASH_H
+#define CONTENTHASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+// 64 bit FNV-1a, `hash` continues a previous hash.
+inline uint64_t hashBytes(const void* data, size_t size,
+                          uint64_t hash = 14695981039346656037ull) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+#endif  // CONTENTHASH_H
@@ -0,0 +1,201 @@
+#include "densitycache.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <omp.h>
+#include <vector>
+
+#include "contenthash.h"
+
+namespace {
+
+const char fileMagic[4] = {'L', 'B', 'G', 'D'};
+const uint32_t fileVersion = 2;
+
+// Hash of the visible pixels (without scan line padding) and the colour
+// table, rows in parallel. Bits past the last pixel of a row are left out.
+uint64_t hashImage(const QImage& image) {
+  const int height = image.height();
+  const size_t lineBits = static_cast<size_t>(image.width()) * image.depth();
+  const size_t lineBytes = lineBits / 8;
+  const int tailBits = static_cast<int>(lineBits % 8);
+  // pixels of a partial last byte, from its top bit unless the format
+  // stores the leftmost pixel in the lowest one
+  const uint8_t tailMask =
+      image.format() == QImage::Format_MonoLSB
+          ? static_cast<uint8_t>((1 << tailBits) - 1)
+          : static_cast<uint8_t>(0xff00 >> tailBits);
+  std::vector<uint64_t> rows(height);
+
+  #pragma omp parallel for
+  for (int y = 0; y < height; ++y) {
+    const uchar* line = image.constScanLine(y);
+    rows[y] = hashBytes(line, lineBytes);
+    if (tailBits > 0) {
+      const uint8_t tail = line[lineBytes] & tailMask;
+      rows[y] = hashBytes(&tail, 1, rows[y]);
+    }
+  }
+
+  const int header[3] = {image.width(), height,
+                         static_cast<int>(image.format())};
+  const QVector<QRgb> colors = image.colorTable();
+  uint64_t hash = hashBytes(header, sizeof(header));
+  hash = hashBytes(colors.constData(), colors.size() * sizeof(QRgb), hash);
+  return hashBytes(rows.data(), rows.size() * sizeof(uint64_t), hash);
+}
+
+uint64_t cacheKey(const QImage& image, const DensityTransform& transform) {
+  const float values[3] = {transform.gamma, transform.contrast,
+                           transform.invert ? 1.0f : 0.0f};
+  return hashBytes(values, sizeof(values), hashImage(image));
+}
+
+// Files are identified by path, size and modification time, so that a hit
+// needs no decoding at all.
+uint64_t fileKey(const QString& path, const DensityTransform& transform,
+                 int width) {
+  const QFileInfo info(path);
+  const std::string name = info.absoluteFilePath().toStdString();
+  const qint64 stamp[3] = {info.size(),
+                           info.lastModified().toMSecsSinceEpoch(), width};
+  const float values[3] = {transform.gamma, transform.contrast,
+                           transform.invert ? 1.0f : 0.0f};
+  uint64_t hash = hashBytes(name.data(), name.size());
+  hash = hashBytes(stamp, sizeof(stamp), hash);
+  return hashBytes(values, sizeof(values), hash);
+}
+
+}  // namespace
+
+DensityCache::DensityCache(size_t capacity) : m_capacity(capacity) {}
+
+void DensityCache::setDirectory(const QString& path) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_directory = path;
+  if (!m_directory.isEmpty()) QDir().mkpath(m_directory);
+}
+
+std::shared_ptr<const DensityMap> DensityCache::get(
+    const QImage& image, const DensityTransform& transform) {
+  return get(cacheKey(image, transform), image.width(), image.height(),
+             [&]() { return std::make_shared<DensityMap>(image, transform); });
+}
+
+std::shared_ptr<const DensityMap> DensityCache::read(
+    const QString& path, const DensityTransform& transform, int width) {
+  return get(fileKey(path, transform, width), width, 0,
+             [&]() { return DensityMap::read(path, transform, width); });
+}
+
+DensityCache::Inks DensityCache::readSeparated(
+    const QString& path, const DensityTransform& transform, int width) {
+  const uint64_t key = fileKey(path, transform, width);
+  DensityMap::Inks separated;  // decoded on the first miss only
+  Inks inks;
+  for (int ink = 0; ink < DensityMap::InkCount; ++ink) {
+    const uint64_t inkKey = hashBytes(&ink, sizeof(ink), key);
+    inks[ink] =
+        get(inkKey, width, 0, [&]() -> std::shared_ptr<const DensityMap> {
+          if (!separated[0])
+            separated = DensityMap::readSeparated(path, transform, width);
+          return separated[ink];
+        });
+    if (!inks[ink]) return Inks();
+  }
+  return inks;
+}
+
+std::shared_ptr<const DensityMap> DensityCache::get(
+    uint64_t key, int width, int height,
+    const std::function<std::shared_ptr<const DensityMap>()>& build) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+    if (it->key == key) {
+      m_entries.splice(m_entries.begin(), m_entries, it);
+      return it->map;
+    }
+  }
+
+  std::shared_ptr<const DensityMap> map = load(key, width, height);
+  if (!map) {
+    map = build();
+    if (!map) return nullptr;
+    store(key, *map);
+  }
+
+  m_entries.push_front({key, map});
+  if (m_entries.size() > m_capacity) m_entries.pop_back();
+  return map;
+}
+
+QString DensityCache::filePath(uint64_t key) const {
+  return QDir(m_directory)
+      .filePath(QString("%1.density").arg(key, 16, 16, QChar('0')));
+}
+
+std::shared_ptr<const DensityMap> DensityCache::load(uint64_t key, int width,
+                                                     int height) const {
+  if (m_directory.isEmpty()) return nullptr;
+
+  std::ifstream file(filePath(key).toStdString(), std::ios::binary);
+  if (!file) return nullptr;
+
+  char magic[4];
+  uint32_t version = 0;
+  int32_t size[2] = {0, 0};
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char*>(&version), sizeof(version));
+  file.read(reinterpret_cast<char*>(size), sizeof(size));
+  if (!file || std::memcmp(magic, fileMagic, sizeof(magic)) != 0 ||
+      version != fileVersion || size[0] <= 0 || size[1] <= 0)
+    return nullptr;
+  if ((width > 0 && size[0] != width) || (height > 0 && size[1] != height))
+    return nullptr;
+
+  // the plane has to fill the rest of the file exactly
+  const std::streamoff start = file.tellg();
+  file.seekg(0, std::ios::end);
+  const std::streamoff end = file.tellg();
+  file.seekg(start);
+  if (!file || static_cast<uint64_t>(end - start) !=
+                   static_cast<uint64_t>(size[0]) * size[1])
+    return nullptr;
+
+  // placed by the threads that scan it, before the file fills it
+  DensityMap::Plane gray = DensityMap::allocatePlane(size[0], size[1]);
+  file.read(reinterpret_cast<char*>(gray.data()), gray.size());
+  if (!file) return nullptr;
+
+  return std::make_shared<DensityMap>(size[0], size[1], std::move(gray));
+}
+
+void DensityCache::store(uint64_t key, const DensityMap& map) const {
+  if (m_directory.isEmpty()) return;
+
+  // write next to the target and rename, so readers never see a partial file
+  const std::string path = filePath(key).toStdString();
+  const std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file) return;
+    const int32_t size[2] = {map.width(), map.height()};
+    file.write(fileMagic, sizeof(fileMagic));
+    file.write(reinterpret_cast<const char*>(&fileVersion),
+               sizeof(fileVersion));
+    file.write(reinterpret_cast<const char*>(size), sizeof(size));
+    file.write(reinterpret_cast<const char*>(map.gray().data()),
+               map.gray().size());
+    if (!file) {
+      file.close();
+      std::remove(tmpPath.c_str());
+      return;
+    }
+  }
+  std::rename(tmpPath.c_str(), path.c_str());
+}
@@ -0,0 +1,64 @@
+#ifndef DENSITYCACHE_H
+#define DENSITYCACHE_H
+
+#include <QImage>
+#include <QString>
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+
+#include "densitymap.h"
+
+// Keeps recently built density maps, keyed by the image content and the
+// transform, so repeated runs on the same image skip the preprocessing. The
+// most recent maps stay in memory; with a directory set, density planes are
+// also stored on disk and picked up by later processes.
+class DensityCache {
+ public:
+  using Inks =
+      std::array<std::shared_ptr<const DensityMap>, DensityMap::InkCount>;
+
+  explicit DensityCache(size_t capacity = 4);
+
+  // An empty path disables the disk cache.
+  void setDirectory(const QString& path);
+
+  std::shared_ptr<const DensityMap> get(const QImage& image,
+                                        const DensityTransform& transform);
+
+  // Like DensityMap::read(), keyed by the file's path, size and modification
+  // time instead of its content. Returns null if the file cannot be read.
+  std::shared_ptr<const DensityMap> read(const QString& path,
+                                         const DensityTransform& transform,
+                                         int width = 0);
+  // DensityMap::readSeparated() through the cache, every ink is cached on
+  // its own. All maps are null if the file cannot be read.
+  Inks readSeparated(const QString& path, const DensityTransform& transform,
+                     int width = 0);
+
+ private:
+  struct Entry {
+    uint64_t key;
+    std::shared_ptr<const DensityMap> map;
+  };
+
+  size_t m_capacity;
+  QString m_directory;
+  std::list<Entry> m_entries;  // most recently used first
+  std::mutex m_mutex;
+
+  // Maps on disk are only taken if they are `width` x `height` pixels, zero
+  // accepts any size.
+  std::shared_ptr<const DensityMap> get(
+      uint64_t key, int width, int height,
+      const std::function<std::shared_ptr<const DensityMap>()>& build);
+  QString filePath(uint64_t key) const;
+  std::shared_ptr<const DensityMap> load(uint64_t key, int width,
+                                         int height) const;
+  void store(uint64_t key, const DensityMap& map) const;
+};
+
+#endif  // DENSITYCACHE_H
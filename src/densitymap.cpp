@@ -0,0 +1,402 @@
+#include "densitymap.h"
+
+#include <QImageReader>
+
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+
+#include "contenthash.h"
+#include "voronoicell.h"
+
+namespace {
+
+// Decoded bytes per strip when reading large files.
+const qint64 stripBytes = qint64(64) << 20;
+
+// Transformed gray value of every input gray value.
+std::array<uint8_t, 256> grayTable(const DensityTransform& transform) {
+  std::array<uint8_t, 256> table;
+  for (int gray = 0; gray < 256; ++gray) {
+    float v = gray / 255.0f;
+    if (transform.invert) v = 1.0f - v;
+    v = std::min(1.0f, std::max(0.0f, (v - 0.5f) * transform.contrast + 0.5f));
+    if (transform.gamma != 1.0f) v = std::pow(v, transform.gamma);
+    table[gray] = static_cast<uint8_t>(std::lround(v * 255.0f));
+  }
+  return table;
+}
+
+}  // namespace
+
+DensityMap::DensityMap(int width, int height)
+    : DensityMap(width, height, allocatePlane(width, height)) {}
+
+DensityMap::DensityMap(const QImage& image, const DensityTransform& transform)
+    : DensityMap(image.width(), image.height()) {
+  convertRows(image, 0, grayTable(transform));
+}
+
+DensityMap::DensityMap(int width, int height, Plane gray)
+    : m_width(width),
+      m_height(height),
+      m_gray(std::move(gray)),
+      m_pixels(m_gray.data()),
+      m_bounds(0, 0, width, height),
+      m_area(static_cast<size_t>(width) * height) {
+  for (int gray = 0; gray < 256; ++gray)
+    m_table[gray] = densityValue(static_cast<uint8_t>(gray));
+}
+
+DensityMap::DensityMap(int width, int height, Plane gray,
+                       const std::array<float, 256>& table, Plane mask)
+    : DensityMap(width, height, std::move(gray)) {
+  m_table = table;
+  m_mask = std::move(mask);
+  if (isMasked()) indexMask();
+}
+
+DensityMap::DensityMap(int width, int height, const uint8_t* gray,
+                       std::shared_ptr<const void> owner,
+                       const DensityTransform& transform)
+    : DensityMap(width, height, Plane()) {
+  m_pixels = gray;
+  m_owner = std::move(owner);
+  const std::array<uint8_t, 256> lut = grayTable(transform);
+  for (int value = 0; value < 256; ++value)
+    m_table[value] = densityValue(lut[value]);
+}
+
+DensityMap::Plane DensityMap::allocatePlane(int width, int height) {
+  Plane plane(static_cast<size_t>(width) * height);
+
+  #pragma omp parallel
+  {
+    const std::pair<int, int> rows = threadRows(height);
+    std::fill_n(plane.data() + static_cast<size_t>(rows.first) * width,
+                static_cast<size_t>(rows.second - rows.first) * width,
+                uint8_t(255));
+  }
+  return plane;
+}
+
+bool DensityMap::pinnedThreads() {
+  return omp_get_proc_bind() != omp_proc_bind_false;
+}
+
+std::pair<int, int> DensityMap::threadRows(int height, int tileRows) {
+  const int64_t tiles = (height + tileRows - 1) / tileRows;
+  const int64_t threads = omp_get_num_threads();
+  const int64_t thread = omp_get_thread_num();
+  auto row = [&](int64_t block) {
+    return static_cast<int>(
+        std::min<int64_t>(height, tiles * block / threads * tileRows));
+  };
+  return {row(thread), row(thread + 1)};
+}
+
+void DensityMap::convertRows(const QImage& image, int firstRow,
+                             const std::array<uint8_t, 256>& lut) {
+  // 32 bit images are converted row by row in parallel, everything else
+  // goes through Qt's conversion first
+  const bool rgb = image.format() == QImage::Format_RGB32 ||
+                   image.format() == QImage::Format_ARGB32;
+  const QImage source =
+      rgb || image.format() == QImage::Format_Grayscale8
+          ? image
+          : image.convertToFormat(QImage::Format_Grayscale8);
+  const int rows = std::min(source.height(), m_height - firstRow);
+  const int width = std::min(source.width(), m_width);
+  // without a transform, gray rows are copied as they are
+  bool identity = true;
+  for (int value = 0; value < 256; ++value)
+    identity = identity && lut[value] == value;
+
+  #pragma omp parallel for
+  for (int y = 0; y < rows; ++y) {
+    uint8_t* row = &m_gray[static_cast<size_t>(firstRow + y) * m_width];
+    if (rgb) {
+      const QRgb* line =
+          reinterpret_cast<const QRgb*>(source.constScanLine(y));
+      for (int x = 0; x < width; ++x) row[x] = lut[qGray(line[x])];
+    } else {
+      const uchar* line = source.constScanLine(y);
+      if (identity)
+        std::copy_n(line, width, row);
+      else
+        for (int x = 0; x < width; ++x) row[x] = lut[line[x]];
+    }
+  }
+}
+
+void DensityMap::separateRows(const QImage& image, int firstRow,
+                              const std::array<uint8_t, 256>& lut,
+                              const Inks& inks) {
+  const QImage source = image.format() == QImage::Format_RGB32 ||
+                                image.format() == QImage::Format_ARGB32
+                            ? image
+                            : image.convertToFormat(QImage::Format_RGB32);
+  const int width = inks[Cyan]->m_width;
+  const int rows = std::min(source.height(), inks[Cyan]->m_height - firstRow);
+  const int columns = std::min(source.width(), width);
+
+  #pragma omp parallel for
+  for (int y = 0; y < rows; ++y) {
+    const QRgb* line = reinterpret_cast<const QRgb*>(source.constScanLine(y));
+    const size_t offset = static_cast<size_t>(firstRow + y) * width;
+    for (int x = 0; x < columns; ++x) {
+      const int r = qRed(line[x]);
+      const int g = qGreen(line[x]);
+      const int b = qBlue(line[x]);
+      // separations are stored as brightness, 255 minus the ink coverage
+      const int white = std::max(r, std::max(g, b));
+      const int k = 255 - white;
+      int c = 0, m = 0, ye = 0;
+      if (white > 0) {
+        c = (255 * (white - r) + white / 2) / white;
+        m = (255 * (white - g) + white / 2) / white;
+        ye = (255 * (white - b) + white / 2) / white;
+      }
+      inks[Cyan]->m_gray[offset + x] = lut[255 - c];
+      inks[Magenta]->m_gray[offset + x] = lut[255 - m];
+      inks[Yellow]->m_gray[offset + x] = lut[255 - ye];
+      inks[Key]->m_gray[offset + x] = lut[255 - k];
+    }
+  }
+}
+
+bool DensityMap::decode(
+    const QString& path, int width,
+    const std::function<void(const QSize&)>& allocate,
+    const std::function<void(const QImage&, int)>& convert) {
+  QImageReader reader(path);
+  QSize size = reader.size();
+  if (!size.isValid()) {
+    // no size without decoding, fall back to a single read
+    const QImage image = reader.read();
+    if (image.isNull()) return false;
+    QImage scaled = width > 0 && width != image.width()
+                        ? image.scaledToWidth(width, Qt::SmoothTransformation)
+                        : image;
+    allocate(scaled.size());
+    convert(scaled, 0);
+    return true;
+  }
+
+  const bool scale = width > 0 && width != size.width();
+  if (scale) {
+    const double height = double(size.height()) * width / size.width();
+    size = QSize(width, std::max(1, static_cast<int>(std::lround(height))));
+  }
+
+  // decode in strips only where the handler clips natively, otherwise the
+  // whole image would be decoded once per strip
+  const QImageIOHandler::ImageOption clipOption =
+      scale ? QImageIOHandler::ScaledClipRect : QImageIOHandler::ClipRect;
+  const qint64 decodedBytes = qint64(size.width()) * size.height() * 4;
+  const int stripRows =
+      decodedBytes > stripBytes && reader.supportsOption(clipOption)
+          ? std::max<qint64>(1, stripBytes / (qint64(size.width()) * 4))
+          : size.height();
+
+  allocate(size);
+  for (int y = 0; y < size.height(); y += stripRows) {
+    // a reader decodes one image, every strip needs a fresh one
+    QImageReader strip(path);
+    const QRect rect(0, y, size.width(),
+                     std::min(stripRows, size.height() - y));
+    if (scale) strip.setScaledSize(size);
+    if (stripRows < size.height()) {
+      if (scale)
+        strip.setScaledClipRect(rect);
+      else
+        strip.setClipRect(rect);
+    }
+    const QImage image = strip.read();
+    if (image.isNull()) return false;
+    convert(image, y);
+  }
+  return true;
+}
+
+std::shared_ptr<DensityMap> DensityMap::read(const QString& path,
+                                             const DensityTransform& transform,
+                                             int width) {
+  const std::array<uint8_t, 256> lut = grayTable(transform);
+  std::shared_ptr<DensityMap> map;
+  const bool ok = decode(
+      path, width,
+      [&](const QSize& size) {
+        map.reset(new DensityMap(size.width(), size.height()));
+      },
+      [&](const QImage& strip, int firstRow) {
+        map->convertRows(strip, firstRow, lut);
+      });
+  return ok ? map : nullptr;
+}
+
+DensityMap::Inks DensityMap::separate(const QImage& image,
+                                      const DensityTransform& transform) {
+  Inks inks;
+  for (std::shared_ptr<DensityMap>& ink : inks)
+    ink.reset(new DensityMap(image.width(), image.height()));
+  separateRows(image, 0, grayTable(transform), inks);
+  return inks;
+}
+
+DensityMap::Inks DensityMap::readSeparated(const QString& path,
+                                           const DensityTransform& transform,
+                                           int width) {
+  const std::array<uint8_t, 256> lut = grayTable(transform);
+  Inks inks;
+  const bool ok = decode(
+      path, width,
+      [&](const QSize& size) {
+        for (std::shared_ptr<DensityMap>& ink : inks)
+          ink.reset(new DensityMap(size.width(), size.height()));
+      },
+      [&](const QImage& strip, int firstRow) {
+        separateRows(strip, firstRow, lut, inks);
+      });
+  return ok ? inks : Inks();
+}
+
+std::shared_ptr<DensityMap> DensityMap::masked(const QImage& mask) const {
+  const bool alpha = mask.hasAlphaChannel();
+  QImage scaled = mask.size() == QSize(m_width, m_height)
+                      ? mask
+                      : mask.scaled(m_width, m_height);
+  scaled = scaled.convertToFormat(alpha ? QImage::Format_Alpha8
+                                        : QImage::Format_Grayscale8);
+
+  std::shared_ptr<DensityMap> map(new DensityMap(m_width, m_height));
+  map->m_table = m_table;
+  map->m_mask = allocatePlane(m_width, m_height);
+  // row by row, keeping the placement of the fresh planes
+  #pragma omp parallel for schedule(static)
+  for (int y = 0; y < m_height; ++y) {
+    const size_t offset = static_cast<size_t>(y) * m_width;
+    std::copy_n(&m_pixels[offset], m_width, &map->m_gray[offset]);
+    const uchar* line = scaled.constScanLine(y);
+    uint8_t* inside = &map->m_mask[offset];
+    for (int x = 0; x < m_width; ++x) inside[x] = line[x] >= 128;
+  }
+  map->indexMask();
+  return map;
+}
+
+void DensityMap::indexMask() {
+  const int tilesX = (m_width + TileSize - 1) / TileSize;
+  const int tilesY = (m_height + TileSize - 1) / TileSize;
+  m_tiles.assign(static_cast<size_t>(tilesX) * tilesY, 0);
+
+  int left = m_width, top = m_height, right = -1, bottom = -1;
+  size_t area = 0;
+  for (int y = 0; y < m_height; ++y) {
+    for (int x = 0; x < m_width; ++x) {
+      if (!inside(x, y)) continue;
+      m_tiles[(y / TileSize) * tilesX + x / TileSize] = 1;
+      left = std::min(left, x);
+      right = std::max(right, x);
+      top = std::min(top, y);
+      bottom = std::max(bottom, y);
+      ++area;
+    }
+  }
+  m_bounds =
+      area > 0 ? QRect(left, top, right - left + 1, bottom - top + 1) : QRect();
+  m_area = area;
+}
+
+bool DensityMap::occupied(int x0, int y0, int x1, int y1) const {
+  if (m_tiles.empty()) return true;
+  x0 = std::max(x0, m_bounds.left());
+  y0 = std::max(y0, m_bounds.top());
+  x1 = std::min(x1, m_bounds.right() + 1);
+  y1 = std::min(y1, m_bounds.bottom() + 1);
+  if (x0 >= x1 || y0 >= y1) return false;
+
+  const int tilesX = (m_width + TileSize - 1) / TileSize;
+  for (int ty = y0 / TileSize; ty <= (y1 - 1) / TileSize; ++ty) {
+    for (int tx = x0 / TileSize; tx <= (x1 - 1) / TileSize; ++tx)
+      if (m_tiles[ty * tilesX + tx]) return true;
+  }
+  return false;
+}
+
+double DensityMap::total() const {
+  std::array<size_t, 256> histogram = {};
+  const size_t size = static_cast<size_t>(m_width) * m_height;
+  if (isMasked()) {
+    for (size_t i = 0; i < size; ++i) histogram[m_pixels[i]] += m_mask[i] != 0;
+  } else {
+    for (size_t i = 0; i < size; ++i) ++histogram[m_pixels[i]];
+  }
+
+  double sum = 0.0;
+  for (int gray = 0; gray < 256; ++gray)
+    sum += histogram[gray] * static_cast<double>(m_table[gray]);
+  return sum;
+}
+
+uint64_t DensityMap::hash() const {
+  std::vector<uint64_t> rows(m_height);
+
+  #pragma omp parallel for
+  for (int y = 0; y < m_height; ++y) {
+    const size_t offset = static_cast<size_t>(y) * m_width;
+    rows[y] = hashBytes(&m_pixels[offset], m_width);
+    if (isMasked()) rows[y] = hashBytes(&m_mask[offset], m_width, rows[y]);
+  }
+
+  const int header[3] = {m_width, m_height, isMasked() ? 1 : 0};
+  uint64_t hash = hashBytes(header, sizeof(header));
+  hash = hashBytes(m_table.data(), sizeof(m_table), hash);
+  return hashBytes(rows.data(), rows.size() * sizeof(uint64_t), hash);
+}
+
+float DensityMap::sample(float x, float y) const {
+  // pixel centers lie at half-integer positions
+  const float fx = std::min(std::max(x - 0.5f, 0.0f), m_width - 1.0f);
+  const float fy = std::min(std::max(y - 0.5f, 0.0f), m_height - 1.0f);
+  const int x0 = static_cast<int>(fx);
+  const int y0 = static_cast<int>(fy);
+  const int x1 = std::min(x0 + 1, m_width - 1);
+  const int y1 = std::min(y0 + 1, m_height - 1);
+  const float tx = fx - x0;
+  const float ty = fy - y0;
+
+  const auto value = [this](int x, int y) {
+    return inside(x, y) ? at(x, y) : 0.0f;
+  };
+  const float top = value(x0, y0) + tx * (value(x1, y0) - value(x0, y0));
+  const float bottom = value(x0, y1) + tx * (value(x1, y1) - value(x0, y1));
+  return top + ty * (bottom - top);
+}
+
+const std::array<std::vector<double>, 4>& DensityMap::rowPrefix() const {
+  std::call_once(m_prefixOnce, [this]() {
+    const size_t stride = m_width + 1;
+    for (int m = 0; m < 3; ++m) m_prefix[m].assign(stride * m_height, 0.0);
+    if (isMasked()) m_prefix[3].assign(stride * m_height, 0.0);
+
+    #pragma omp parallel for
+    for (int y = 0; y < m_height; ++y) {
+      double* s0 = &m_prefix[0][y * stride];
+      double* s1 = &m_prefix[1][y * stride];
+      double* s2 = &m_prefix[2][y * stride];
+      for (int x = 0; x < m_width; ++x) {
+        const double d = inside(x, y) ? at(x, y) : 0.0;
+        // integrals of d, t * d and t^2 * d over [x, x + 1]
+        s0[x + 1] = s0[x] + d;
+        s1[x + 1] = s1[x] + d * (2.0 * x + 1.0) / 2.0;
+        s2[x + 1] = s2[x] + d * (3.0 * x * x + 3.0 * x + 1.0) / 3.0;
+      }
+      if (isMasked()) {
+        double* s3 = &m_prefix[3][y * stride];
+        for (int x = 0; x < m_width; ++x) s3[x + 1] = s3[x] + inside(x, y);
+      }
+    }
+  });
+  return m_prefix;
+}
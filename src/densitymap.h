@@ -0,0 +1,212 @@
+#ifndef DENSITYMAP_H
+#define DENSITYMAP_H
+
+#include <QImage>
+#include <QRect>
+#include <QString>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Tone adjustments applied while converting an image into densities. The
+// brightness v in [0, 1] of each pixel is optionally inverted, then
+// stretched by `contrast` around 0.5 and raised to `gamma`.
+struct DensityTransform {
+  float gamma = 1.0f;
+  float contrast = 1.0f;
+  bool invert = false;
+};
+
+// Allocator that leaves new elements uninitialized, so that a vector can be
+// sized without touching its pages.
+template <class T>
+struct UninitializedAllocator : std::allocator<T> {
+  template <class U>
+  struct rebind {
+    using other = UninitializedAllocator<U>;
+  };
+
+  template <class U>
+  void construct(U* p) {
+    ::new (static_cast<void*>(p)) U;
+  }
+  template <class U, class... Args>
+  void construct(U* p, Args&&... args) {
+    ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+  }
+};
+
+// Density values of an image at its original resolution, stored as one
+// byte of (transformed) gray per pixel. Engines that supersample read
+// sub-pixel positions through sample() instead of working on an upscaled
+// copy of the image.
+//
+// A map can be restricted to a mask. Pixels outside have no density and no
+// area, they are not part of any cell. Engines skip whole tiles of
+// TileSize pixels that lie outside.
+class DensityMap {
+ public:
+  // Process inks of a colour separation, in printing order.
+  enum Ink { Cyan, Magenta, Yellow, Key, InkCount };
+  using Inks = std::array<std::shared_ptr<DensityMap>, InkCount>;
+  using Plane = std::vector<uint8_t, UninitializedAllocator<uint8_t>>;
+  // Read-only view of a plane, owned by the map or borrowed from its
+  // owner. Reads like the const Plane that gray() used to return.
+  class PlaneView {
+   public:
+    PlaneView(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+    const uint8_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const uint8_t* begin() const { return m_data; }
+    const uint8_t* end() const { return m_data + m_size; }
+    uint8_t operator[](size_t i) const { return m_data[i]; }
+
+   private:
+    const uint8_t* m_data;
+    size_t m_size;
+  };
+
+  explicit DensityMap(const QImage& image,
+                      const DensityTransform& transform = DensityTransform());
+  DensityMap(int width, int height, Plane gray);
+  // Map with the densities of `table`, restricted to the pixels with a
+  // non-zero entry in `mask` unless it is empty. Used to rebuild maps from
+  // their parts.
+  DensityMap(int width, int height, Plane gray,
+             const std::array<float, 256>& table, Plane mask = Plane());
+  // Map over gray values owned by someone else, one byte per pixel in rows
+  // of `width`, that are read in place. The transform goes into the table
+  // instead of the pixels. `owner` keeps the pixels alive as long as the
+  // map, they must not change meanwhile.
+  DensityMap(int width, int height, const uint8_t* gray,
+             std::shared_ptr<const void> owner,
+             const DensityTransform& transform = DensityTransform());
+
+  // Allocates a gray plane and touches it first from all threads, every
+  // thread its block of threadRows(). With pinned threads (see
+  // pinnedThreads()) the pages of the plane are spread over the NUMA nodes
+  // instead of landing on the allocating thread's node. The engines still
+  // take tiles dynamically, so a block is not only read by its own thread.
+  static Plane allocatePlane(int width, int height);
+  // Whether OpenMP threads are bound to places (OMP_PROC_BIND, OMP_PLACES),
+  // without which the placement of allocatePlane() does not last.
+  static bool pinnedThreads();
+  // Rows [first, last) of a plane of `height` rows that the calling thread
+  // of a parallel region places. Blocks hold whole rows of tiles of
+  // `tileRows` rows, TileSize times the supersampling for index maps, so
+  // that all planes of one map split alike.
+  static std::pair<int, int> threadRows(int height, int tileRows = TileSize);
+
+  // Decodes an image file straight into a density map, optionally scaled
+  // (down or up) to `width` pixels. Formats that support clipping are
+  // decoded in horizontal strips so that the full decoded image is never
+  // resident. Returns null if the file cannot be read.
+  static std::shared_ptr<DensityMap> read(
+      const QString& path,
+      const DensityTransform& transform = DensityTransform(), int width = 0);
+
+  // Separates a colour image into one density map per process ink (naive
+  // RGB to CMYK with full black generation), the coverage of each ink taking
+  // the place of darkness. The transform applies to every separation.
+  static Inks separate(const QImage& image,
+                       const DensityTransform& transform = DensityTransform());
+  // Like read(), separating the strips while they are decoded. All maps are
+  // null if the file cannot be read.
+  static Inks readSeparated(
+      const QString& path,
+      const DensityTransform& transform = DensityTransform(), int width = 0);
+
+  // Copy restricted to the pixels where `mask` (scaled to the map) is at
+  // least half opaque, or at least mid gray if it has no alpha channel. The
+  // gray values stay as they are, the mask is kept in a plane of its own.
+  std::shared_ptr<DensityMap> masked(const QImage& mask) const;
+
+  static const int TileSize = 32;
+
+  int width() const { return m_width; }
+  int height() const { return m_height; }
+  // Gray value of every pixel, row by row.
+  PlaneView gray() const {
+    return PlaneView(m_pixels, static_cast<size_t>(m_width) * m_height);
+  }
+
+  // Density of pixel (x, y), constant over the pixel. Pixels outside the
+  // mask keep their density here, callers check inside().
+  float at(int x, int y) const {
+    return m_table[m_pixels[static_cast<size_t>(y) * m_width + x]];
+  }
+
+  const std::array<float, 256>& table() const { return m_table; }
+  // Non-zero for every pixel inside the mask, row by row, null without one.
+  const uint8_t* mask() const {
+    return m_mask.empty() ? nullptr : m_mask.data();
+  }
+
+  bool isMasked() const { return !m_mask.empty(); }
+  bool inside(int x, int y) const {
+    return m_mask.empty() || m_mask[static_cast<size_t>(y) * m_width + x];
+  }
+  // Bounding box of the pixels inside the mask, the whole map without one.
+  const QRect& bounds() const { return m_bounds; }
+  // Whether any pixel of [x0, x1) x [y0, y1) lies inside the mask.
+  bool occupied(int x0, int y0, int x1, int y1) const;
+  // Number of pixels inside the mask.
+  size_t area() const { return m_area; }
+
+  // Sum of the densities of all pixels inside the mask.
+  double total() const;
+
+  // Hash of the densities and the mask, rows are hashed in parallel.
+  uint64_t hash() const;
+
+  // Bilinear interpolation between pixel centers at the continuous position
+  // (x, y) in pixels, clamped at the image border. Pixels outside the mask
+  // count as empty.
+  float sample(float x, float y) const;
+
+  // Per-row integrals of x^m * d from 0 to every pixel border, m = 0..2,
+  // with width + 1 entries per row, and for masked maps the same integral
+  // of the inside indicator as a fourth (otherwise empty) array. Built on
+  // first use and kept with the map, so cached maps share them.
+  const std::array<std::vector<double>, 4>& rowPrefix() const;
+
+ private:
+  int m_width;
+  int m_height;
+  Plane m_gray;
+  const uint8_t* m_pixels;  // m_gray, or the pixels of m_owner
+  std::shared_ptr<const void> m_owner;
+  std::array<float, 256> m_table;  // density of every gray value
+  Plane m_mask;  // inside flag of every pixel, empty without mask
+  QRect m_bounds;
+  size_t m_area;
+  std::vector<uint8_t> m_tiles;  // occupancy of every tile, masked maps only
+
+  mutable std::once_flag m_prefixOnce;
+  mutable std::array<std::vector<double>, 4> m_prefix;
+
+  DensityMap(int width, int height);
+  // Bounds, area and tile occupancy from the mask.
+  void indexMask();
+  // Converts `image` into the rows starting at `firstRow`.
+  void convertRows(const QImage& image, int firstRow,
+                   const std::array<uint8_t, 256>& lut);
+  static void separateRows(const QImage& image, int firstRow,
+                           const std::array<uint8_t, 256>& lut,
+                           const Inks& inks);
+
+  // Decodes `path` in strips as described for read(). `allocate` receives
+  // the final size before `convert` receives the strips with their first
+  // row. Returns false if the file cannot be read.
+  static bool decode(const QString& path, int width,
+                     const std::function<void(const QSize&)>& allocate,
+                     const std::function<void(const QImage&, int)>& convert);
+};
+
+#endif  // DENSITYMAP_H
@@ -0,0 +1,452 @@
+#include "distributedcellengine.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <list>
+#include <thread>
+
+#include "sitegrid.h"
+
+namespace {
+
+const char protocolMagic[4] = {'L', 'B', 'G', 'S'};
+const uint32_t protocolVersion = 4;
+static_assert(sizeof(Moments) == 7 * sizeof(float),
+              "moments are sent as they are in memory");
+
+std::vector<std::string> stripAddresses;
+
+// Limits of what a worker accepts from a coordinator, far above any real
+// run but small enough that a bad header cannot exhaust the worker.
+const int32_t maxSide = 1 << 17;
+const uint64_t maxStripPixels = uint64_t(1) << 32;
+const int32_t maxSuperSampling = 64;
+// coordinators served at the same time
+const size_t maxSessions = 64;
+
+// Header of a strip, followed by the density table, the gray rows and, for
+// masked maps, the mask rows. The rows sent start at image row `top` and
+// include a halo row above and below the sampled ones where the image has
+// one.
+struct StripHeader {
+  int32_t width;
+  int32_t rows;  // rows sent
+  int32_t top;
+  int32_t imageHeight;
+  int32_t superSampling;
+  int32_t masked;
+  int32_t firstRow;  // first sampled row among the rows sent
+  int32_t sampledRows;
+};
+
+bool validHeader(const StripHeader& h) {
+  return h.width > 0 && h.width <= maxSide && h.imageHeight > 0 &&
+         h.imageHeight <= maxSide && h.rows > 0 && h.top >= 0 &&
+         h.rows <= h.imageHeight - h.top && h.superSampling >= 1 &&
+         h.superSampling <= maxSuperSampling &&
+         (h.masked == 0 || h.masked == 1) && h.firstRow >= 0 &&
+         h.sampledRows > 0 && h.sampledRows <= h.rows - h.firstRow &&
+         static_cast<uint64_t>(h.width) * h.rows <= maxStripPixels;
+}
+
+// Rows of the map sent for a strip: the sampled rows and, with
+// supersampling, the halo rows that samples at their border interpolate
+// with.
+std::pair<int, int> haloRows(const DensityMap& density, int superSampling,
+                             int top, int rows) {
+  const int halo = superSampling > 1 ? 1 : 0;
+  const int first = std::max(0, top - halo);
+  return {first, std::min(density.height(), top + rows + halo) - first};
+}
+
+std::shared_ptr<const DensityMap> stripMap(const DensityMap& density, int top,
+                                           int rows) {
+  const int width = density.width();
+  const size_t offset = static_cast<size_t>(top) * width;
+  DensityMap::Plane gray = DensityMap::allocatePlane(width, rows);
+  std::memcpy(gray.data(), density.gray().data() + offset, gray.size());
+  DensityMap::Plane mask;
+  if (density.isMasked()) {
+    mask = DensityMap::allocatePlane(width, rows);
+    std::memcpy(mask.data(), density.mask() + offset, mask.size());
+  }
+  return std::make_shared<DensityMap>(width, rows, std::move(gray),
+                                      density.table(), std::move(mask));
+}
+
+std::unique_ptr<Connection> connectWorker(const std::string& address) {
+  const size_t colon = address.rfind(':');
+  if (colon == std::string::npos) return nullptr;
+  const int port = std::atoi(address.c_str() + colon + 1);
+  if (port <= 0 || port > 65535) return nullptr;
+  return Connection::open(address.substr(0, colon),
+                          static_cast<uint16_t>(port));
+}
+
+// Indices of the sites whose cells can reach into the image rows
+// [top, top + rows), in ascending order. Every tile of the rows gets the
+// sites within the nearest distance plus the tile diagonal of its center,
+// as the fused engine does, so the owner of every sample is among them.
+std::vector<uint32_t> reachingSites(const SiteGrid& grid, const QRect& bounds,
+                                    int top, int rows, float tileSize,
+                                    std::vector<uint8_t>& reached) {
+  reached.assign(grid.size(), 0);
+  std::vector<uint32_t> indices;
+  for (float y0 = top; y0 < top + rows; y0 += tileSize) {
+    const float y1 = std::min(y0 + tileSize, float(top + rows));
+    for (float x0 = bounds.left(); x0 <= bounds.right(); x0 += tileSize) {
+      const float x1 = std::min(x0 + tileSize, float(bounds.right() + 1));
+      const float cx = 0.5f * (x0 + x1);
+      const float cy = 0.5f * (y0 + y1);
+      float d0 = 0.0f;
+      grid.nearest(cx, cy, d0);
+      // one more pixel against float rounding
+      const float reach = d0 + std::hypot(x1 - x0, y1 - y0) + 1.0f;
+      indices.clear();
+      grid.gather(cx, cy, reach, indices);
+      for (const uint32_t i : indices) reached[i] = 1;
+    }
+  }
+  indices.clear();
+  for (size_t i = 0; i < reached.size(); ++i)
+    if (reached[i]) indices.push_back(static_cast<uint32_t>(i));
+  return indices;
+}
+
+// Adds the (frozen, non-frozen) pairs of sites owning vertically
+// neighbouring samples on both sides of image row `top`, where two strips
+// meet and no worker sees both samples, to `borders`.
+void seamBorders(const SiteGrid& grid, const DensityMap& density,
+                 int superSampling, int top,
+                 const std::vector<uint8_t>& frozen,
+                 std::vector<std::pair<uint32_t, uint32_t>>& borders) {
+  const QRect bounds = density.bounds();
+  const float step = 1.0f / superSampling;
+  const int above = top * superSampling - 1;
+  const float pyAbove = (above + 0.5f) * step;
+  const float pyBelow = (above + 1.5f) * step;
+  for (int sx = bounds.left() * superSampling;
+       sx < (bounds.right() + 1) * superSampling; ++sx) {
+    const int x = sx / superSampling;
+    if (!density.inside(x, above / superSampling) ||
+        !density.inside(x, top))
+      continue;
+    const float px = (sx + 0.5f) * step;
+    float dist = 0.0f;
+    const uint32_t a = grid.nearest(px, pyAbove, dist);
+    const uint32_t b = grid.nearest(px, pyBelow, dist);
+    if (frozen[a] != frozen[b])
+      borders.push_back(frozen[a] ? std::make_pair(a, b)
+                                  : std::make_pair(b, a));
+  }
+}
+
+bool finite(const std::vector<float>& values) {
+  return std::all_of(values.begin(), values.end(),
+                     [](float v) { return std::isfinite(v); });
+}
+
+// Serves one coordinator until it disconnects or sends something invalid.
+void serveCoordinator(Connection& connection) {
+  char magic[4];
+  uint32_t version = 0;
+  StripHeader header;
+  std::array<float, 256> table;
+  if (!connection.receive(magic) || !connection.receive(version) ||
+      std::memcmp(magic, protocolMagic, sizeof(magic)) != 0 ||
+      version != protocolVersion || !connection.receive(header) ||
+      !validHeader(header) || !connection.receive(table))
+    return;
+  for (const float density : table)
+    if (!std::isfinite(density) || density < 0.0f) return;
+
+  DensityMap::Plane gray =
+      DensityMap::allocatePlane(header.width, header.rows);
+  if (!connection.receive(gray.data(), gray.size())) return;
+  DensityMap::Plane mask;
+  if (header.masked) {
+    mask = DensityMap::allocatePlane(header.width, header.rows);
+    if (!connection.receive(mask.data(), mask.size())) return;
+  }
+  auto density = std::make_shared<DensityMap>(
+      header.width, header.rows, std::move(gray), table, std::move(mask));
+  const FusedCellEngine engine(density, header.superSampling, header.top,
+                               header.imageHeight, header.firstRow,
+                               header.sampledRows);
+
+  // no more sites than pixels in the image
+  const uint64_t maxSites =
+      static_cast<uint64_t>(header.width) * header.imageHeight;
+  std::vector<float> x;
+  std::vector<float> y;
+  float spacing = 0.0f;
+  uint8_t orientation = 1;
+  std::vector<uint8_t> frozen;
+  std::vector<uint32_t> indices;
+  std::vector<Moments> partial;
+  std::vector<std::pair<uint32_t, uint32_t>> adjacency;
+  std::vector<std::pair<uint32_t, uint32_t>> borders;
+  std::vector<uint32_t> packed;
+  // frozen flags come for every site or, without freezing, for none
+  while (connection.receiveArray(x, maxSites) &&
+         connection.receiveArray(y, maxSites) &&
+         connection.receive(spacing) && connection.receive(orientation) &&
+         connection.receiveArray(frozen, maxSites) &&
+         x.size() == y.size() && finite(x) && finite(y) &&
+         std::isfinite(spacing) && spacing > 0.0f && orientation <= 1 &&
+         (frozen.empty() || frozen.size() == x.size()) &&
+         std::all_of(frozen.begin(), frozen.end(),
+                     [](uint8_t f) { return f <= 1; })) {
+    // sizes do not matter for the cells, no site reaching the strip makes
+    // an empty reply
+    const StippleView sites(x.data(), y.data(), x.data(), nullptr, x.size());
+    // The borders of frozen cells are only known once all strips replied,
+    // every cell is accumulated and the coordinator decides which to skip.
+    const bool freezing = !frozen.empty();
+    borders.clear();
+    const std::vector<Moments> moments =
+        sites.empty() ? std::vector<Moments>()
+                      : engine.moments(sites, spacing, orientation != 0,
+                                       freezing ? &adjacency : nullptr,
+                                       freezing ? &frozen : nullptr, &borders);
+
+    // only the cells that reach into the strip
+    indices.clear();
+    partial.clear();
+    for (size_t i = 0; i < moments.size(); ++i) {
+      if (moments[i].area == 0.0f) continue;
+      indices.push_back(static_cast<uint32_t>(i));
+      partial.push_back(moments[i]);
+    }
+    packed.clear();
+    for (const auto& [a, b] : borders) {
+      packed.push_back(a);
+      packed.push_back(b);
+    }
+    if (!connection.sendArray(indices.data(), indices.size()) ||
+        !connection.sendArray(partial.data(), partial.size()) ||
+        !connection.sendArray(packed.data(), packed.size()))
+      return;
+  }
+}
+
+}  // namespace
+
+DistributedCellEngine::DistributedCellEngine(
+    std::shared_ptr<const DensityMap> density, int superSampling,
+    const std::vector<std::string>& workers)
+    : m_density(std::move(density)),
+      m_superSampling(std::max(1, superSampling)) {
+  // rows outside the mask bounds hold no samples
+  const QRect bounds = m_density->bounds();
+  const int count = std::max<int>(
+      1, std::min<int>(static_cast<int>(workers.size()), bounds.height()));
+  for (int s = 0; s < count; ++s) {
+    Strip strip;
+    strip.top = bounds.top() + bounds.height() * s / count;
+    strip.rows = bounds.top() + bounds.height() * (s + 1) / count - strip.top;
+    if (s < static_cast<int>(workers.size())) {
+      strip.connection = connectWorker(workers[s]);
+      if (strip.connection && !sendStrip(strip)) strip.connection.reset();
+    }
+    m_strips.push_back(std::move(strip));
+  }
+}
+
+bool DistributedCellEngine::sendStrip(Strip& strip) const {
+  const int width = m_density->width();
+  const std::pair<int, int> rows =
+      haloRows(*m_density, m_superSampling, strip.top, strip.rows);
+  const StripHeader header = {width,
+                              rows.second,
+                              rows.first,
+                              m_density->height(),
+                              m_superSampling,
+                              m_density->isMasked() ? 1 : 0,
+                              strip.top - rows.first,
+                              strip.rows};
+  const size_t offset = static_cast<size_t>(rows.first) * width;
+  const size_t size = static_cast<size_t>(rows.second) * width;
+  Connection& connection = *strip.connection;
+  return connection.send(protocolMagic) && connection.send(protocolVersion) &&
+         connection.send(header) && connection.send(m_density->table()) &&
+         connection.send(m_density->gray().data() + offset, size) &&
+         (!header.masked || connection.send(m_density->mask() + offset, size));
+}
+
+std::vector<Moments> DistributedCellEngine::computeLocally(
+    Strip& strip, const StippleView& sites, float spacing, bool orientation,
+    const std::vector<uint8_t>* frozen,
+    std::vector<std::pair<uint32_t, uint32_t>>& borders) const {
+  if (!strip.local) {
+    const std::pair<int, int> rows =
+        haloRows(*m_density, m_superSampling, strip.top, strip.rows);
+    strip.local = std::make_unique<FusedCellEngine>(
+        stripMap(*m_density, rows.first, rows.second), m_superSampling,
+        rows.first, m_density->height(), strip.top - rows.first,
+        strip.rows);
+  }
+  std::vector<std::pair<uint32_t, uint32_t>> adjacency;
+  std::vector<std::pair<uint32_t, uint32_t>> stripBorders;
+  std::vector<Moments> moments =
+      strip.local->moments(sites, spacing, orientation,
+                           frozen ? &adjacency : nullptr, frozen,
+                           &stripBorders);
+  borders.insert(borders.end(), stripBorders.begin(), stripBorders.end());
+  return moments;
+}
+
+CellResult DistributedCellEngine::compute(const StippleView& sites,
+                                          const CellQuery& query) {
+  // Pairs of neighbouring cells span the strips, the pass that collects
+  // them runs here on the whole image.
+  if (query.adjacency)
+    return FusedCellEngine(m_density, m_superSampling).compute(sites, query);
+
+  // the spacing of the whole image, so that strips tile like one engine
+  const float spacing = std::sqrt(
+      static_cast<float>(std::max<size_t>(1, m_density->area())) /
+      sites.size());
+
+  const uint8_t orientation = query.orientation;
+
+  // every worker only gets the sites whose cells can reach its strip
+  const int width = m_density->width();
+  const SiteGrid grid(sites, width, m_density->height(), spacing);
+  const float tileSize = std::min(64.0f, std::max(8.0f, 2.0f * spacing));
+  std::vector<uint8_t> reached;
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<uint8_t> frozen;
+
+  // all requests go out before the first reply is awaited, the workers
+  // compute at the same time
+  for (Strip& strip : m_strips) {
+    if (!strip.connection) continue;
+    strip.sites = reachingSites(grid, m_density->bounds(), strip.top,
+                                strip.rows, tileSize, reached);
+    x.resize(strip.sites.size());
+    y.resize(strip.sites.size());
+    for (size_t k = 0; k < strip.sites.size(); ++k) {
+      x[k] = sites.x()[strip.sites[k]];
+      y[k] = sites.y()[strip.sites[k]];
+    }
+    frozen.clear();
+    if (query.frozen) {
+      for (const uint32_t i : strip.sites) frozen.push_back((*query.frozen)[i]);
+    }
+    if (!strip.connection->sendArray(x.data(), x.size()) ||
+        !strip.connection->sendArray(y.data(), y.size()) ||
+        !strip.connection->send(spacing) ||
+        !strip.connection->send(orientation) ||
+        !strip.connection->sendArray(frozen.data(), frozen.size()))
+      strip.connection.reset();
+  }
+
+  std::vector<Moments> moments(sites.size());
+  std::vector<uint32_t> indices;
+  std::vector<Moments> partial;
+  std::vector<uint32_t> packed;
+  CellResult result;
+  for (Strip& strip : m_strips) {
+    const size_t sent = strip.sites.size();
+    if (strip.connection &&
+        (!strip.connection->receiveArray(indices, sent) ||
+         !strip.connection->receiveArray(partial, sent) ||
+         indices.size() != partial.size() ||
+         // far more than the pairs of a planar graph
+         !strip.connection->receiveArray(packed, 16 * uint64_t(sent)) ||
+         packed.size() % 2 != 0 ||
+         std::any_of(packed.begin(), packed.end(),
+                     [sent](uint32_t k) { return k >= sent; })))
+      strip.connection.reset();
+
+    if (!strip.connection) {
+      const std::vector<Moments> local =
+          computeLocally(strip, sites, spacing, query.orientation,
+                         query.frozen, result.frozenBorders);
+      for (size_t i = 0; i < local.size(); ++i) moments[i] += local[i];
+      continue;
+    }
+    for (size_t k = 0; k < indices.size(); ++k) {
+      if (indices[k] < sent) moments[strip.sites[indices[k]]] += partial[k];
+    }
+    for (size_t k = 0; k < packed.size(); k += 2)
+      result.frozenBorders.emplace_back(strip.sites[packed[k]],
+                                        strip.sites[packed[k + 1]]);
+  }
+
+  const float step = 1.0f / m_superSampling;
+  result.cells =
+      cellsFromMoments(moments, sites, m_density->width(),
+                       m_density->height(), step * step, query.orientation);
+  result.skipped.assign(sites.size(), 0);
+  if (query.frozen) {
+    for (size_t s = 1; s < m_strips.size(); ++s)
+      seamBorders(grid, *m_density, m_superSampling, m_strips[s].top,
+                  *query.frozen, result.frozenBorders);
+    std::vector<std::pair<uint32_t, uint32_t>>& borders =
+        result.frozenBorders;
+    std::sort(borders.begin(), borders.end());
+    borders.erase(std::unique(borders.begin(), borders.end()),
+                  borders.end());
+
+    // every cell was accumulated, the ones skipped are left out as the
+    // other engines do
+    result.skipped = *query.frozen;
+    for (const auto& border : borders) result.skipped[border.first] = 0;
+    for (size_t i = 0; i < sites.size(); ++i)
+      if (result.skipped[i]) result.cells[i] = VoronoiCell();
+  }
+  return result;
+}
+
+void setStripWorkers(const std::vector<std::string>& addresses) {
+  stripAddresses = addresses;
+}
+
+const std::vector<std::string>& stripWorkers() { return stripAddresses; }
+
+void serveStrips(Listener& listener) {
+  // The channels of a colour run connect at the same time, every
+  // coordinator is served on a thread of its own. Finished sessions are
+  // joined whenever the next coordinator connects.
+  struct Session {
+    std::thread thread;
+    std::shared_ptr<std::atomic<bool>> done;
+  };
+  std::list<Session> sessions;
+  auto joinFinished = [&sessions]() {
+    for (auto it = sessions.begin(); it != sessions.end();) {
+      if (!*it->done) {
+        ++it;
+        continue;
+      }
+      it->thread.join();
+      it = sessions.erase(it);
+    }
+  };
+
+  while (std::shared_ptr<Connection> connection = listener.accept()) {
+    joinFinished();
+    // a connection past the limit is closed right away
+    if (sessions.size() >= maxSessions) continue;
+    auto done = std::make_shared<std::atomic<bool>>(false);
+    std::thread thread([connection, done]() {
+      // a failing session only loses its coordinator, which falls back to
+      // computing the strip itself
+      try {
+        serveCoordinator(*connection);
+      } catch (const std::exception&) {
+      }
+      *done = true;
+    });
+    sessions.push_back({std::move(thread), std::move(done)});
+  }
+  for (Session& session : sessions) session.thread.join();
+}
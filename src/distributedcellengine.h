@@ -0,0 +1,66 @@
+#ifndef DISTRIBUTEDCELLENGINE_H
+#define DISTRIBUTEDCELLENGINE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cellengine.h"
+#include "connection.h"
+#include "densitymap.h"
+#include "fusedcellengine.h"
+
+// Spreads the cell computation of one image over worker processes. The
+// rows of the map (its mask bounds) are split into one horizontal strip
+// per worker, each worker receives its strip once, with a halo row above
+// and below for supersampling, and then, every iteration, the sites whose
+// cells can reach the strip. It returns the partial moments of the cells
+// reaching into its strip, which are summed into whole cells here. As the
+// split and merge decisions are still taken on the complete cells, a run
+// matches one on a single machine with the CPU engine, up to the order in
+// which floats are summed. A strip whose worker cannot be reached or fails
+// is computed locally instead. With frozen cells, the workers also return
+// the borders between frozen and non-frozen cells within their strip.
+class DistributedCellEngine : public CellEngine {
+ public:
+  // `workers` are "host:port" addresses of processes running serveStrips().
+  DistributedCellEngine(std::shared_ptr<const DensityMap> density,
+                        int superSampling,
+                        const std::vector<std::string>& workers);
+
+  CellResult compute(const StippleView& sites,
+                     const CellQuery& query) override;
+
+ private:
+  struct Strip {
+    int top;
+    int rows;
+    std::unique_ptr<Connection> connection;  // null if computed locally
+    std::unique_ptr<FusedCellEngine> local;  // created on first use
+    std::vector<uint32_t> sites;  // sent to the worker this iteration
+  };
+
+  std::shared_ptr<const DensityMap> m_density;
+  int m_superSampling;
+  std::vector<Strip> m_strips;
+
+  bool sendStrip(Strip& strip) const;
+  // Moments of `strip` computed here, with the (frozen, non-frozen) pairs
+  // of its cells added to `borders` if `frozen` is given.
+  std::vector<Moments> computeLocally(
+      Strip& strip, const StippleView& sites, float spacing,
+      bool orientation, const std::vector<uint8_t>* frozen,
+      std::vector<std::pair<uint32_t, uint32_t>>& borders) const;
+};
+
+// Addresses of the workers used by engines of type Distributed.
+void setStripWorkers(const std::vector<std::string>& workers);
+const std::vector<std::string>& stripWorkers();
+
+// Worker side: serves every coordinator that connects to `listener` on a
+// thread of its own, up to a limit, and checks what they send against the
+// strip they sent. Coordinators are not authenticated. Only returns, once
+// all sessions ended, if no more connections can be accepted.
+void serveStrips(Listener& listener);
+
+#endif  // DISTRIBUTEDCELLENGINE_H
@@ -0,0 +1,335 @@
+#include "fusedcellengine.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <omp.h>
+
+#include "sitegrid.h"
+
+namespace {
+
+struct Candidate {
+  uint32_t index;
+  float x;
+  float y;
+  float dist;  // distance to the tile center
+};
+
+// Collects every site that can be the nearest one for some pixel of the
+// tile. If the closest site to the center is d0 away, no pixel (at most
+// halfDiag from the center) is further than d0 + halfDiag from its nearest
+// site, so the owner is within d0 + 2 * halfDiag of the center.
+void tileSites(const SiteGrid& grid, float cx, float cy, float halfDiag,
+               std::vector<uint32_t>& indices) {
+  float d0 = 0.0f;
+  grid.nearest(cx, cy, d0);
+
+  indices.clear();
+  grid.gather(cx, cy, d0 + 2.0f * halfDiag, indices);
+}
+
+// The sites of tileSites() as candidates, sorted by distance to the tile
+// center.
+void tileCandidates(const SiteGrid& grid, float cx, float cy,
+                    const std::vector<uint32_t>& indices,
+                    std::vector<Candidate>& candidates) {
+  candidates.clear();
+  for (uint32_t i : indices) {
+    const float dist = std::hypot(grid.x(i) - cx, grid.y(i) - cy);
+    candidates.push_back({i, grid.x(i), grid.y(i), dist});
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Candidate& a, const Candidate& b) {
+              return a.dist < b.dist || (a.dist == b.dist && a.index < b.index);
+            });
+}
+
+// Decides a tie of the float distances of `a` and `b` to (px, py) in
+// double, then by the lower index, so that the owner of a sample does not
+// depend on the order the candidates of its tile come in.
+bool closer(const Candidate& a, const Candidate& b, float px, float py) {
+  auto distance = [px, py](const Candidate& c) {
+    const double dx = double(c.x) - px;
+    const double dy = double(c.y) - py;
+    return dx * dx + dy * dy;
+  };
+  const double da = distance(a);
+  const double db = distance(b);
+  return da < db || (da == db && a.index < b.index);
+}
+
+}  // namespace
+
+FusedCellEngine::FusedCellEngine(std::shared_ptr<const DensityMap> density,
+                                 int superSampling, int top, int imageHeight,
+                                 int firstRow, int rows)
+    : m_density(std::move(density)),
+      m_superSampling(std::max(1, superSampling)),
+      m_top(top),
+      m_imageHeight(imageHeight > 0 ? imageHeight : m_density->height()),
+      m_firstRow(firstRow),
+      m_rows(rows > 0 ? rows : m_density->height() - firstRow) {}
+
+CellResult FusedCellEngine::compute(const StippleView& sites,
+                                    const CellQuery& query) {
+  assert(!sites.empty());
+
+  // about one site per grid cell, tiles span a few sites
+  const float spacing = std::sqrt(
+      static_cast<float>(std::max<size_t>(1, m_density->area())) /
+      sites.size());
+  const float step = 1.0f / m_superSampling;
+
+  CellResult result;
+  result.cells = cellsFromMoments(
+      moments(sites, spacing, query.orientation,
+              query.adjacency ? &result.adjacency : nullptr, query.frozen,
+              &result.frozenBorders),
+      sites, m_density->width(), m_imageHeight, step * step,
+      query.orientation);
+  result.skipped.assign(sites.size(), 0);
+  if (query.frozen) {
+    // frozen cells next to non-frozen ones are complete, as with an index map
+    result.skipped = *query.frozen;
+    for (const auto& border : result.frozenBorders)
+      result.skipped[border.first] = 0;
+    for (size_t i = 0; i < sites.size(); ++i)
+      if (result.skipped[i]) result.cells[i] = VoronoiCell();
+  }
+  return result;
+}
+
+std::vector<Moments> FusedCellEngine::moments(
+    const StippleView& sites, float spacing, bool orientation,
+    std::vector<std::pair<uint32_t, uint32_t>>* adjacency,
+    const std::vector<uint8_t>* frozen,
+    std::vector<std::pair<uint32_t, uint32_t>>* frozenBorders) const {
+  assert(!frozen || frozenBorders);
+  const int width = m_density->width();
+  const SiteGrid grid(sites, width, m_imageHeight, spacing);
+  const int tileSize =
+      std::min(64, std::max(8, static_cast<int>(2.0f * spacing)));
+  // only the bounding box of a mask is tiled, without the halo rows
+  const QRect maskBounds = m_density->bounds();
+  const int boundsTop = std::max(maskBounds.top(), m_firstRow);
+  const int boundsBottom =
+      std::min(maskBounds.bottom(), m_firstRow + m_rows - 1);
+  if (boundsBottom < boundsTop) return std::vector<Moments>(sites.size());
+  const QRect bounds(maskBounds.left(), boundsTop, maskBounds.width(),
+                     boundsBottom - boundsTop + 1);
+  const int tilesX = (bounds.width() + tileSize - 1) / tileSize;
+  const int tilesY = (bounds.height() + tileSize - 1) / tileSize;
+
+  const float step = 1.0f / m_superSampling;
+
+  // samples are taken in rows of the map, positions are in the image
+  const int top = m_top;
+  std::vector<Moments> moments(sites.size());
+  // cell moments of every tile, added up in tile order
+  std::vector<TileMoments> tileParts(tilesX * tilesY);
+  // site pairs of all threads, packed
+  std::vector<uint64_t> edges;
+  const uint32_t none = ~uint32_t(0);
+  // Tiles whose candidates are all frozen are left for a second pass, in
+  // which only those with a candidate next to a non-frozen cell are
+  // scanned. The candidates cover one more pixel around the tile, so the
+  // pairs such a tile would add are all frozen ones.
+  const bool deferring = frozen && !adjacency;
+  std::vector<uint8_t> thawing;
+
+  // one instance per feature set, without per-sample tests in its loops
+  auto kernel = [&](auto supersampledTag, auto maskedTag, auto orientationTag,
+                    auto adjacencyTag) {
+    constexpr bool Supersampled = decltype(supersampledTag)::value;
+    constexpr bool Masked = decltype(maskedTag)::value;
+    constexpr bool Orientation = decltype(orientationTag)::value;
+    constexpr bool Adjacency = decltype(adjacencyTag)::value;
+    const int ss = Supersampled ? m_superSampling : 1;
+
+    #pragma omp parallel
+    {
+      std::vector<uint32_t> indices;
+      std::vector<Candidate> candidates;
+      std::vector<Moments> tileMoments;
+      // owning candidate of every sample of the tile, and site pairs of the
+      // thread and of the tile
+      std::vector<uint32_t> labels;
+      std::vector<uint64_t> localEdges;
+      std::vector<uint64_t> tileEdges;
+      std::vector<std::array<int, 4>> deferred;
+
+      auto scanTile = [&](int x0, int y0, int x1, int y1, bool secondPass) {
+        if (!m_density->occupied(x0, y0, x1, y1)) return;
+
+        // Samples are paired with the ones to their right and below. Owners
+        // are found for one more column and row, the first ones of the next
+        // tiles, which only count for the pairs.
+        const int sx1 = x1 * ss;
+        const int sy1 = y1 * ss;
+        const int extra = Adjacency ? 2 : 0;
+        const float cx = 0.5f * (x0 + x1);
+        const float cy = 0.5f * (y0 + y1) + top;
+        const float halfDiag =
+            0.5f * std::hypot(x1 - x0 + extra, y1 - y0 + extra);
+        tileSites(grid, cx, cy, halfDiag, indices);
+
+        // For the borders of frozen cells only tiles with both frozen and
+        // non-frozen candidates are paired, the pairs of the second pass
+        // are all frozen ones.
+        bool pairing = Adjacency && !secondPass;
+        if (secondPass) {
+          auto thawed = [&](uint32_t i) { return thawing[i] != 0; };
+          if (std::none_of(indices.begin(), indices.end(), thawed)) return;
+        } else if (deferring) {
+          auto isFrozen = [&](uint32_t i) { return (*frozen)[i] != 0; };
+          const size_t count =
+              std::count_if(indices.begin(), indices.end(), isFrozen);
+          if (count == indices.size()) {
+            deferred.push_back({x0, y0, x1, y1});
+            return;
+          }
+          pairing = count > 0;
+        }
+        const int ex1 =
+            pairing ? std::min(sx1 + 1, (bounds.right() + 1) * ss) : sx1;
+        const int ey1 =
+            pairing ? std::min(sy1 + 1, (bounds.bottom() + 1) * ss) : sy1;
+        const int labelWidth = ex1 - x0 * ss;
+        if (pairing) labels.resize(labelWidth * (ey1 - y0 * ss));
+        tileCandidates(grid, cx, cy, indices, candidates);
+
+        tileMoments.assign(candidates.size(), Moments());
+
+        // sample rows and columns of the tile, in supersampled units
+        for (int sy = y0 * ss; sy < ey1; ++sy) {
+          const float py =
+              (Supersampled ? (sy + 0.5f) * step : sy + 0.5f) + top;
+          for (int sx = x0 * ss; sx < ex1; ++sx) {
+            const size_t label = (sy - y0 * ss) * labelWidth + sx - x0 * ss;
+            if (Masked && !m_density->inside(sx / ss, sy / ss)) {
+              if (Adjacency && pairing) labels[label] = none;
+              continue;
+            }
+            const float px = Supersampled ? (sx + 0.5f) * step : sx + 0.5f;
+            const float e = std::hypot(px - cx, py - cy);
+
+            // candidates further than best + e from the center cannot win
+            float best = std::numeric_limits<float>::max();
+            float bestDist = best;
+            size_t owner = 0;
+            for (size_t k = 0; k < candidates.size(); ++k) {
+              const Candidate& c = candidates[k];
+              if (c.dist - e > bestDist) break;
+              const float d2 =
+                  (c.x - px) * (c.x - px) + (c.y - py) * (c.y - py);
+              if (d2 < best ||
+                  (d2 == best && closer(c, candidates[owner], px, py))) {
+                best = d2;
+                bestDist = std::sqrt(d2);
+                owner = k;
+              }
+            }
+
+            if (Adjacency && pairing) {
+              labels[label] = static_cast<uint32_t>(owner);
+              if (sx >= sx1 || sy >= sy1) continue;
+            }
+
+            const float densityVal = Supersampled
+                                         ? m_density->sample(px, py - top)
+                                         : m_density->at(sx, sy);
+            const Candidate& site = candidates[owner];
+            tileMoments[owner].add<Orientation>(px - site.x, py - site.y,
+                                                densityVal);
+          }
+        }
+
+        TileMoments& part = tileParts[(y0 - bounds.top()) / tileSize * tilesX +
+                                      (x0 - bounds.left()) / tileSize];
+        for (size_t k = 0; k < candidates.size(); ++k) {
+          if (tileMoments[k].area > 0.0f)
+            part.emplace_back(candidates[k].index, tileMoments[k]);
+        }
+
+        if (Adjacency && pairing) {
+          // neighbouring samples mostly repeat the previous pair
+          uint32_t lastA = none;
+          uint32_t lastB = none;
+          auto pair = [&](uint32_t a, uint32_t b) {
+            if (b == none || b == a || (a == lastA && b == lastB)) return;
+            lastA = a;
+            lastB = b;
+            const uint32_t i = candidates[a].index;
+            const uint32_t j = candidates[b].index;
+            // only borders of frozen cells, unless all pairs are asked for
+            if (deferring && (*frozen)[i] == (*frozen)[j]) return;
+            tileEdges.push_back(packPair(std::min(i, j), std::max(i, j)));
+          };
+          for (int ly = 0; ly < sy1 - y0 * ss; ++ly) {
+            const uint32_t* row = &labels[ly * labelWidth];
+            for (int lx = 0; lx < sx1 - x0 * ss; ++lx) {
+              if (row[lx] == none) continue;
+              if (x0 * ss + lx + 1 < ex1) pair(row[lx], row[lx + 1]);
+              if (y0 * ss + ly + 1 < ey1) pair(row[lx], row[lx + labelWidth]);
+            }
+          }
+          // a border crosses a tile in many samples but a few pairs
+          std::sort(tileEdges.begin(), tileEdges.end());
+          localEdges.insert(localEdges.end(), tileEdges.begin(),
+                            std::unique(tileEdges.begin(), tileEdges.end()));
+          tileEdges.clear();
+        }
+      };
+      const int bx1 = bounds.right() + 1;
+      const int by1 = bounds.bottom() + 1;
+      #pragma omp for schedule(dynamic) nowait
+      for (int tile = 0; tile < tilesX * tilesY; ++tile) {
+        const int x = bounds.left() + (tile % tilesX) * tileSize;
+        const int y = bounds.top() + (tile / tilesX) * tileSize;
+        scanTile(x, y, std::min(x + tileSize, bx1),
+                 std::min(y + tileSize, by1), false);
+      }
+
+      if (Adjacency) {
+        std::sort(localEdges.begin(), localEdges.end());
+        localEdges.erase(std::unique(localEdges.begin(), localEdges.end()),
+                         localEdges.end());
+        #pragma omp critical
+        edges.insert(edges.end(), localEdges.begin(), localEdges.end());
+      }
+
+      if (deferring) {
+        // the borders are only known once every thread paired its tiles
+        #pragma omp barrier
+        #pragma omp single
+        {
+          *frozenBorders = findFrozenBorders(unpackPairs(edges), *frozen);
+          thawing.assign(sites.size(), 0);
+          for (const auto& border : *frozenBorders) thawing[border.first] = 1;
+        }
+        // every thread rescans the tiles it deferred
+        for (const auto& [x0, y0, x1, y1] : deferred)
+          scanTile(x0, y0, x1, y1, true);
+      }
+    }
+  };
+  // adjacency is rarely asked for, its flag goes on top of the others
+  auto withAdjacency = [&](auto supersampledTag, auto maskedTag,
+                           auto orientationTag) {
+    adjacency || frozen ? kernel(supersampledTag, maskedTag, orientationTag,
+                                 std::true_type())
+                        : kernel(supersampledTag, maskedTag, orientationTag,
+                                 std::false_type());
+  };
+  dispatchKernel(m_superSampling > 1, m_density->isMasked(), orientation,
+                 withAdjacency);
+  addTileMoments(tileParts, moments);
+  if (adjacency) {
+    *adjacency = unpackPairs(edges);
+    if (frozen) *frozenBorders = findFrozenBorders(*adjacency, *frozen);
+  }
+  return moments;
+}
@@ -0,0 +1,55 @@
+#ifndef FUSEDCELLENGINE_H
+#define FUSEDCELLENGINE_H
+
+#include "cellengine.h"
+#include "densitymap.h"
+
+// CPU engine that never materializes an index map: the image is processed
+// in small tiles, each pixel is assigned to its nearest site (found via a
+// grid over the sites) and immediately added to that site's moments. With
+// supersampling, every pixel is split into sub-pixel samples whose density
+// is interpolated from the image at its original resolution. Tiles outside
+// the mask of a masked map are skipped, and so are tiles inside frozen
+// cells that only border frozen cells.
+//
+// The map can also be a horizontal strip of a taller image, starting at
+// row `top` of an image `imageHeight` rows high. Sites and positions then
+// refer to the whole image and the strip contributes partial moments. With
+// `rows` > 0 only the map rows [firstRow, firstRow + rows) are sampled, the
+// rows around them are halo rows that supersampled samples at the border
+// interpolate with, as they would on the whole image.
+class FusedCellEngine : public CellEngine {
+ public:
+  FusedCellEngine(std::shared_ptr<const DensityMap> density,
+                  int superSampling = 1, int top = 0, int imageHeight = 0,
+                  int firstRow = 0, int rows = 0);
+
+  CellResult compute(const StippleView& sites,
+                     const CellQuery& query) override;
+
+  // Moments of every site over the samples of the map, about the site in
+  // pixels of the image. `spacing` is the expected distance between sites in
+  // pixels, it sizes the site grid and the tiles. Without `orientation` the
+  // second order moments stay zero. With `adjacency` the pairs of sites
+  // owning neighbouring samples are collected as by accumulateCells().
+  // With `frozen` flags, the (frozen, non-frozen) pairs among them go to
+  // `frozenBorders` and, unless `adjacency` is asked for, tiles that only
+  // frozen sites can own are skipped if none of those borders a non-frozen
+  // site. Frozen sites without such a border then get partial moments.
+  std::vector<Moments> moments(
+      const StippleView& sites, float spacing, bool orientation = true,
+      std::vector<std::pair<uint32_t, uint32_t>>* adjacency = nullptr,
+      const std::vector<uint8_t>* frozen = nullptr,
+      std::vector<std::pair<uint32_t, uint32_t>>* frozenBorders =
+          nullptr) const;
+
+ private:
+  std::shared_ptr<const DensityMap> m_density;
+  int m_superSampling;
+  int m_top;
+  int m_imageHeight;
+  int m_firstRow;
+  int m_rows;
+};
+
+#endif  // FUSEDCELLENGINE_H
@@ -0,0 +1,38 @@
+#include "hysteresis.h"
+
+#include "checkpoint.h"
+
+void AdaptiveHysteresis::save(Checkpoint& checkpoint) const {
+  checkpoint.hysteresis = m_value;
+  checkpoint.direction = m_direction;
+  checkpoint.stalls = m_stalls;
+}
+
+void AdaptiveHysteresis::restore(const Checkpoint& checkpoint) {
+  m_value = checkpoint.hysteresis;
+  m_direction = checkpoint.direction;
+  m_stalls = checkpoint.stalls;
+}
+
+float AdaptiveHysteresis::next(const LBGStippling::Status& last) {
+  if (last.iteration == 0) return m_value;
+
+  const bool growing =
+      last.splits > last.merges && last.pointChange >= growthRate;
+  // splits and merges that mostly cancel, or a net change that flips sign,
+  // mean cells at the edge of the band go back and forth
+  const int direction =
+      (last.splits > last.merges) - (last.splits < last.merges);
+  const size_t net = last.splits > last.merges ? last.splits - last.merges
+                                               : last.merges - last.splits;
+  const bool oscillating =
+      direction * m_direction < 0 || 2 * net < last.splits + last.merges;
+  if (!growing && oscillating) {
+    ++m_stalls;
+    m_value += m_stalls * m_params.hysteresisDelta;
+  } else {
+    m_stalls = 0;
+  }
+  m_direction = direction;
+  return m_value;
+}
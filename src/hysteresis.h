@@ -0,0 +1,36 @@
+#ifndef HYSTERESIS_H
+#define HYSTERESIS_H
+
+#include <cstddef>
+
+#include "lbgstippling.h"
+
+struct Checkpoint;
+
+// Hysteresis driven by the split and merge counts of the previous
+// iteration. Widening the band early only leaves cells badly sized, so it
+// stays put while the count still grows by a noticeable fraction through
+// splits. Later every iteration in which cells flip between split and merge
+// widens the band, by a growing step while the oscillation persists.
+class AdaptiveHysteresis {
+ public:
+  explicit AdaptiveHysteresis(const LBGStippling::Params& params)
+      : m_params(params), m_value(params.hysteresis) {}
+
+  void save(Checkpoint& checkpoint) const;
+  void restore(const Checkpoint& checkpoint);
+
+  // The hysteresis of the iteration after `last`.
+  float next(const LBGStippling::Status& last);
+
+ private:
+  // relative growth of the point count that still counts as refining
+  static constexpr float growthRate = 0.1f;
+
+  const LBGStippling::Params& m_params;
+  float m_value;
+  int m_direction = 0;
+  size_t m_stalls = 0;
+};
+
+#endif  // HYSTERESIS_H
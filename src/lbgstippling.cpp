@@ -1,34 +1,40 @@
 #include "lbgstippling.h"
+#include "cellengine.h"
+#include "checkpoint.h"
+#include "contenthash.h"
+#include "hysteresis.h"
 #include "voronoicell.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <memory>
+#include <omp.h>
 #include <random>
+#include <sstream>
 
+#include <QRectF>
 #include <QVector>
 #include <QtMath>
 
 namespace Random {
-static std::random_device rd;
-static std::mt19937 gen(rd());
+// one generator per thread, channels are stippled concurrently
+static thread_local std::mt19937 gen(std::random_device{}());
 }  // namespace Random
 
 using Params = LBGStippling::Params;
 using Status = LBGStippling::Status;
 
-QVector<QVector2D> sites(const std::vector<Stipple> &stipples) {
-  QVector<QVector2D> sites(stipples.size());
-  std::transform(stipples.begin(), stipples.end(), sites.begin(),
-                 [](const auto &s) { return s.pos; });
-  return sites;
-}
-
-std::vector<Stipple> randomStipples(size_t n, float size) {
+// Random stipples within `region`, in normalized coordinates.
+StippleSet randomStipples(size_t n, float size, const QRectF &region) {
   std::uniform_real_distribution<float> dis(0.01f, 0.99f);
-  std::vector<Stipple> stipples(n);
-  std::generate(stipples.begin(), stipples.end(), [&]() {
-    return Stipple{QVector2D(dis(Random::gen), dis(Random::gen)), size,
-                   Qt::black};
-  });
+  StippleSet stipples;
+  stipples.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    const float x = region.x() + dis(Random::gen) * region.width();
+    const float y = region.y() + dis(Random::gen) * region.height();
+    stipples.push_back(QVector2D(x, y), size);
+  }
   return stipples;
 }
 
@@ -43,20 +49,13 @@ QVector2D jitter(QVector2D s) {
   return s += QVector2D(jitter_dis(gen), jitter_dis(gen));
 }
 
-float getSplitValueUpper(float pointDiameter, float hysteresis,
-                         size_t superSampling) {
-  const float pointArea = M_PIf32 * pow2(pointDiameter / 2.0f);
-  return (1.0f + hysteresis / 2.0f) * pointArea * pow2(superSampling);
-}
-
-float getSplitValueLower(float pointDiameter, float hysteresis,
-                         size_t superSampling) {
-  const float pointArea = M_PIf32 * pow2(pointDiameter / 2.0f);
-  return (1.0f - hysteresis / 2.0f) * pointArea * pow2(superSampling);
+float pointArea(float pointDiameter) {
+  return M_PIf32 * pow2(pointDiameter / 2.0f);
 }
 
+template <bool Adaptive>
 float stippleSize(const VoronoiCell &cell, const Params &params) {
-  if (params.adaptivePointSize) {
+  if (Adaptive) {
     const float avgIntensitySqrt = std::sqrt(cell.sumDensity / cell.area);
     return params.pointSizeMin * (1.0f - avgIntensitySqrt) +
            params.pointSizeMax * avgIntensitySqrt;
@@ -65,72 +64,468 @@ float stippleSize(const VoronoiCell &cell, const Params &params) {
   }
 }
 
+float stippleSize(const VoronoiCell &cell, const Params &params) {
+  return params.adaptivePointSize ? stippleSize<true>(cell, params)
+                                  : stippleSize<false>(cell, params);
+}
+
+enum class CellFate : uint8_t { Merge, Keep, Split };
+
+// The split and merge kernel: stipple diameter and fate of every cell that
+// is not frozen. A cell merges below (1 - hysteresis / 2) and splits above
+// (1 + hysteresis / 2) times its point area, scaled by `scale`.
+template <bool Adaptive>
+void classifyCells(const std::vector<VoronoiCell> &cells,
+                   const std::vector<uint8_t> &frozen, const Params &params,
+                   float hysteresis, float scale, std::vector<float> &diameters,
+                   std::vector<CellFate> &fates) {
+  const float lower = 1.0f - hysteresis / 2.0f;
+  const float upper = 1.0f + hysteresis / 2.0f;
+  diameters.resize(cells.size());
+  fates.resize(cells.size());
+
+  for (size_t i = 0; i < cells.size(); ++i) {
+    if (!frozen.empty() && frozen[i]) continue;
+    const VoronoiCell &cell = cells[i];
+    const float diameter = stippleSize<Adaptive>(cell, params);
+    const float area = pointArea(diameter);
+    diameters[i] = diameter;
+    if (cell.sumDensity < lower * area * scale || cell.area == 0.0f) {
+      fates[i] = CellFate::Merge;
+    } else if (cell.sumDensity < upper * area * scale) {
+      fates[i] = CellFate::Keep;
+    } else {
+      fates[i] = CellFate::Split;
+    }
+  }
+}
+
 float currentHysteresis(size_t i, const Params &params) {
   return params.hysteresis + i * params.hysteresisDelta;
 }
 
+// The pairs of neighbouring cells `adjacency` as pairs of the stipples the
+// cells turned into, cell i into stipples [first[i], first[i + 1]). Both
+// stipples of a split cell take its neighbours and border each other,
+// merged cells drop theirs.
+LBGStippling::Graph stippleGraph(
+    const std::vector<std::pair<uint32_t, uint32_t>> &adjacency,
+    const std::vector<uint32_t> &first) {
+  LBGStippling::Graph graph;
+  for (size_t i = 0; i + 1 < first.size(); ++i)
+    for (uint32_t a = first[i]; a + 1 < first[i + 1]; ++a)
+      graph.emplace_back(a, a + 1);
+  for (const auto &[i, j] : adjacency)
+    for (uint32_t a = first[i]; a < first[i + 1]; ++a)
+      for (uint32_t b = first[j]; b < first[j + 1]; ++b)
+        graph.emplace_back(a, b);
+  std::sort(graph.begin(), graph.end());
+  return graph;
+}
+
+// Per-stipple bookkeeping for freezing converged cells, aligned with the
+// stipple set.
+struct StabilityTracker {
+  std::vector<uint8_t> stableIterations;
+  std::vector<VoronoiCell> cells;
+
+  void resize(size_t n) {
+    stableIterations.resize(n, 0);
+    cells.resize(n, VoronoiCell{});
+  }
+
+  void push_back(uint8_t iterations, const VoronoiCell &cell) {
+    stableIterations.push_back(iterations);
+    cells.push_back(cell);
+  }
+};
+
+// Expected reach of a site's cone, in pixels of the input image, from the
+// area of its cell in the previous iteration.
+float coneRadius(float cellArea, const Params &params) {
+  // a few pixels minimum, whatever the factor, so that tiny cells still
+  // cover their own pixels
+  return std::max(2.0f,
+                  params.coneRadiusFactor * std::sqrt(cellArea / M_PIf32));
+}
+
+bool similarDensity(const VoronoiCell &cell, const VoronoiCell &previous,
+                    const Params &params) {
+  return std::abs(cell.sumDensity - previous.sumDensity) <=
+         params.freezeDensityChange * previous.sumDensity;
+}
+
+bool LBGStippling::converged(const Status &status, const Params &params) {
+  bool anyCriterion = false;
+  bool allMet = true;
+  auto check = [&](bool enabled, bool met) {
+    anyCriterion |= enabled;
+    allMet &= !enabled || met;
+  };
+  check(params.minPointChange > 0.0f,
+        status.pointChange <= params.minPointChange);
+  check(params.maxMeanDisplacement > 0.0f,
+        status.meanDisplacement <= params.maxMeanDisplacement);
+  check(params.maxMaxDisplacement > 0.0f,
+        status.maxDisplacement <= params.maxMaxDisplacement);
+  check(params.minStableFraction > 0.0f,
+        status.stableFraction >= params.minStableFraction);
+  return anyCriterion && allMet;
+}
+
+bool onTarget(const Status &status, const Params &params) {
+  if (params.targetPoints == 0) return true;
+  const float target = static_cast<float>(params.targetPoints);
+  return std::abs(status.size - target) <= params.targetTolerance * target;
+}
+
 bool notFinished(const Status &status, const Params &params) {
-  auto [iteration, size, splits, merges, hysteresis] = status;
-  return !((splits == 0 && merges == 0) || (iteration == params.maxIterations));
+  if (status.iteration == params.maxIterations) return false;
+  if (params.timeBudget > 0.0f && status.elapsed >= params.timeBudget)
+    return false;
+  // a target count has to be met before anything else ends the run
+  if (!onTarget(status, params)) return true;
+  if (status.splits == 0 && status.merges == 0) return false;
+  return !LBGStippling::converged(status, params);
+}
+
+// Threshold scale at which a stipple of point area `meanArea` covers its
+// share total / targetPoints of the density, times `trim`.
+float targetScale(double densityShare, double meanArea, float trim) {
+  return static_cast<float>(densityShare / meanArea * trim);
+}
+
+// Trim of the target scale after an iteration that left `points` stipples.
+// Cells settle with density ratios anywhere inside the hysteresis band, so
+// the count can miss the target by about the band. The trim follows the
+// count error by at most 5% per iteration, which keeps the splitting phase
+// from overshooting, and stays within the square of the band.
+float targetTrim(size_t points, float trim, float hysteresis,
+                 const Params &params) {
+  const double error = static_cast<double>(points) / params.targetPoints;
+  const double step = std::min(std::max(error, 0.95), 1.05);
+  const double lower = 1.0 / (1.0 + hysteresis / 2.0);
+  const double upper = 1.0 / std::max(0.1, 1.0 - hysteresis / 2.0);
+  return static_cast<float>(
+      std::min(std::max(trim * step, lower * lower), upper * upper));
+}
+
+uint64_t LBGStippling::hash(const Params &params, uint64_t hash) {
+  // must follow new parameters that change the result
+  const double values[] = {
+      static_cast<double>(params.initialPoints),
+      params.initialPointSize,
+      params.adaptivePointSize ? 1.0 : 0.0,
+      params.pointSizeMin,
+      params.pointSizeMax,
+      static_cast<double>(params.superSamplingFactor),
+      static_cast<double>(params.maxIterations),
+      static_cast<double>(params.targetPoints),
+      params.targetTolerance,
+      static_cast<double>(params.engine),
+      params.coneRadiusFactor,
+      params.hysteresis,
+      params.hysteresisDelta,
+      static_cast<double>(params.hysteresisSchedule),
+      params.minPointChange,
+      params.maxMeanDisplacement,
+      params.maxMaxDisplacement,
+      params.minStableFraction,
+      params.stableDisplacement,
+      static_cast<double>(params.freezeIterations),
+      params.freezeDisplacement,
+      params.freezeDensityChange};
+  hash = hashBytes(values, sizeof(values), hash);
+  return hashBytes(&params.seed, sizeof(params.seed), hash);
 }
 
 LBGStippling::LBGStippling() {
   m_statusCallback = [](const Status &) {};
-  m_stippleCallback = [](const std::vector<Stipple> &) {};
+  m_stippleCallback = [](const StippleView &) {};
 }
 
 void LBGStippling::setStatusCallback(Report<Status> statusCB) {
   m_statusCallback = statusCB;
 }
 
-void LBGStippling::setStippleCallback(Report<std::vector<Stipple>> stippleCB) {
+void LBGStippling::setStippleCallback(Report<StippleView> stippleCB) {
   m_stippleCallback = stippleCB;
 }
 
-std::vector<Stipple> LBGStippling::stipple(const QImage &density,
-                                           const Params &params) const {
-  QImage densityGray =
-      density
-          .scaledToWidth(params.superSamplingFactor * density.width(),
-                         Qt::SmoothTransformation)
-          .convertToFormat(QImage::Format_Grayscale8);
+StippleSet LBGStippling::stipple(const QImage &density,
+                                 const Params &params) const {
+  return stipple(m_densityCache.get(density, params.preprocessing), params);
+}
 
-  VoronoiDiagram voronoi(densityGray);
+StippleSet LBGStippling::stipple(std::shared_ptr<const DensityMap> density,
+                                 const Params &params, Graph *graph) const {
+  return stippleChannel(std::move(density), params, 0, graph);
+}
 
-  std::vector<Stipple> stipples =
-      randomStipples(params.initialPoints, params.initialPointSize);
+std::vector<StippleSet> LBGStippling::stipple(
+    const std::vector<std::shared_ptr<const DensityMap>> &channels,
+    const Params &params, std::vector<Graph> *graphs) const {
+  std::vector<StippleSet> layers(channels.size());
+  if (graphs) graphs->assign(channels.size(), Graph());
+  if (channels.empty()) return layers;
+  auto graph = [graphs](size_t c) { return graphs ? &(*graphs)[c] : nullptr; };
+
+  // every channel keeps its own checkpoint
+  std::vector<Params> channelParams(channels.size(), params);
+  if (!params.checkpointPath.empty()) {
+    for (size_t c = 0; c < channels.size(); ++c)
+      channelParams[c].checkpointPath += "." + std::to_string(c);
+  }
+
+  if (params.engine == CellEngineType::GPU) {
+    // The OpenGL context is bound to the thread that creates the engine and
+    // the diagrams share it, so the channels take turns on it and a run
+    // takes as long as its channels one by one.
+    for (size_t c = 0; c < channels.size(); ++c)
+      layers[c] = stippleChannel(channels[c], channelParams[c], c, graph(c));
+    return layers;
+  }
+
+  // One thread per channel, the parallel loops of the cell engines split
+  // the remaining threads between them. A channel that finishes early
+  // leaves its share idle, but channels of one image take similar times.
+  const int threads = omp_get_max_threads();
+  const int teams = std::min<int>(threads, static_cast<int>(channels.size()));
+  const int levels = omp_get_max_active_levels();
+  omp_set_max_active_levels(2);
+
+  #pragma omp parallel for num_threads(teams) schedule(dynamic, 1)
+  for (int c = 0; c < static_cast<int>(channels.size()); ++c) {
+    omp_set_num_threads(std::max(1, threads / teams));
+    layers[c] = stippleChannel(channels[c], channelParams[c], c, graph(c));
+  }
+
+  omp_set_max_active_levels(levels);
+  return layers;
+}
+
+StippleSet LBGStippling::stippleChannel(
+    std::shared_ptr<const DensityMap> density, const Params &params,
+    size_t channel, Graph *graph) const {
+  using Clock = std::chrono::steady_clock;
+  Clock::time_point start = Clock::now();
+  if (graph) graph->clear();
+
+  // supersampling happens inside the engine, on the original resolution
+  const int width = density->width();
+  const int height = density->height();
+  // stippling starts inside the bounding box of a mask
+  const QRect bounds = density->bounds();
+  if (bounds.isEmpty()) return StippleSet();
+  const QRectF region(static_cast<qreal>(bounds.x()) / width,
+                      static_cast<qreal>(bounds.y()) / height,
+                      static_cast<qreal>(bounds.width()) / width,
+                      static_cast<qreal>(bounds.height()) / height);
+
+  // target mode: every stipple covers the same share of the total density
+  const double densityShare =
+      params.targetPoints > 0 ? density->total() / params.targetPoints : 0.0;
+  float thresholdTrim = 1.0f;
+  float thresholdScale = 1.0f;
+  if (params.targetPoints > 0) {
+    const float meanDensity =
+        static_cast<float>(density->total() / density->area());
+    VoronoiCell average{QVector2D(), 0.0f, 1.0f, meanDensity};
+    thresholdScale = targetScale(
+        densityShare, pointArea(stippleSize(average, params)), thresholdTrim);
+  }
+
+  if (params.seed != 0) {
+    const uint64_t seed = params.seed + channel;
+    std::seed_seq sequence{static_cast<uint32_t>(seed),
+                           static_cast<uint32_t>(seed >> 32)};
+    Random::gen.seed(sequence);
+  } else {
+    Random::gen.seed(std::random_device{}());
+  }
+
+  // checkpoints are tied to the density map and the parameters
+  std::unique_ptr<CheckpointWriter> checkpointWriter;
+  std::unique_ptr<Checkpoint> resumed;
+  uint64_t checkpointKey = 0;
+  if (!params.checkpointPath.empty() &&
+      (params.checkpointInterval > 0 || params.resume)) {
+    checkpointKey = hash(params, density->hash());
+    if (params.resume) {
+      resumed = std::make_unique<Checkpoint>();
+      if (!resumed->read(params.checkpointPath) ||
+          resumed->key != checkpointKey || !resumed->fits(params))
+        resumed.reset();
+    }
+    checkpointWriter =
+        std::make_unique<CheckpointWriter>(params.checkpointPath);
+  }
+
+  std::unique_ptr<CellEngine> engine =
+      createCellEngine(params.engine, std::move(density),
+                       static_cast<int>(params.superSamplingFactor));
+
+  StippleSet stipples =
+      randomStipples(params.initialPoints, params.initialPointSize, region);
+
+  const bool freezing = params.freezeIterations > 0;
+  const size_t freezeIterations =
+      std::min(params.freezeIterations, MaxFreezeIterations);
+  StabilityTracker tracker;
+  if (freezing) tracker.resize(stipples.size());
+
+  // cone radii from the previous iteration, empty draws full-size cones
+  const bool boundedCones = params.coneRadiusFactor > 0.0f;
+  std::vector<float> radii;
 
   Status status = {0, 0, 1, 1, params.hysteresis};
+  status.channel = channel;
+
+  AdaptiveHysteresis adaptiveHysteresis(params);
+
+  // the kernel is chosen once, not per cell
+  const auto classify = params.adaptivePointSize ? classifyCells<true>
+                                                 : classifyCells<false>;
+  bool graphCollected = false;
+  std::vector<float> diameters;
+  std::vector<CellFate> fates;
+
+  if (resumed) {
+    stipples = std::move(resumed->stipples);
+    tracker.stableIterations = std::move(resumed->stableIterations);
+    tracker.cells = std::move(resumed->cells);
+    radii = std::move(resumed->radii);
+    status = resumed->status;
+    thresholdScale = resumed->thresholdScale;
+    thresholdTrim = resumed->thresholdTrim;
+    adaptiveHysteresis.restore(*resumed);
+    std::istringstream random(resumed->random);
+    random >> Random::gen;
+    // the elapsed time carries on from the interrupted run
+    start -= std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<float>(status.elapsed));
+    resumed.reset();
+  }
 
   while (notFinished(status, params)) {
+    const float hysteresis =
+        params.hysteresisSchedule == HysteresisSchedule::Adaptive
+            ? adaptiveHysteresis.next(status)
+            : currentHysteresis(status.iteration, params);
+    status.hysteresis = hysteresis;
+
     status.splits = 0;
     status.merges = 0;
-    auto indexMap = voronoi.calculate(sites(stipples));
-    std::vector<VoronoiCell> cells = accumulateCells(indexMap, densityGray);
+    status.frozen = 0;
+    // Frozen cells only need to be accumulated if they border a non-frozen
+    // cell, otherwise neither their site nor any neighbour has moved.
+    std::vector<uint8_t> frozen;
+    bool anyFrozen = false;
+    if (freezing) {
+      frozen.resize(stipples.size());
+      for (size_t i = 0; i < frozen.size(); ++i) {
+        frozen[i] = tracker.stableIterations[i] >= freezeIterations;
+        anyFrozen = anyFrozen || frozen[i];
+      }
+    }
+
+    CellQuery query;
+    query.radii = boundedCones ? &radii : nullptr;
+    // the graph is collected by the last iteration, over all cells
+    query.adjacency = graph && status.iteration + 1 == params.maxIterations;
+    // until a cell freezes there are no borders to look for
+    query.frozen = anyFrozen && !query.adjacency ? &frozen : nullptr;
+    // Orientations only matter for cells that split, which is only known
+    // once the cells are complete. They are always accumulated: the three
+    // moments cost far less than a second pass over the cells would.
+    query.orientation = true;
+    const CellResult result = engine->compute(stipples.view(), query);
+    classify(result.cells, frozen, params, hysteresis, thresholdScale,
+             diameters, fates);
+    radii.clear();
+
+    const std::vector<VoronoiCell> &cells = result.cells;
+    const std::vector<uint8_t> &skip = result.skipped;
+    const auto &frozenBorders = result.frozenBorders;
 
     assert(cells.size() == stipples.size());
 
+    StippleSet previous = std::move(stipples);
     stipples.clear();
+    stipples.reserve(cells.size());
+
+    StabilityTracker previousTracker = std::move(tracker);
+    tracker = StabilityTracker();
+    // new index of every kept stipple and whether its site changed notably
+    std::vector<uint32_t> newIndex(freezing ? cells.size() : 0);
+    std::vector<uint8_t> changed(freezing ? cells.size() : 0, 1);
+
+    status.thresholdScale = thresholdScale;
+
+    // centroid movement of kept cells, in pixels of the input image
+    float sumDisplacement = 0.0f;
+    float maxDisplacement = 0.0f;
+    size_t kept = 0;
+    size_t stable = 0;
+    // cell i turns into the stipples [first[i], first[i + 1])
+    std::vector<uint32_t> first(query.adjacency ? cells.size() + 1 : 0);
+
+    for (size_t i = 0; i < cells.size(); ++i) {
+      if (query.adjacency) first[i] = stipples.size();
+      if (freezing && frozen[i]) {
+        // frozen site stays in place, a recomputed cell refreshes the cache
+        VoronoiCell cached = previousTracker.cells[i];
+        uint8_t iterations = previousTracker.stableIterations[i];
+        if (!skip[i]) {
+          if (!similarDensity(cells[i], cached, params)) iterations = 0;
+          cached = cells[i];
+        }
+        newIndex[i] = stipples.size();
+        changed[i] = 0;
+        stipples.push_back(previous.pos(i), previous[i].size);
+        tracker.push_back(iterations, cached);
+        if (boundedCones) radii.push_back(coneRadius(cached.area, params));
+        ++kept;
+        ++stable;
+        ++status.frozen;
+        continue;
+      }
 
-    float hysteresis = currentHysteresis(status.iteration, params);
-    status.hysteresis = hysteresis;
-
-    for (const auto &cell : cells) {
-      const float totalDensity = cell.sumDensity;
-      const float diameter = stippleSize(cell, params);
+      const VoronoiCell &cell = cells[i];
+      const float diameter = diameters[i];
 
-      if (totalDensity < getSplitValueLower(diameter, hysteresis,
-                                            params.superSamplingFactor) ||
-          cell.area == 0.0f) {
+      if (fates[i] == CellFate::Merge) {
         // cell too small - merge
         ++status.merges;
         continue;
       }
 
-      if (totalDensity < getSplitValueUpper(diameter, hysteresis,
-                                            params.superSamplingFactor)) {
+      if (fates[i] == CellFate::Keep) {
         // cell size within acceptable range - keep
-        stipples.push_back({cell.centroid, diameter, Qt::black});
+        if (freezing) newIndex[i] = stipples.size();
+        stipples.push_back(cell.centroid, diameter);
+        if (boundedCones) radii.push_back(coneRadius(cell.area, params));
+
+        const QVector2D move = cell.centroid - previous.pos(i);
+        const float displacement = std::hypot(move.x() * width,
+                                              move.y() * height);
+        sumDisplacement += displacement;
+        maxDisplacement = std::max(maxDisplacement, displacement);
+        ++kept;
+        if (displacement < params.stableDisplacement) ++stable;
+
+        if (freezing) {
+          const bool resting = displacement < params.freezeDisplacement;
+          const bool stableCell =
+              resting && similarDensity(cell, previousTracker.cells[i], params);
+          const uint8_t iterations =
+              stableCell ? std::min<size_t>(
+                               previousTracker.stableIterations[i] + 1,
+                               MaxFreezeIterations)
+                         : 0;
+          tracker.push_back(iterations, cell);
+          changed[i] = !resting;
+        }
         continue;
       }
 
@@ -144,8 +539,8 @@ std::vector<Stipple> LBGStippling::stipple(const QImage &density,
           splitVector.x() * std::cos(a) - splitVector.y() * std::sin(a),
           splitVector.y() * std::cos(a) + splitVector.x() * std::sin(a));
 
-      splitVectorRotated.setX(splitVectorRotated.x() / densityGray.width());
-      splitVectorRotated.setY(splitVectorRotated.y() / densityGray.height());
+      splitVectorRotated.setX(splitVectorRotated.x() / width);
+      splitVectorRotated.setY(splitVectorRotated.y() / height);
 
       QVector2D splitSeed1 = cell.centroid - splitVectorRotated;
       QVector2D splitSeed2 = cell.centroid + splitVectorRotated;
@@ -157,24 +552,92 @@ std::vector<Stipple> LBGStippling::stipple(const QImage &density,
       splitSeed2.setX(std::max(0.0f, std::min(splitSeed2.x(), 1.0f)));
       splitSeed2.setY(std::max(0.0f, std::min(splitSeed2.y(), 1.0f)));
 
-      stipples.push_back({jitter(splitSeed1), diameter, Qt::red});
-      stipples.push_back({jitter(splitSeed2), diameter, Qt::red});
+      stipples.push_back(jitter(splitSeed1), diameter, StippleTag::Split);
+      stipples.push_back(jitter(splitSeed2), diameter, StippleTag::Split);
+      if (boundedCones) {
+        radii.push_back(coneRadius(area / 2.0f, params));
+        radii.push_back(coneRadius(area / 2.0f, params));
+      }
+      if (freezing) {
+        tracker.push_back(0, VoronoiCell{});
+        tracker.push_back(0, VoronoiCell{});
+      }
 
       ++status.splits;
     }
+    if (query.adjacency) {
+      first.back() = stipples.size();
+      *graph = stippleGraph(result.adjacency, first);
+      graphCollected = true;
+    }
+    // a frozen cell next to a merged, split or moved site has to thaw, its
+    // own cell will change in the next iteration
+    for (const auto &border : frozenBorders) {
+      if (changed[border.second])
+        tracker.stableIterations[newIndex[border.first]] = 0;
+    }
+
+    status.pointChange =
+        std::abs(static_cast<float>(stipples.size()) - previous.size()) /
+        std::max<size_t>(1, previous.size());
+    // without kept cells nothing has settled yet
+    const float none = std::numeric_limits<float>::max();
+    status.meanDisplacement = kept > 0 ? sumDisplacement / kept : none;
+    status.maxDisplacement = kept > 0 ? maxDisplacement : none;
+    status.stableFraction =
+        static_cast<float>(stable) / std::max<size_t>(1, cells.size());
+    status.elapsed =
+        std::chrono::duration<float>(Clock::now() - start).count();
+
     status.size = stipples.size();
-    m_stippleCallback(stipples);
-    m_statusCallback(status);
+    if (params.targetPoints > 0 && !stipples.empty()) {
+      double sumArea = 0.0;
+      const StippleView view = stipples.view();
+      for (size_t i = 0; i < view.size(); ++i)
+        sumArea += pointArea(view.sizes()[i]);
+      thresholdTrim =
+          targetTrim(stipples.size(), thresholdTrim, hysteresis, params);
+      thresholdScale =
+          targetScale(densityShare, sumArea / stipples.size(), thresholdTrim);
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_reportMutex);
+      m_stippleCallback(stipples.view());
+      m_statusCallback(status);
+    }
 
     ++status.iteration;
-    ++this->iter;
+    // every cell merged, there is nothing left to place
+    if (stipples.empty()) break;
+
+    if (checkpointWriter && params.checkpointInterval > 0 &&
+        status.iteration % params.checkpointInterval == 0 &&
+        notFinished(status, params)) {
+      // the copy is cheap next to an iteration, the writing is not
+      auto checkpoint = std::make_unique<Checkpoint>();
+      checkpoint->key = checkpointKey;
+      checkpoint->status = status;
+      checkpoint->thresholdScale = thresholdScale;
+      checkpoint->thresholdTrim = thresholdTrim;
+      adaptiveHysteresis.save(*checkpoint);
+      checkpoint->stipples = stipples;
+      checkpoint->stableIterations = tracker.stableIterations;
+      checkpoint->cells = tracker.cells;
+      checkpoint->radii = radii;
+      std::ostringstream random;
+      random << Random::gen;
+      checkpoint->random = random.str();
+      checkpointWriter->write(std::move(checkpoint));
+    }
+  }
+  if (checkpointWriter) checkpointWriter->remove();
+
+  // a run that stopped before maxIterations never knew its last iteration
+  if (graph && !graphCollected && !stipples.empty()) {
+    CellQuery query;
+    query.orientation = false;
+    query.adjacency = true;
+    *graph = engine->compute(stipples.view(), query).adjacency;
   }
   return stipples;
 }
-
-bool LBGStippling::draw() const {
-  if(this->iter%5==0)
-    return(true);
-  else
-    return(false);
-}
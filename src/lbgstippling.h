@@ -1,20 +1,32 @@
 #ifndef LBGSTIPPLING_H
 #define LBGSTIPPLING_H
 
-#include "voronoidiagram.h"
+#include "cellengine.h"
+#include "densitycache.h"
+#include "stippleset.h"
 
 #include <QImage>
 #include <QVector2D>
 
-// TODO: Color is only used for debugging
-struct Stipple {
-  QVector2D pos;
-  float size;
-  QColor color;
-};
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// How the hysteresis band evolves over the iterations. Linear widens it by
+// hysteresisDelta every iteration. Adaptive keeps it at its initial width
+// while splitting still grows the point count and only widens it, in
+// growing multiples of hysteresisDelta, while splits and merges oscillate.
+enum class HysteresisSchedule { Linear, Adaptive };
 
 class LBGStippling {
  public:
+  // Largest number of stable iterations a cell is frozen after.
+  static constexpr size_t MaxFreezeIterations = 255;
+
   struct Params {
     size_t initialPoints = 1;
     float initialPointSize = 1.0f;
@@ -23,11 +35,70 @@ class LBGStippling {
     float pointSizeMin = 2.0f;
     float pointSizeMax = 4.0f;
 
+    // Samples per pixel and axis taken by the cell engine. The image is
+    // interpolated on the fly, never upscaled. Only the CPU and distributed
+    // engines keep no per-sample memory: the GPU engine still renders and
+    // reads back its index map at factor^2 times the image area, the
+    // analytic engine ignores the factor.
     size_t superSamplingFactor = 1;
     size_t maxIterations = 50;
 
+    // Aims for this many stipples, zero disables the target. The split and
+    // merge thresholds give every stipple an equal share of the total
+    // density, a small trim steers the count into targetTolerance (relative)
+    // of the target; point sizes stay as set.
+    size_t targetPoints = 0;
+    float targetTolerance = 0.01f;
+
+    CellEngineType engine = CellEngineType::GPU;
+
+    // Tone adjustments applied while converting the image into densities.
+    DensityTransform preprocessing;
+
+    // Bounds each site's distance cone to this multiple of the radius of its
+    // previous cell (as a circle of equal area) instead of drawing cones
+    // across the whole image. Zero draws full-size cones.
+    float coneRadiusFactor = 0.0f;
+
     float hysteresis = 0.6f;
     float hysteresisDelta = 0.01f;
+    HysteresisSchedule hysteresisSchedule = HysteresisSchedule::Linear;
+
+    // Additional convergence criteria, a value of zero disables the
+    // criterion. The algorithm stops as soon as all enabled criteria hold.
+    float minPointChange = 0.0f;       // relative change of the point count
+    float maxMeanDisplacement = 0.0f;  // mean centroid movement in pixels
+    float maxMaxDisplacement = 0.0f;   // largest centroid movement in pixels
+    float minStableFraction = 0.0f;    // fraction of stable cells
+    // Cells that are kept and move less than this (in pixels) are stable.
+    float stableDisplacement = 0.5f;
+
+    // Cells that stayed kept, moved less than freezeDisplacement pixels and
+    // changed their density by less than freezeDensityChange (relative) for
+    // freezeIterations iterations are frozen: their site no longer moves and
+    // their moments are only recomputed when a neighbouring cell changes.
+    // Stable iterations are counted in a byte per cell, larger values are
+    // taken as MaxFreezeIterations.
+    size_t freezeIterations = 0;  // 0 disables freezing
+    float freezeDisplacement = 0.1f;
+    float freezeDensityChange = 0.01f;
+
+    // Wall-clock budget in seconds, the run stops after the first iteration
+    // exceeding it (zero disables the budget).
+    float timeBudget = 0.0f;
+
+    // Seed of the random initial points and jitter, channel c of a
+    // multi-channel run uses seed + c. Zero seeds from the system.
+    uint64_t seed = 0;
+
+    // Saves the state of the run to checkpointPath every checkpointInterval
+    // iterations (zero disables checkpoints), written in the background and
+    // deleted once the run finishes. Channel c of a multi-channel run
+    // appends ".c" to the path. With resume set, a run continues from a
+    // checkpoint of the same density map and parameters if there is one.
+    std::string checkpointPath;
+    size_t checkpointInterval = 0;
+    bool resume = false;
   };
 
   struct Status {
@@ -36,27 +107,71 @@ class LBGStippling {
     size_t splits;
     size_t merges;
     float hysteresis;
+    size_t frozen = 0;
+    float thresholdScale = 1.0f;  // applied to the split and merge thresholds
+    size_t channel = 0;           // index of the map in multi-channel runs
+
+    float pointChange = std::numeric_limits<float>::max();
+    float meanDisplacement = std::numeric_limits<float>::max();
+    float maxDisplacement = std::numeric_limits<float>::max();
+    float stableFraction = 0.0f;
+    float elapsed = 0.0f;  // seconds since the start of the run
   };
 
-  mutable size_t iter;
-
   template <class T>
   using Report = std::function<void(const T&)>;
 
-  LBGStippling();
+  // Pairs (i, j), i < j, of stipples whose cells share a border: their
+  // Delaunay graph as resolved by params.engine. A run collects it while
+  // it accumulates the cells of its last iteration, which are those of the
+  // sites before they moved to the centroids. Both stipples of a cell split
+  // in that iteration take its neighbours and border each other, merged
+  // cells drop theirs. Only the last iteration by maxIterations is known in
+  // advance; a run that stops earlier accumulates the cells of its final
+  // stipples once more, which costs 1.2 to 1.5 regular iterations
+  // (bench/kernelsbench, column neighbours).
+  using Graph = std::vector<std::pair<uint32_t, uint32_t>>;
 
-  std::vector<Stipple> stipple(const QImage& density,
-                               const Params& params) const;
+  LBGStippling();
 
-  bool draw() const;
+  StippleSet stipple(const QImage& density, const Params& params) const;
+  // Stipples an already preprocessed density map, params.preprocessing is
+  // not applied again. With `graph`, the neighbour graph of the stipples
+  // goes there.
+  StippleSet stipple(std::shared_ptr<const DensityMap> density,
+                     const Params& params, Graph* graph = nullptr) const;
+  // Stipples several density maps, e.g. the inks of a colour separation,
+  // concurrently with the same parameters and returns one set per map.
+  // Reports are serialized, Status::channel tells them apart. The GPU
+  // engine is the exception: its OpenGL context belongs to the calling
+  // thread, so its channels run one after another. With `graphs`, the
+  // neighbour graph of every set goes there.
+  std::vector<StippleSet> stipple(
+      const std::vector<std::shared_ptr<const DensityMap>>& channels,
+      const Params& params, std::vector<Graph>* graphs = nullptr) const;
+
+  // Whether every convergence criterion enabled in `params` holds for
+  // `status`, false if none is enabled.
+  static bool converged(const Status& status, const Params& params);
+
+  // Hash of every parameter that changes the result, continuing `hash`.
+  // The preprocessing is left out, it is part of the density map.
+  static uint64_t hash(const Params& params, uint64_t hash);
 
   // TODO: Rename and method chaining.
   void setStatusCallback(Report<Status> statusCB);
-  void setStippleCallback(Report<std::vector<Stipple>> stippleCB);
+  void setStippleCallback(Report<StippleView> stippleCB);
 
  private:
   Report<Status> m_statusCallback;
-  Report<std::vector<Stipple>> m_stippleCallback;
+  Report<StippleView> m_stippleCallback;
+  mutable std::mutex m_reportMutex;
+  // density maps of recent images, so reruns skip the preprocessing
+  mutable DensityCache m_densityCache;
+
+  StippleSet stippleChannel(std::shared_ptr<const DensityMap> density,
+                            const Params& params, size_t channel,
+                            Graph* graph) const;
 };
 
 #endif  // LBGSTIPPLING_H
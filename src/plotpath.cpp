@@ -0,0 +1,464 @@
+#include "plotpath.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <omp.h>
+
+namespace {
+
+// near neighbours considered for every move
+const int Neighbours = 8;
+// Longest parts of the tour moves may reverse, one pass each while time is
+// left. Reversals cost their length, on millions of points unbounded ones
+// would use up the time budget on a few moves, so short ones come first.
+const uint32_t MaxReversals[] = {1000, 50000, ~uint32_t(0)};
+
+// Uniform grid over the points, about two points per cell. Every cell keeps
+// its points in one range of `entries`; the first `live` of them are the
+// ones not yet taken by the nearest neighbour tour.
+class PointGrid {
+ public:
+  PointGrid(const std::vector<float>& x, const std::vector<float>& y)
+      : m_x(x), m_y(y) {
+    const size_t n = x.size();
+    const auto [minX, maxX] = std::minmax_element(x.begin(), x.end());
+    const auto [minY, maxY] = std::minmax_element(y.begin(), y.end());
+    m_left = *minX;
+    m_top = *minY;
+    const float w = *maxX - *minX;
+    const float h = *maxY - *minY;
+    // points on a line still spread over about n / 2 cells
+    const float extent = std::max(w, h);
+    const float area = std::max(w * h, extent * extent / n);
+    m_cellSize = std::sqrt(2.0f * area / n);
+    if (!(m_cellSize > 0.0f)) m_cellSize = 1.0f;
+    m_cols = static_cast<int>(w / m_cellSize) + 1;
+    m_rows = static_cast<int>(h / m_cellSize) + 1;
+
+    std::vector<uint32_t> cells(n);
+    m_start.assign(static_cast<size_t>(m_cols) * m_rows + 1, 0);
+    for (size_t i = 0; i < n; ++i) {
+      cells[i] = cell(col(x[i]), row(y[i]));
+      ++m_start[cells[i] + 1];
+    }
+    for (size_t c = 1; c < m_start.size(); ++c) m_start[c] += m_start[c - 1];
+    m_entries.resize(n);
+    m_slot.resize(n);
+    std::vector<uint32_t> fill(m_start.begin(), m_start.end() - 1);
+    for (size_t i = 0; i < n; ++i) {
+      m_slot[i] = fill[cells[i]]++;
+      m_entries[m_slot[i]] = static_cast<uint32_t>(i);
+    }
+    m_live.resize(m_start.size() - 1);
+    for (size_t c = 0; c + 1 < m_start.size(); ++c)
+      m_live[c] = m_start[c + 1] - m_start[c];
+  }
+
+  // Takes point i out of the live points.
+  void remove(uint32_t i) {
+    const uint32_t c = cell(col(m_x[i]), row(m_y[i]));
+    const uint32_t last = m_start[c] + --m_live[c];
+    const uint32_t other = m_entries[last];
+    std::swap(m_entries[m_slot[i]], m_entries[last]);
+    std::swap(m_slot[i], m_slot[other]);
+  }
+
+  // Nearest live point to (px, py), or none if no point is live.
+  uint32_t nearest(float px, float py) const {
+    uint32_t best = none;
+    float bestDist = std::numeric_limits<float>::max();
+    scan(px, py, [&](uint32_t i, float dist) {
+      if (dist < bestDist) {
+        bestDist = dist;
+        best = i;
+      }
+      return bestDist;
+    });
+    return best;
+  }
+
+  // The `Neighbours` points closest to point i, nearest first, all points
+  // counting as live.
+  void neighbours(uint32_t i, uint32_t* out) const {
+    std::pair<float, uint32_t> found[Neighbours];
+    int count = 0;
+    scan(m_x[i], m_y[i],
+         [&](uint32_t j, float dist) {
+           if (j == i) return count < Neighbours ? max : found[count - 1].first;
+           if (count < Neighbours || dist < found[count - 1].first) {
+             int k = std::min(count, Neighbours - 1);
+             for (; k > 0 && found[k - 1].first > dist; --k)
+               found[k] = found[k - 1];
+             found[k] = {dist, j};
+             count = std::min(count + 1, Neighbours);
+           }
+           return count < Neighbours ? max : found[count - 1].first;
+         },
+         true);
+    for (int k = 0; k < Neighbours; ++k)
+      out[k] = k < count ? found[k].second : none;
+  }
+
+  static constexpr uint32_t none = ~uint32_t(0);
+
+ private:
+  static constexpr float max = std::numeric_limits<float>::max();
+
+  const std::vector<float>& m_x;
+  const std::vector<float>& m_y;
+  float m_left;
+  float m_top;
+  float m_cellSize;
+  int m_cols;
+  int m_rows;
+  std::vector<uint32_t> m_start;
+  std::vector<uint32_t> m_entries;
+  std::vector<uint32_t> m_slot;  // position of every point in m_entries
+  std::vector<uint32_t> m_live;
+
+  int col(float x) const {
+    return std::min(m_cols - 1,
+                    std::max(0, static_cast<int>((x - m_left) / m_cellSize)));
+  }
+  int row(float y) const {
+    return std::min(m_rows - 1,
+                    std::max(0, static_cast<int>((y - m_top) / m_cellSize)));
+  }
+  uint32_t cell(int c, int r) const {
+    return static_cast<uint32_t>(r) * m_cols + c;
+  }
+
+  // Visits the points in rings of cells around (px, py) and passes their
+  // squared distances to `visit`, which returns the squared distance within
+  // which it still looks for points. Points in ring r + 1 are at least r
+  // cells away, so the scan stops once that is beyond the returned bound.
+  template <class Visit>
+  void scan(float px, float py, Visit&& visit, bool all = false) const {
+    const int cx = col(px);
+    const int cy = row(py);
+    const int rings = std::max(m_cols, m_rows);
+    float bound = max;
+    for (int r = 0; r <= rings; ++r) {
+      const int r0 = std::max(0, cy - r);
+      const int r1 = std::min(m_rows - 1, cy + r);
+      for (int cr = r0; cr <= r1; ++cr) {
+        const bool edge = cr == cy - r || cr == cy + r;
+        const int step = edge ? 1 : 2 * r;
+        for (int cc = cx - r; cc <= cx + r; cc += std::max(1, step)) {
+          if (cc < 0 || cc >= m_cols) continue;
+          const uint32_t c = cell(cc, cr);
+          const uint32_t end = m_start[c] + (all ? m_start[c + 1] - m_start[c]
+                                                 : m_live[c]);
+          for (uint32_t e = m_start[c]; e < end; ++e) {
+            const uint32_t j = m_entries[e];
+            const float dx = m_x[j] - px;
+            const float dy = m_y[j] - py;
+            bound = visit(j, dx * dx + dy * dy);
+          }
+        }
+      }
+      const float reach = r * m_cellSize;
+      if (bound <= reach * reach) break;
+    }
+  }
+};
+
+// Closed tour stored as the order of the points and the position of every
+// point in it.
+class Tour {
+ public:
+  explicit Tour(std::vector<uint32_t> order)
+      : m_order(std::move(order)), m_pos(m_order.size()) {
+    for (size_t i = 0; i < m_order.size(); ++i) m_pos[m_order[i]] = i;
+  }
+
+  const std::vector<uint32_t>& order() const { return m_order; }
+  uint32_t size() const { return static_cast<uint32_t>(m_order.size()); }
+  uint32_t position(uint32_t a) const { return m_pos[a]; }
+  uint32_t next(uint32_t a) const {
+    const uint32_t i = m_pos[a] + 1;
+    return m_order[i == size() ? 0 : i];
+  }
+  uint32_t prev(uint32_t a) const {
+    const uint32_t i = m_pos[a];
+    return m_order[i == 0 ? size() - 1 : i - 1];
+  }
+
+  // Number of points move(a, b, c, d) reverses.
+  uint32_t moveLength(uint32_t a, uint32_t b, uint32_t c, uint32_t d) const {
+    const uint32_t length = next(a) == b ? span(b, c) : span(a, d);
+    return std::min(length, size() - length);
+  }
+
+  // Replaces the edges (a, b) and (c, d) by (a, c) and (b, d), where b and
+  // d follow a and c in the same direction.
+  void move(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    if (next(a) == b)
+      reverse(b, c);
+    else
+      reverse(a, d);
+  }
+
+ private:
+  std::vector<uint32_t> m_order;
+  std::vector<uint32_t> m_pos;
+
+  // Number of points from `from` forward to `to`.
+  uint32_t span(uint32_t from, uint32_t to) const {
+    return (m_pos[to] + size() - m_pos[from]) % size() + 1;
+  }
+
+  // Reverses the part from `from` forward to `to`, or the rest of the
+  // tour if that is shorter, which gives the same cycle.
+  void reverse(uint32_t from, uint32_t to) {
+    const uint32_t n = size();
+    uint32_t i = m_pos[from];
+    uint32_t j = m_pos[to];
+    uint32_t length = (j + n - i) % n + 1;
+    if (2 * length > n) {
+      std::swap(i, j);
+      i = i + 1 == n ? 0 : i + 1;
+      j = j == 0 ? n - 1 : j - 1;
+      length = n - length;
+    }
+    for (uint32_t k = 0; k < length / 2; ++k) {
+      std::swap(m_order[i], m_order[j]);
+      m_pos[m_order[i]] = i;
+      m_pos[m_order[j]] = j;
+      i = i + 1 == n ? 0 : i + 1;
+      j = j == 0 ? n - 1 : j - 1;
+    }
+  }
+};
+
+class Optimizer {
+ public:
+  Optimizer(const std::vector<float>& x, const std::vector<float>& y,
+            const std::vector<uint32_t>& neighbours, Tour& tour)
+      : m_x(x), m_y(y), m_neighbours(neighbours), m_tour(tour) {}
+
+  // Runs until no point can be improved with reversals of at most
+  // `maxReversal` points or the deadline has passed. Returns false if the
+  // deadline stopped it.
+  template <class Clock>
+  bool run(typename Clock::time_point deadline, uint32_t maxReversal) {
+    m_maxReversal = maxReversal;
+    const uint32_t n = m_tour.size();
+    m_queued.assign(n, 1);
+    m_queue.assign(m_tour.order().begin(), m_tour.order().end());
+    for (size_t visits = 0; !m_queue.empty(); ++visits) {
+      if (visits % 64 == 0 && Clock::now() >= deadline) return false;
+      const uint32_t a = m_queue.front();
+      m_queue.pop_front();
+      m_queued[a] = 0;
+      if (twoOpt(a) || orOpt(a)) push(a);
+    }
+    return true;
+  }
+
+ private:
+  const std::vector<float>& m_x;
+  const std::vector<float>& m_y;
+  const std::vector<uint32_t>& m_neighbours;
+  Tour& m_tour;
+  std::deque<uint32_t> m_queue;  // points whose edges may still improve
+  std::vector<uint8_t> m_queued;
+  uint32_t m_maxReversal = 0;
+
+  static constexpr double minGain = 1e-7;
+
+  double dist(uint32_t a, uint32_t b) const {
+    const double dx = static_cast<double>(m_x[a]) - m_x[b];
+    const double dy = static_cast<double>(m_y[a]) - m_y[b];
+    return std::sqrt(dx * dx + dy * dy);
+  }
+
+  void push(uint32_t a) {
+    if (m_queued[a]) return;
+    m_queued[a] = 1;
+    m_queue.push_back(a);
+  }
+
+  const uint32_t* neighbours(uint32_t a) const {
+    return &m_neighbours[static_cast<size_t>(a) * Neighbours];
+  }
+
+  // Replaces the edge from a to its successor (or predecessor) and the one
+  // from a near neighbour c to its successor (predecessor) by (a, c) and the
+  // edge between the two others.
+  bool twoOpt(uint32_t a) {
+    for (const bool forward : {true, false}) {
+      const uint32_t an = forward ? m_tour.next(a) : m_tour.prev(a);
+      const double edge = dist(a, an);
+      for (int k = 0; k < Neighbours; ++k) {
+        const uint32_t c = neighbours(a)[k];
+        if (c == PointGrid::none) break;
+        const double ac = dist(a, c);
+        if (ac >= edge) break;
+        const uint32_t cn = forward ? m_tour.next(c) : m_tour.prev(c);
+        if (c == an || cn == a) continue;
+        const double gain = edge + dist(c, cn) - ac - dist(an, cn);
+        if (gain <= minGain) continue;
+        const uint32_t move[4] = {forward ? a : an, forward ? an : a,
+                                  forward ? c : cn, forward ? cn : c};
+        if (m_tour.moveLength(move[0], move[1], move[2], move[3]) >
+            m_maxReversal)
+          continue;
+        m_tour.move(move[0], move[1], move[2], move[3]);
+        push(an);
+        push(c);
+        push(cn);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Moves the segment of one to three points starting at a (forward) next
+  // to a near neighbour of one of its ends, in either direction.
+  bool orOpt(uint32_t a) {
+    const uint32_t n = m_tour.size();
+    uint32_t s2 = a;
+    for (uint32_t length = 1; length <= 3 && length + 3 <= n; ++length) {
+      if (length > 1) s2 = m_tour.next(s2);
+      const uint32_t s1 = a;
+      const uint32_t p = m_tour.prev(s1);
+      const uint32_t after = m_tour.next(s2);
+      const double removed = dist(p, s1) + dist(s2, after) - dist(p, after);
+      if (removed <= minGain) continue;
+
+      auto inSegment = [&](uint32_t c) {
+        return (m_tour.position(c) + n - m_tour.position(s1)) % n < length;
+      };
+      for (const uint32_t end : {s1, s2}) {
+        for (int k = 0; k < Neighbours; ++k) {
+          const uint32_t c = neighbours(end)[k];
+          if (c == PointGrid::none) break;
+          if (dist(end, c) >= removed) break;
+          if (inSegment(c)) continue;
+          // the edges next to c, as (c0, c1) with c1 following c0
+          for (const uint32_t c0 : {c, m_tour.prev(c)}) {
+            const uint32_t c1 = m_tour.next(c0);
+            if (inSegment(c0) || inSegment(c1) || c0 == after || c1 == p)
+              continue;
+            const double edge = dist(c0, c1);
+            const double keep = dist(c0, s1) + dist(s2, c1) - edge;
+            const double flip = dist(c0, s2) + dist(s1, c1) - edge;
+            const double gain = removed - std::min(keep, flip);
+            if (gain <= minGain ||
+                m_tour.moveLength(p, s1, c0, c1) > m_maxReversal)
+              continue;
+
+            // three 2-opt moves: the first two insert the segment
+            // reversed, the last one turns it around again
+            m_tour.move(p, s1, c0, c1);
+            m_tour.move(p, c0, after, s2);
+            if (keep < flip) m_tour.move(c0, s2, s1, c1);
+            for (const uint32_t changed : {p, after, s1, s2, c0, c1})
+              push(changed);
+            return true;
+          }
+        }
+      }
+    }
+    return false;
+  }
+};
+
+double pathLength(const std::vector<float>& x, const std::vector<float>& y,
+                  const std::vector<uint32_t>& order) {
+  double length = 0.0;
+  double px = 0.0;
+  double py = 0.0;
+  for (const uint32_t i : order) {
+    length += std::hypot(x[i] - px, y[i] - py);
+    px = x[i];
+    py = y[i];
+  }
+  return length;
+}
+
+}  // namespace
+
+PlotPath planPlotPath(const std::vector<float>& x, const std::vector<float>& y,
+                      float timeBudget) {
+  using Clock = std::chrono::steady_clock;
+  const Clock::time_point start = Clock::now();
+  const uint32_t n = static_cast<uint32_t>(x.size());
+
+  PlotPath path;
+  path.order.resize(n);
+  for (uint32_t i = 0; i < n; ++i) path.order[i] = i;
+  path.initialTravel = path.travel = pathLength(x, y, path.order);
+  if (n < 3) return path;
+
+  // the tour starts at the point closest to the origin
+  uint32_t current = 0;
+  for (uint32_t i = 1; i < n; ++i) {
+    if (std::hypot(x[i], y[i]) < std::hypot(x[current], y[current]))
+      current = i;
+  }
+
+  PointGrid grid(x, y);
+  for (uint32_t k = 0; k < n; ++k) {
+    path.order[k] = current;
+    grid.remove(current);
+    if (k + 1 < n) current = grid.nearest(x[current], y[current]);
+  }
+  path.nearestTravel = path.travel = pathLength(x, y, path.order);
+  if (timeBudget <= 0.0f) {
+    path.seconds = std::chrono::duration<float>(Clock::now() - start).count();
+    return path;
+  }
+
+  const Clock::time_point deadline =
+      start + std::chrono::duration_cast<Clock::duration>(
+                  std::chrono::duration<float>(timeBudget));
+  std::vector<uint32_t> neighbours(static_cast<size_t>(n) * Neighbours);
+  #pragma omp parallel for schedule(dynamic, 1024)
+  for (int64_t i = 0; i < static_cast<int64_t>(n); ++i)
+    grid.neighbours(static_cast<uint32_t>(i), &neighbours[i * Neighbours]);
+
+  Tour tour(path.order);
+  Optimizer optimizer(x, y, neighbours, tour);
+  for (const uint32_t maxReversal : MaxReversals) {
+    if (!optimizer.run<Clock>(deadline, maxReversal) || maxReversal >= n / 2)
+      break;
+  }
+  std::vector<uint32_t> nearest = std::move(path.order);
+
+  // open the tour at its longest jump, starting at the end nearer to the
+  // origin
+  const std::vector<uint32_t>& order = tour.order();
+  uint32_t cut = 0;
+  double longest = -1.0;
+  for (uint32_t i = 0; i < n; ++i) {
+    const uint32_t a = order[i];
+    const uint32_t b = order[i + 1 == n ? 0 : i + 1];
+    const double length = std::hypot(x[a] - x[b], y[a] - y[b]);
+    if (length > longest) {
+      longest = length;
+      cut = i;
+    }
+  }
+  const uint32_t first = order[cut + 1 == n ? 0 : cut + 1];
+  const uint32_t last = order[cut];
+  const bool forward =
+      std::hypot(x[first], y[first]) <= std::hypot(x[last], y[last]);
+  path.order.resize(n);
+  for (uint32_t k = 0; k < n; ++k) {
+    const uint32_t i = forward ? (cut + 1 + k) % n : (cut + n - k) % n;
+    path.order[k] = order[i];
+  }
+  path.travel = pathLength(x, y, path.order);
+  // the closed tour cut open can lose to the open one on few points
+  if (path.travel > path.nearestTravel) {
+    path.order = std::move(nearest);
+    path.travel = path.nearestTravel;
+  }
+  path.seconds = std::chrono::duration<float>(Clock::now() - start).count();
+  return path;
+}
@@ -0,0 +1,24 @@
+#ifndef PLOTPATH_H
+#define PLOTPATH_H
+
+#include <cstdint>
+#include <vector>
+
+// Order in which a pen plotter visits a set of points, starting from the
+// origin. Points and lengths share one unit.
+struct PlotPath {
+  std::vector<uint32_t> order;
+  double initialTravel = 0.0;  // visiting the points in their given order
+  double nearestTravel = 0.0;  // after the nearest neighbour tour
+  double travel = 0.0;         // along `order`
+  float seconds = 0.0f;        // spent planning
+};
+
+// Builds a nearest neighbour tour over a grid of the points and improves it
+// with 2-opt and Or-opt moves between near neighbours until no move helps
+// or `timeBudget` seconds have passed (zero gives the nearest neighbour
+// tour only). The tour is cut open at its longest jump.
+PlotPath planPlotPath(const std::vector<float>& x, const std::vector<float>& y,
+                      float timeBudget);
+
+#endif  // PLOTPATH_H
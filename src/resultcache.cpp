@@ -0,0 +1,135 @@
+#include "resultcache.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "contenthash.h"
+
+namespace {
+
+const char fileMagic[4] = {'L', 'B', 'G', 'R'};
+const uint32_t fileVersion = 1;
+
+}  // namespace
+
+ResultCache::ResultCache(const QString& directory, qint64 capacity)
+    : m_directory(directory), m_capacity(capacity) {
+  if (!m_directory.isEmpty()) QDir().mkpath(m_directory);
+}
+
+uint64_t ResultCache::key(const DensityMap& density,
+                          const LBGStippling::Params& params,
+                          size_t channel) {
+  if (params.seed == 0 || params.timeBudget > 0.0f) return 0;
+  const uint64_t version = fileVersion;
+  uint64_t hash = hashBytes(&version, sizeof(version), density.hash());
+  hash = LBGStippling::hash(params, hash);
+  hash = hashBytes(&channel, sizeof(channel), hash);
+  return hash != 0 ? hash : 1;
+}
+
+bool ResultCache::load(uint64_t key, StippleSet& stipples) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_directory.isEmpty() || key == 0) return false;
+
+  const QString path = filePath(key);
+  std::ifstream file(path.toStdString(), std::ios::binary);
+  char magic[4];
+  uint32_t version = 0;
+  uint64_t count = 0;
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char*>(&version), sizeof(version));
+  file.read(reinterpret_cast<char*>(&count), sizeof(count));
+  if (!file || std::memcmp(magic, fileMagic, sizeof(magic)) != 0 ||
+      version != fileVersion) {
+    ++m_misses;
+    return false;
+  }
+
+  // the arrays have to fill the rest of the file exactly, before a count
+  // read from it sizes any allocation
+  const std::streamoff start = file.tellg();
+  file.seekg(0, std::ios::end);
+  const std::streamoff end = file.tellg();
+  file.seekg(start);
+  const uint64_t bytes = static_cast<uint64_t>(end - start);
+  if (!file || count > bytes / (3 * sizeof(float)) ||
+      count * 3 * sizeof(float) != bytes) {
+    ++m_misses;
+    return false;
+  }
+
+  std::vector<float> values(count * 3);
+  file.read(reinterpret_cast<char*>(values.data()),
+            values.size() * sizeof(float));
+  if (!file) {
+    ++m_misses;
+    return false;
+  }
+
+  stipples.clear();
+  stipples.reserve(count);
+  for (size_t i = 0; i < count; ++i)
+    stipples.push_back(QVector2D(values[i], values[count + i]),
+                       values[2 * count + i]);
+
+  // the modification time orders the files for eviction
+  QFile touched(path);
+  if (touched.open(QIODevice::ReadWrite))
+    touched.setFileTime(QDateTime::currentDateTime(),
+                        QFileDevice::FileModificationTime);
+  ++m_hits;
+  return true;
+}
+
+void ResultCache::store(uint64_t key, const StippleView& stipples) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_directory.isEmpty() || key == 0) return;
+
+  // write next to the target and rename, so readers never see a partial file
+  const std::string path = filePath(key).toStdString();
+  const std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file) return;
+    const uint64_t count = stipples.size();
+    const size_t bytes = stipples.size() * sizeof(float);
+    file.write(fileMagic, sizeof(fileMagic));
+    file.write(reinterpret_cast<const char*>(&fileVersion),
+               sizeof(fileVersion));
+    file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    file.write(reinterpret_cast<const char*>(stipples.x()), bytes);
+    file.write(reinterpret_cast<const char*>(stipples.y()), bytes);
+    file.write(reinterpret_cast<const char*>(stipples.sizes()), bytes);
+    if (!file) {
+      file.close();
+      std::remove(tmpPath.c_str());
+      return;
+    }
+  }
+  std::rename(tmpPath.c_str(), path.c_str());
+  evict();
+}
+
+QString ResultCache::filePath(uint64_t key) const {
+  return QDir(m_directory)
+      .filePath(QString("%1.stipples").arg(key, 16, 16, QChar('0')));
+}
+
+void ResultCache::evict() {
+  // newest first, everything past the capacity goes
+  const QFileInfoList files = QDir(m_directory).entryInfoList(
+      {"*.stipples"}, QDir::Files, QDir::Time);
+  qint64 total = 0;
+  for (const QFileInfo& info : files) {
+    total += info.size();
+    if (total > m_capacity) QFile::remove(info.absoluteFilePath());
+  }
+}
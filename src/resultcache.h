@@ -0,0 +1,48 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <QString>
+
+#include <cstdint>
+#include <mutex>
+
+#include "densitymap.h"
+#include "lbgstippling.h"
+#include "stippleset.h"
+
+// Final stipple sets of earlier runs on disk, keyed by the content of the
+// density map and every parameter that influences the result. Only seeded
+// runs without a time budget are repeatable, on any number of threads, and
+// thus cached. The directory is bounded in size, the least recently used
+// results are evicted first.
+class ResultCache {
+ public:
+  // An empty path disables the cache.
+  explicit ResultCache(const QString& directory = QString(),
+                       qint64 capacity = qint64(1) << 30);
+
+  bool enabled() const { return !m_directory.isEmpty(); }
+
+  // Zero if a run with these parameters cannot be cached.
+  static uint64_t key(const DensityMap& density,
+                      const LBGStippling::Params& params, size_t channel);
+
+  // Fills `stipples` on a hit. Every lookup counts as hit or miss.
+  bool load(uint64_t key, StippleSet& stipples);
+  void store(uint64_t key, const StippleView& stipples);
+
+  size_t hits() const { return m_hits; }
+  size_t misses() const { return m_misses; }
+
+ private:
+  QString m_directory;
+  qint64 m_capacity;  // in bytes
+  size_t m_hits = 0;
+  size_t m_misses = 0;
+  std::mutex m_mutex;
+
+  QString filePath(uint64_t key) const;
+  void evict();
+};
+
+#endif  // RESULTCACHE_H
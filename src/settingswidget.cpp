@@ -64,6 +64,17 @@ SettingsWidget::SettingsWidget(StippleViewer *stippleViewer, QWidget *parent)
           QOverload<double>::of(&QDoubleSpinBox::valueChanged),
           [this](double value) { m_params.pointSizeMax = value; });
 
+  QLabel *targetPointsLabel = new QLabel("Target Points:", this);
+  QSpinBox *spinTargetPoints = new QSpinBox(this);
+  spinTargetPoints->setRange(0, 10000000);
+  spinTargetPoints->setSingleStep(1000);
+  spinTargetPoints->setValue(m_params.targetPoints);
+  spinTargetPoints->setToolTip(
+      "Adjusts the split and merge thresholds until the result has this "
+      "many points (within 1%). Zero disables the target.");
+  connect(spinTargetPoints, QOverload<int>::of(&QSpinBox::valueChanged),
+          [this](int value) { m_params.targetPoints = value; });
+
   QGridLayout *pointGroupLayout = new QGridLayout(pointGroup);
   pointGroup->setLayout(pointGroupLayout);
   pointGroupLayout->addWidget(initialPointLabel, 0, 0);
@@ -75,6 +86,8 @@ SettingsWidget::SettingsWidget(StippleViewer *stippleViewer, QWidget *parent)
   pointGroupLayout->addWidget(spinMinPointSize, 3, 1);
   pointGroupLayout->addWidget(maxPointSize, 4, 0);
   pointGroupLayout->addWidget(spinMaxPointSize, 4, 1);
+  pointGroupLayout->addWidget(targetPointsLabel, 5, 0);
+  pointGroupLayout->addWidget(spinTargetPoints, 5, 1);
 
   layout->addWidget(pointGroup);
 
@@ -123,10 +136,46 @@ SettingsWidget::SettingsWidget(StippleViewer *stippleViewer, QWidget *parent)
   spinSuperSample->setValue(m_params.superSamplingFactor);
   spinSuperSample->setToolTip(
       "Increases the size and percision of the Voronoi "
-      "diagram, but makes the calculation slower.");
+      "diagram, but makes the calculation slower. The GPU engine "
+      "needs the square of the factor times the memory.");
   connect(spinSuperSample, QOverload<int>::of(&QSpinBox::valueChanged),
           [this](int value) { m_params.superSamplingFactor = value; });
 
+  QLabel *engineLabel = new QLabel("Cell Engine:", this);
+  QComboBox *comboEngine = new QComboBox(this);
+  comboEngine->addItem("GPU", static_cast<int>(CellEngineType::GPU));
+  comboEngine->addItem("CPU", static_cast<int>(CellEngineType::CPU));
+  comboEngine->addItem("Analytic", static_cast<int>(CellEngineType::Analytic));
+  comboEngine->setCurrentIndex(
+      comboEngine->findData(static_cast<int>(m_params.engine)));
+  comboEngine->setToolTip(
+      "GPU renders the Voronoi diagram with OpenGL, CPU computes the cells "
+      "tile by tile without an intermediate index map, Analytic integrates "
+      "the exact Voronoi polygons.");
+  connect(comboEngine, QOverload<int>::of(&QComboBox::currentIndexChanged),
+          [this, comboEngine](int index) {
+            m_params.engine = static_cast<CellEngineType>(
+                comboEngine->itemData(index).toInt());
+          });
+
+  QLabel *scheduleLabel = new QLabel("Hysteresis Schedule:", this);
+  QComboBox *comboSchedule = new QComboBox(this);
+  comboSchedule->addItem("Linear",
+                         static_cast<int>(HysteresisSchedule::Linear));
+  comboSchedule->addItem("Adaptive",
+                         static_cast<int>(HysteresisSchedule::Adaptive));
+  comboSchedule->setCurrentIndex(
+      static_cast<int>(m_params.hysteresisSchedule));
+  comboSchedule->setToolTip(
+      "Linear adds the increment every iteration. Adaptive keeps the "
+      "hysteresis while the point count grows and only adds increments "
+      "once splits and merges start to oscillate.");
+  connect(comboSchedule, QOverload<int>::of(&QComboBox::currentIndexChanged),
+          [this, comboSchedule](int index) {
+            m_params.hysteresisSchedule = static_cast<HysteresisSchedule>(
+                comboSchedule->itemData(index).toInt());
+          });
+
   QGridLayout *algoGroupLayout = new QGridLayout(algoGroup);
   algoGroup->setLayout(algoGroupLayout);
   algoGroupLayout->addWidget(hysteresisLabel, 0, 0);
@@ -137,6 +186,10 @@ SettingsWidget::SettingsWidget(StippleViewer *stippleViewer, QWidget *parent)
   algoGroupLayout->addWidget(spinMaxIter, 2, 1);
   algoGroupLayout->addWidget(superSampleLabel, 3, 0);
   algoGroupLayout->addWidget(spinSuperSample, 3, 1);
+  algoGroupLayout->addWidget(engineLabel, 4, 0);
+  algoGroupLayout->addWidget(comboEngine, 4, 1);
+  algoGroupLayout->addWidget(scheduleLabel, 5, 0);
+  algoGroupLayout->addWidget(comboSchedule, 5, 1);
 
   layout->addWidget(algoGroup);
 
@@ -258,17 +311,41 @@ SettingsWidget::SettingsWidget(StippleViewer *stippleViewer, QWidget *parent)
     m_stippleViewer->stipple(m_params);
   });
 
-    // invert button
+  // density preprocessing
   QGroupBox *opGroup = new QGroupBox("Image ops:", this);
-  QVBoxLayout *opLayout = new QVBoxLayout(opGroup);
+  QGridLayout *opLayout = new QGridLayout(opGroup);
+
+  QCheckBox *invertBox = new QCheckBox("Invert image", this);
+  invertBox->setChecked(m_params.preprocessing.invert);
+  connect(invertBox, &QCheckBox::stateChanged, [this](int state) {
+    m_params.preprocessing.invert = state == Qt::Checked;
+  });
 
-  QPushButton *invertButton = new QPushButton("Invert image", this);
-  opLayout->addWidget(invertButton);
+  QLabel *gammaLabel = new QLabel("Gamma:", this);
+  QDoubleSpinBox *spinGamma = new QDoubleSpinBox(this);
+  spinGamma->setMinimum(0.1);
+  spinGamma->setMaximum(10.0);
+  spinGamma->setSingleStep(0.1);
+  spinGamma->setValue(m_params.preprocessing.gamma);
+  connect(spinGamma, QOverload<double>::of(&QDoubleSpinBox::valueChanged),
+          [this](double value) { m_params.preprocessing.gamma = value; });
+
+  QLabel *contrastLabel = new QLabel("Contrast:", this);
+  QDoubleSpinBox *spinContrast = new QDoubleSpinBox(this);
+  spinContrast->setMinimum(0.1);
+  spinContrast->setMaximum(10.0);
+  spinContrast->setSingleStep(0.1);
+  spinContrast->setValue(m_params.preprocessing.contrast);
+  connect(spinContrast, QOverload<double>::of(&QDoubleSpinBox::valueChanged),
+          [this](double value) { m_params.preprocessing.contrast = value; });
+
+  opLayout->addWidget(invertBox, 0, 0, 1, 2);
+  opLayout->addWidget(gammaLabel, 1, 0);
+  opLayout->addWidget(spinGamma, 1, 1);
+  opLayout->addWidget(contrastLabel, 2, 0);
+  opLayout->addWidget(spinContrast, 2, 1);
   opGroup->setLayout(opLayout);
   layout->addWidget(opGroup);
-  connect(invertButton, &QPushButton::released, [this, progressBar]() {
-    m_stippleViewer->invert();
-  });
 
   layout->addStretch(1);
 }
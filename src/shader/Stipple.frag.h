@@ -0,0 +1,15 @@
+std::string stippleFragment = R"(#version 330 core
+
+in vec2 DiscCoord;
+in vec4 VertColor;
+
+uniform int pointMode;
+
+out vec4 fragColor;
+
+void main()
+{
+	if (pointMode == 0 && dot(DiscCoord, DiscCoord) > 1.0f)
+		discard;
+	fragColor = VertColor;
+})";
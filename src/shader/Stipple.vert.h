@@ -0,0 +1,23 @@
+std::string stippleVertex = R"(#version 330 core
+layout(location = 0) in vec2 Corner;
+layout(location = 1) in vec3 Stipple;
+layout(location = 2) in vec4 StippleColor;
+
+uniform mat4 projection;
+uniform float scale;
+uniform int pointMode;
+
+out vec2 DiscCoord;
+out vec4 VertColor;
+
+void main()
+{
+	VertColor = StippleColor;
+	DiscCoord = Corner;
+	if (pointMode == 1) {
+		gl_PointSize = max(Stipple.z * scale, 1.0f);
+		gl_Position = projection * vec4(Stipple.xy, 0.0f, 1.0f);
+	} else {
+		gl_Position = projection * vec4(Stipple.xy + 0.5f * Stipple.z * Corner, 0.0f, 1.0f);
+	}
+})";
@@ -1,20 +1,29 @@
 std::string voronoiVertex = R"(#version 400 core
 layout(location = 0) in vec3 VertPosition;
-layout(location = 1) in vec2 ConePosition;
-layout(location = 2) in vec3 ConeColor;
-
-out vec3 VertColor;
+layout(location = 1) in float ConePositionX;
+layout(location = 2) in float ConeRadius;
+layout(location = 3) in float ConePositionY;
+layout(location = 4) in uint ConeIndex;
 
+uniform bool indexFromInstance;
 
-const float height = 1.99f;
+out vec3 VertColor;
 
 const mat4 projection = mat4(2.0f, 0.0f, 0.0f, 0.0f,
                              0.0f, -2.0f, 0.0f, 0.0f,
                              0.0f, 0.0f, -1.0f, 0.0f,
                              -1.0f, 1.0f, 0.0f, 1.0f);
 
+// Encodes the cell index as 24 bit color.
+vec3 encode(uint index)
+{
+	return vec3((index >> 16) & 0xffu, (index >> 8) & 0xffu, index & 0xffu) / 255.0f;
+}
+
 void main()
 {
-	VertColor = ConeColor;
-	gl_Position = projection * vec4(VertPosition.xy + ConePosition, VertPosition.z + (1.0 - height), 1.0f);
+	VertColor = encode(indexFromInstance ? uint(gl_InstanceID) : ConeIndex);
+	// unit cone scaled to the radius, depth grows with the distance
+	vec2 position = ConeRadius * VertPosition.xy + vec2(ConePositionX, ConePositionY);
+	gl_Position = projection * vec4(position, 1.0f - ConeRadius * VertPosition.z, 1.0f);
 })";
@@ -0,0 +1,100 @@
+#include "sitegrid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+SiteGrid::SiteGrid(const StippleView& sites, int width, int height,
+                   float cellSize)
+    : m_cellSize(std::max(cellSize, 1.0f)) {
+  m_cols = std::max(1, static_cast<int>(std::ceil(width / m_cellSize)));
+  m_rows = std::max(1, static_cast<int>(std::ceil(height / m_cellSize)));
+
+  m_x.resize(sites.size());
+  m_y.resize(sites.size());
+  for (size_t i = 0; i < sites.size(); ++i) {
+    m_x[i] = sites.x()[i] * width;
+    m_y[i] = sites.y()[i] * height;
+  }
+
+  // counting sort of the sites into the grid cells
+  m_cellStart.assign(m_cols * m_rows + 1, 0);
+  std::vector<uint32_t> cellOf(sites.size());
+  for (size_t i = 0; i < sites.size(); ++i) {
+    cellOf[i] = row(m_y[i]) * m_cols + col(m_x[i]);
+    ++m_cellStart[cellOf[i] + 1];
+  }
+  for (size_t c = 1; c < m_cellStart.size(); ++c)
+    m_cellStart[c] += m_cellStart[c - 1];
+
+  m_entries.resize(sites.size());
+  std::vector<uint32_t> next(m_cellStart.begin(), m_cellStart.end() - 1);
+  for (size_t i = 0; i < sites.size(); ++i)
+    m_entries[next[cellOf[i]]++] = static_cast<uint32_t>(i);
+}
+
+int SiteGrid::col(float x) const {
+  return std::min(m_cols - 1, std::max(0, static_cast<int>(x / m_cellSize)));
+}
+
+int SiteGrid::row(float y) const {
+  return std::min(m_rows - 1, std::max(0, static_cast<int>(y / m_cellSize)));
+}
+
+uint32_t SiteGrid::nearest(float x, float y, float& dist) const {
+  const int c0 = col(x);
+  const int r0 = row(y);
+
+  float best = std::numeric_limits<float>::max();
+  uint32_t bestIndex = 0;
+  const int maxRing = std::max(m_cols, m_rows);
+
+  // search rings of grid cells until no closer site can follow
+  for (int ring = 0; ring <= maxRing; ++ring) {
+    for (int r = r0 - ring; r <= r0 + ring; ++r) {
+      if (r < 0 || r >= m_rows) continue;
+      const bool edgeRow = r == r0 - ring || r == r0 + ring;
+      const int step = edgeRow ? 1 : 2 * ring;
+      for (int c = c0 - ring; c <= c0 + ring; c += std::max(step, 1)) {
+        if (c < 0 || c >= m_cols) continue;
+        const int cell = r * m_cols + c;
+        for (uint32_t e = m_cellStart[cell]; e < m_cellStart[cell + 1]; ++e) {
+          const uint32_t i = m_entries[e];
+          const float d2 = (m_x[i] - x) * (m_x[i] - x) +
+                           (m_y[i] - y) * (m_y[i] - y);
+          if (d2 < best) {
+            best = d2;
+            bestIndex = i;
+          }
+        }
+      }
+    }
+    // sites beyond this ring are at least ring * cellSize away
+    const float reach = ring * m_cellSize;
+    if (best <= reach * reach) break;
+  }
+
+  dist = std::sqrt(best);
+  return bestIndex;
+}
+
+void SiteGrid::gather(float x, float y, float radius,
+                      std::vector<uint32_t>& out) const {
+  const int c0 = col(x - radius);
+  const int c1 = col(x + radius);
+  const int r0 = row(y - radius);
+  const int r1 = row(y + radius);
+  const float radius2 = radius * radius;
+
+  for (int r = r0; r <= r1; ++r) {
+    for (int c = c0; c <= c1; ++c) {
+      const int cell = r * m_cols + c;
+      for (uint32_t e = m_cellStart[cell]; e < m_cellStart[cell + 1]; ++e) {
+        const uint32_t i = m_entries[e];
+        const float d2 = (m_x[i] - x) * (m_x[i] - x) +
+                         (m_y[i] - y) * (m_y[i] - y);
+        if (d2 <= radius2) out.push_back(i);
+      }
+    }
+  }
+}
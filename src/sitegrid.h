@@ -0,0 +1,39 @@
+#ifndef SITEGRID_H
+#define SITEGRID_H
+
+#include <cstdint>
+#include <vector>
+
+#include "stippleset.h"
+
+// Uniform grid over the sites for nearest-site and radius queries. Sites
+// and queries are given in pixels of a width x height image.
+class SiteGrid {
+ public:
+  SiteGrid(const StippleView& sites, int width, int height, float cellSize);
+
+  size_t size() const { return m_x.size(); }
+  float x(uint32_t i) const { return m_x[i]; }
+  float y(uint32_t i) const { return m_y[i]; }
+
+  // Index of the site closest to (x, y), its distance is stored in `dist`.
+  uint32_t nearest(float x, float y, float& dist) const;
+
+  // Appends all sites within `radius` of (x, y) to `out`.
+  void gather(float x, float y, float radius,
+              std::vector<uint32_t>& out) const;
+
+ private:
+  int m_cols;
+  int m_rows;
+  float m_cellSize;
+  std::vector<float> m_x;
+  std::vector<float> m_y;
+  std::vector<uint32_t> m_cellStart;  // first entry of every grid cell
+  std::vector<uint32_t> m_entries;    // site indices sorted by grid cell
+
+  int col(float x) const;
+  int row(float y) const;
+};
+
+#endif  // SITEGRID_H
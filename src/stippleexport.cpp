@@ -0,0 +1,211 @@
+#include "stippleexport.h"
+
+#include <QPainter>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <omp.h>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Draws the stipples onto `image` in horizontal bands, each band with its
+// own painter on its own thread. The stipples are bucketed by band first,
+// so every band only visits its own. A dot crossing a band border goes into
+// both buckets and is drawn by both bands, each clipped to its rows.
+void paintStipples(QImage& image, const StippleView& stipples,
+                   const QColor& color) {
+  const int width = image.width();
+  const int height = image.height();
+  const int bands = std::min(height, 4 * omp_get_max_threads());
+  // detach once, the bands only share the pixels
+  uchar* bits = image.bits();
+  const int bytesPerLine = image.bytesPerLine();
+  const QImage::Format format = image.format();
+
+  const qreal w = width;
+  const qreal h = height;
+  auto bandTop = [height, bands](int b) {
+    return static_cast<int>(static_cast<int64_t>(height) * b / bands);
+  };
+  // first and last band a dot reaches
+  auto bandRange = [&](size_t i) {
+    const qreal r = stipples.sizes()[i] / 2.0;
+    const qreal y = stipples.y()[i] * h;
+    auto bandOf = [&](qreal row) {
+      int b = static_cast<int>(row * bands / h);
+      b = std::max(0, std::min(b, bands - 1));
+      while (b > 0 && bandTop(b) > row) --b;
+      while (b + 1 < bands && bandTop(b + 1) <= row) ++b;
+      return b;
+    };
+    return std::make_pair(bandOf(y - r), bandOf(y + r));
+  };
+
+  // counting sort into buckets, in stipple order within each
+  std::vector<size_t> offsets(bands + 1, 0);
+  for (size_t i = 0; i < stipples.size(); ++i) {
+    const std::pair<int, int> range = bandRange(i);
+    for (int b = range.first; b <= range.second; ++b) ++offsets[b + 1];
+  }
+  for (int b = 0; b < bands; ++b) offsets[b + 1] += offsets[b];
+  std::vector<uint32_t> buckets(offsets[bands]);
+  std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+  for (size_t i = 0; i < stipples.size(); ++i) {
+    const std::pair<int, int> range = bandRange(i);
+    for (int b = range.first; b <= range.second; ++b)
+      buckets[fill[b]++] = static_cast<uint32_t>(i);
+  }
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int b = 0; b < bands; ++b) {
+    const int top = bandTop(b);
+    const int bottom = bandTop(b + 1);
+    QImage band(bits + static_cast<size_t>(top) * bytesPerLine, width,
+                bottom - top, bytesPerLine, format);
+
+    QPainter painter(&band);
+    painter.setRenderHint(QPainter::Antialiasing, true);
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(color);
+    painter.translate(0.0, -top);
+    for (size_t k = offsets[b]; k < offsets[b + 1]; ++k) {
+      const size_t i = buckets[k];
+      const qreal r = stipples.sizes()[i] / 2.0;
+      // split stipples are only distinguishable in debug builds
+      if (stipples.tag(i) == StippleTag::Split) painter.setBrush(Qt::red);
+      painter.drawEllipse(QPointF(stipples.x()[i] * w, stipples.y()[i] * h),
+                          r, r);
+      if (stipples.tag(i) == StippleTag::Split) painter.setBrush(color);
+    }
+  }
+}
+
+}  // namespace
+
+QImage renderStipples(const StippleView& stipples, const QSize& size) {
+  QImage image(size, QImage::Format_RGB32);
+  image.fill(Qt::white);
+  paintStipples(image, stipples, Qt::black);
+  return image;
+}
+
+QImage renderLayers(const std::vector<StippleView>& layers,
+                    const std::vector<QColor>& colors, const QSize& size) {
+  QImage image(size, QImage::Format_RGB32);
+  image.fill(Qt::white);
+
+  // each layer is drawn on its own white canvas first, so that dots of one
+  // ink do not darken each other where they overlap
+  QImage layer(size, QImage::Format_RGB32);
+  for (size_t l = 0; l < layers.size(); ++l) {
+    layer.fill(Qt::white);
+    paintStipples(layer, layers[l], colors[l]);
+
+    QPainter composer(&image);
+    composer.setCompositionMode(QPainter::CompositionMode_Multiply);
+    composer.drawImage(0, 0, layer);
+  }
+  return image;
+}
+
+bool writeStipplesBinary(const std::string& path,
+                         const StippleView& stipples) {
+  std::ofstream out(path, std::ios::binary);
+  if (!out) return false;
+  uint64_t n = stipples.size();
+  out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+
+  // interleave in small chunks instead of copying the whole set
+  const size_t chunk = 4096;
+  std::vector<float> buffer(2 * chunk);
+  for (size_t begin = 0; begin < n; begin += chunk) {
+    const size_t end = std::min<size_t>(begin + chunk, n);
+    for (size_t i = begin; i < end; ++i) {
+      buffer[2 * (i - begin)] = stipples.x()[i];
+      buffer[2 * (i - begin) + 1] = stipples.y()[i];
+    }
+    out.write(reinterpret_cast<const char*>(buffer.data()),
+              2 * (end - begin) * sizeof(float));
+  }
+  return out.good();
+}
+
+bool writeStippleGraph(
+    const std::string& path,
+    const std::vector<std::pair<uint32_t, uint32_t>>& edges) {
+  std::ofstream out(path, std::ios::binary);
+  if (!out) return false;
+  uint64_t n = edges.size();
+  out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+
+  const size_t chunk = 4096;
+  std::vector<uint32_t> buffer(2 * chunk);
+  for (size_t begin = 0; begin < n; begin += chunk) {
+    const size_t end = std::min<size_t>(begin + chunk, n);
+    for (size_t i = begin; i < end; ++i) {
+      buffer[2 * (i - begin)] = edges[i].first;
+      buffer[2 * (i - begin) + 1] = edges[i].second;
+    }
+    out.write(reinterpret_cast<const char*>(buffer.data()),
+              2 * (end - begin) * sizeof(uint32_t));
+  }
+  return out.good();
+}
+
+bool writePlot(const std::string& path, PlotFormat format,
+               const StippleView& stipples, const QSize& size,
+               const PlotSettings& settings, PlotPath* plan) {
+  // millimetres on the plotter, y pointing up
+  const float width = settings.width;
+  const float height = settings.width * size.height() / size.width();
+  std::vector<float> x(stipples.size());
+  std::vector<float> y(stipples.size());
+  for (size_t i = 0; i < stipples.size(); ++i) {
+    x[i] = stipples.x()[i] * width;
+    y[i] = (1.0f - stipples.y()[i]) * height;
+  }
+  PlotPath route = planPlotPath(x, y, settings.timeBudget);
+
+  std::ofstream out(path, std::ios::binary);
+  if (!out) return false;
+  std::string buffer;
+  char line[96];
+  auto flush = [&]() {
+    out.write(buffer.data(), buffer.size());
+    buffer.clear();
+  };
+
+  if (format == PlotFormat::GCode) {
+    std::snprintf(line, sizeof(line),
+                  "; %zu stipples, %.1f x %.1f mm\nG21\nG90\nG0 Z%.3f\n",
+                  stipples.size(), width, height, settings.penUp);
+    buffer += line;
+    for (const uint32_t i : route.order) {
+      std::snprintf(line, sizeof(line),
+                    "G0 X%.3f Y%.3f\nG1 Z%.3f F1000\nG0 Z%.3f\n", x[i],
+                    y[i], settings.penDown, settings.penUp);
+      buffer += line;
+      if (buffer.size() > (1 << 16)) flush();
+    }
+    buffer += "G0 X0 Y0\n";
+  } else {
+    // plotter units of 0.025 mm
+    buffer += "IN;SP1;PU;\n";
+    for (const uint32_t i : route.order) {
+      std::snprintf(line, sizeof(line), "PU%ld,%ld;PD;\n",
+                    std::lround(x[i] * 40.0f), std::lround(y[i] * 40.0f));
+      buffer += line;
+      if (buffer.size() > (1 << 16)) flush();
+    }
+    buffer += "PU0,0;SP0;\n";
+  }
+  flush();
+
+  if (plan) *plan = std::move(route);
+  return out.good();
+}
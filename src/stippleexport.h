@@ -0,0 +1,51 @@
+#ifndef STIPPLEEXPORT_H
+#define STIPPLEEXPORT_H
+
+#include <QColor>
+#include <QImage>
+#include <QSize>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "plotpath.h"
+#include "stippleset.h"
+
+// Renders the stipples as black discs on white, the same picture the viewer
+// saves as PNG, without a viewer or an OpenGL context.
+QImage renderStipples(const StippleView& stipples, const QSize& size);
+
+// Renders every layer in its colour, multiplied onto white the way
+// overprinted inks combine.
+QImage renderLayers(const std::vector<StippleView>& layers,
+                    const std::vector<QColor>& colors, const QSize& size);
+
+// Writes the point count followed by interleaved x, y positions.
+bool writeStipplesBinary(const std::string& path, const StippleView& stipples);
+
+// Writes the pair count followed by the pairs of stipple indices, as
+// uint32 (i, j) with i < j.
+bool writeStippleGraph(const std::string& path,
+                       const std::vector<std::pair<uint32_t, uint32_t>>& edges);
+
+// Plotter languages of writePlot().
+enum class PlotFormat { GCode, HPGL };
+
+struct PlotSettings {
+  float width = 200.0f;      // of the plot in mm, the height follows
+  float timeBudget = 10.0f;  // seconds spent shortening the pen travel
+  float penUp = 2.0f;        // G-code pen heights in mm
+  float penDown = 0.0f;
+};
+
+// Writes one dot per stipple as plotter commands, the image scaled to
+// settings.width mm with the origin at its bottom left corner. Dots are
+// visited along planPlotPath(), whose result (in mm) goes to `plan` if
+// given. `size` is the image size in pixels.
+bool writePlot(const std::string& path, PlotFormat format,
+               const StippleView& stipples, const QSize& size,
+               const PlotSettings& settings, PlotPath* plan = nullptr);
+
+#endif  // STIPPLEEXPORT_H
@@ -0,0 +1,229 @@
+#include "stippleitem.h"
+
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QPaintEngine>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+
+#include "shader/Stipple.frag.h"
+#include "shader/Stipple.vert.h"
+
+// Discs smaller than this (in device pixels) are drawn as single points.
+static const float lodPointDiameter = 2.0f;
+
+StippleItem::StippleItem(const QSizeF &imageSize)
+    : m_imageSize(imageSize),
+      m_maxDiameter(0.0f),
+      m_dirty(false),
+      m_shaderProgram(nullptr),
+      m_vao(nullptr),
+      m_quadVBO(QOpenGLBuffer::VertexBuffer),
+      m_instanceVBO(QOpenGLBuffer::VertexBuffer) {}
+
+StippleItem::~StippleItem() { releaseGL(); }
+
+void StippleItem::releaseGL() {
+  if (!m_shaderProgram) return;
+  QObject::disconnect(m_contextConnection);
+
+  // The item may outlive the paint event, so its context is made current on
+  // a surface of its own and the previous one restored afterwards.
+  QOpenGLContext *previous = QOpenGLContext::currentContext();
+  QSurface *previousSurface = previous ? previous->surface() : nullptr;
+  const bool switchContext = m_context && m_context != previous;
+  QOffscreenSurface surface;
+  if (switchContext) {
+    surface.setFormat(m_context->format());
+    surface.create();
+    m_context->makeCurrent(&surface);
+  }
+
+  m_instanceVBO.destroy();
+  m_quadVBO.destroy();
+  delete m_vao;
+  m_vao = nullptr;
+  delete m_shaderProgram;
+  m_shaderProgram = nullptr;
+
+  if (switchContext) {
+    m_context->doneCurrent();
+    if (previous) previous->makeCurrent(previousSurface);
+  }
+}
+
+void StippleItem::setImageSize(const QSizeF &imageSize) {
+  prepareGeometryChange();
+  m_imageSize = imageSize;
+}
+
+void StippleItem::setStipples(const StippleView &stipples) {
+  prepareGeometryChange();
+  m_instances.resize(stipples.size());
+  m_maxDiameter = 0.0f;
+
+  const float w = static_cast<float>(m_imageSize.width());
+  const float h = static_cast<float>(m_imageSize.height());
+  for (size_t i = 0; i < stipples.size(); ++i) {
+    Instance &inst = m_instances[i];
+    inst.x = stipples.x()[i] * w;
+    inst.y = stipples.y()[i] * h;
+    inst.diameter = stipples.sizes()[i];
+
+    // split stipples are only distinguishable in debug builds
+    const QColor color =
+        stipples.tag(i) == StippleTag::Split ? Qt::red : Qt::black;
+    inst.color[0] = static_cast<uchar>(color.red());
+    inst.color[1] = static_cast<uchar>(color.green());
+    inst.color[2] = static_cast<uchar>(color.blue());
+    inst.color[3] = static_cast<uchar>(color.alpha());
+    m_maxDiameter = std::max(m_maxDiameter, inst.diameter);
+  }
+  m_dirty = true;
+  update();
+}
+
+QRectF StippleItem::boundingRect() const {
+  // Discs at the border may reach half a diameter outside the image.
+  const qreal margin = m_maxDiameter / 2.0;
+  return QRectF(QPointF(0.0, 0.0), m_imageSize)
+      .adjusted(-margin, -margin, margin, margin);
+}
+
+void StippleItem::paint(QPainter *painter,
+                        const QStyleOptionGraphicsItem *option, QWidget *) {
+  if (m_instances.empty()) return;
+
+  const bool nativeGL =
+      painter->paintEngine()->type() == QPaintEngine::OpenGL2 &&
+      QOpenGLContext::currentContext() != nullptr;
+
+  if (nativeGL) {
+    const float lod = static_cast<float>(option->levelOfDetailFromTransform(
+        painter->worldTransform()));
+    paintNative(painter, lod);
+  } else {
+    paintRaster(painter);
+  }
+}
+
+void StippleItem::paintRaster(QPainter *painter) {
+  painter->save();
+  painter->setPen(Qt::NoPen);
+
+  QRgb currentColor = 0;
+  bool hasBrush = false;
+  for (const Instance &inst : m_instances) {
+    const QRgb color =
+        qRgba(inst.color[0], inst.color[1], inst.color[2], inst.color[3]);
+    if (!hasBrush || color != currentColor) {
+      painter->setBrush(QColor::fromRgba(color));
+      currentColor = color;
+      hasBrush = true;
+    }
+    const qreal r = inst.diameter / 2.0;
+    painter->drawEllipse(QRectF(inst.x - r, inst.y - r, 2.0 * r, 2.0 * r));
+  }
+  painter->restore();
+}
+
+void StippleItem::initializeGL() {
+  // the viewport's context may be destroyed before the item
+  m_context = QOpenGLContext::currentContext();
+  m_contextConnection =
+      QObject::connect(m_context, &QOpenGLContext::aboutToBeDestroyed,
+                       [this]() { releaseGL(); });
+
+  m_shaderProgram = new QOpenGLShaderProgram();
+  m_shaderProgram->addShaderFromSourceCode(QOpenGLShader::Vertex,
+                                           stippleVertex.c_str());
+  m_shaderProgram->addShaderFromSourceCode(QOpenGLShader::Fragment,
+                                           stippleFragment.c_str());
+  m_shaderProgram->link();
+
+  m_vao = new QOpenGLVertexArrayObject();
+  m_vao->create();
+
+  // Unit quad, expanded to the disc diameter in the vertex shader.
+  const GLfloat corners[] = {-1.0f, -1.0f, 1.0f, -1.0f,
+                             -1.0f, 1.0f,  1.0f, 1.0f};
+  m_quadVBO.create();
+  m_quadVBO.setUsagePattern(QOpenGLBuffer::StaticDraw);
+  m_quadVBO.bind();
+  m_quadVBO.allocate(corners, sizeof(corners));
+  m_quadVBO.release();
+
+  m_instanceVBO.create();
+  m_instanceVBO.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+}
+
+void StippleItem::paintNative(QPainter *painter, float lod) {
+  const QTransform transform = painter->combinedTransform();
+  const QPaintDevice *device = painter->device();
+
+  painter->beginNativePainting();
+
+  QOpenGLExtraFunctions *gl =
+      QOpenGLContext::currentContext()->extraFunctions();
+
+  if (!m_shaderProgram) initializeGL();
+
+  QOpenGLVertexArrayObject::Binder vaoBinder(m_vao);
+
+  m_instanceVBO.bind();
+  if (m_dirty) {
+    m_instanceVBO.allocate(m_instances.data(),
+                           m_instances.size() * sizeof(Instance));
+    m_dirty = false;
+  }
+
+  QMatrix4x4 projection;
+  projection.ortho(0.0f, device->width(), device->height(), 0.0f, -1.0f, 1.0f);
+  projection *= QMatrix4x4(transform);
+
+  // Level of detail: if even the largest disc covers less than a couple of
+  // pixels, the disc shape is invisible and a single point is enough.
+  const bool pointMode = m_maxDiameter * lod < lodPointDiameter;
+
+  m_shaderProgram->bind();
+  m_shaderProgram->setUniformValue("projection", projection);
+  m_shaderProgram->setUniformValue("scale", lod);
+  m_shaderProgram->setUniformValue("pointMode", pointMode ? 1 : 0);
+
+  m_shaderProgram->enableAttributeArray(1);
+  m_shaderProgram->setAttributeBuffer(1, GL_FLOAT, offsetof(Instance, x), 3,
+                                      sizeof(Instance));
+  gl->glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Instance),
+                            reinterpret_cast<const void *>(
+                                offsetof(Instance, color)));
+  m_shaderProgram->enableAttributeArray(2);
+  m_instanceVBO.release();
+
+  gl->glEnable(GL_BLEND);
+  gl->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  if (pointMode) {
+    gl->glVertexAttribDivisor(1, 0);
+    gl->glVertexAttribDivisor(2, 0);
+    m_shaderProgram->disableAttributeArray(0);
+    gl->glEnable(GL_PROGRAM_POINT_SIZE);
+    gl->glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(m_instances.size()));
+    gl->glDisable(GL_PROGRAM_POINT_SIZE);
+  } else {
+    m_quadVBO.bind();
+    m_shaderProgram->enableAttributeArray(0);
+    m_shaderProgram->setAttributeBuffer(0, GL_FLOAT, 0, 2);
+    m_quadVBO.release();
+    gl->glVertexAttribDivisor(0, 0);
+    gl->glVertexAttribDivisor(1, 1);
+    gl->glVertexAttribDivisor(2, 1);
+    gl->glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4,
+                              static_cast<GLsizei>(m_instances.size()));
+  }
+
+  m_shaderProgram->release();
+  vaoBinder.release();
+
+  painter->endNativePainting();
+}
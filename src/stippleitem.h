@@ -0,0 +1,58 @@
+#ifndef STIPPLEITEM_H
+#define STIPPLEITEM_H
+
+#include <QGraphicsItem>
+#include <QOpenGLBuffer>
+#include <QOpenGLContext>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLVertexArrayObject>
+#include <QPointer>
+
+#include "lbgstippling.h"
+
+// Draws the complete stipple set as a single graphics item. On an OpenGL
+// viewport all discs are uploaded once per update and drawn with one
+// instanced call, every other paint device (export to PNG, SVG, PDF) gets
+// plain QPainter ellipses.
+class StippleItem : public QGraphicsItem {
+ public:
+  explicit StippleItem(const QSizeF &imageSize);
+  ~StippleItem() override;
+
+  void setImageSize(const QSizeF &imageSize);
+  void setStipples(const StippleView &stipples);
+
+  QRectF boundingRect() const override;
+  void paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+             QWidget *widget) override;
+
+ private:
+  // Per-stipple vertex data, in scene coordinates.
+  struct Instance {
+    float x;
+    float y;
+    float diameter;
+    uchar color[4];
+  };
+
+  QSizeF m_imageSize;
+  std::vector<Instance> m_instances;
+  float m_maxDiameter;
+  bool m_dirty;
+
+  // context the resources below were created in, they are released with it
+  QPointer<QOpenGLContext> m_context;
+  QMetaObject::Connection m_contextConnection;
+  QOpenGLShaderProgram *m_shaderProgram;
+  QOpenGLVertexArrayObject *m_vao;
+  QOpenGLBuffer m_quadVBO;
+  QOpenGLBuffer m_instanceVBO;
+
+  void paintNative(QPainter *painter, float lod);
+  void paintRaster(QPainter *painter);
+  void initializeGL();
+  // Deletes the GL resources with their context current.
+  void releaseGL();
+};
+
+#endif  // STIPPLEITEM_H
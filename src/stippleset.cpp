@@ -0,0 +1,49 @@
+#include "stippleset.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/// Stipple View
+
+StippleView::StippleView(const float* x, const float* y, const float* size,
+                         const StippleTag* tag, size_t count)
+    : m_x(x), m_y(y), m_size(size), m_tag(tag), m_count(count) {}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Stipple Set
+
+void StippleSet::reserve(size_t n) {
+  m_x.reserve(n);
+  m_y.reserve(n);
+  m_size.reserve(n);
+#ifdef LBG_DEBUG_STIPPLES
+  m_tag.reserve(n);
+#endif
+}
+
+void StippleSet::clear() {
+  m_x.clear();
+  m_y.clear();
+  m_size.clear();
+#ifdef LBG_DEBUG_STIPPLES
+  m_tag.clear();
+#endif
+}
+
+void StippleSet::push_back(const QVector2D& pos, float size, StippleTag tag) {
+  m_x.push_back(pos.x());
+  m_y.push_back(pos.y());
+  m_size.push_back(size);
+#ifdef LBG_DEBUG_STIPPLES
+  m_tag.push_back(tag);
+#else
+  (void)tag;
+#endif
+}
+
+StippleView StippleSet::view() const {
+#ifdef LBG_DEBUG_STIPPLES
+  const StippleTag* tag = m_tag.data();
+#else
+  const StippleTag* tag = nullptr;
+#endif
+  return StippleView(m_x.data(), m_y.data(), m_size.data(), tag, size());
+}
@@ -0,0 +1,75 @@
+#ifndef STIPPLESET_H
+#define STIPPLESET_H
+
+#include <QVector2D>
+
+#include <cstdint>
+#include <vector>
+
+// Debug tag of a stipple, only stored when built with LBG_DEBUG_STIPPLES.
+enum class StippleTag : uint8_t { Kept, Split };
+
+// Single stipple by value. Positions are normalized to [0, 1].
+struct Stipple {
+  QVector2D pos;
+  float size;
+};
+
+// Non-owning, read-only view on the arrays of a StippleSet. Only valid as
+// long as the viewed set is not modified.
+class StippleView {
+ public:
+  StippleView() = default;
+  StippleView(const float* x, const float* y, const float* size,
+              const StippleTag* tag, size_t count);
+
+  size_t size() const { return m_count; }
+  bool empty() const { return m_count == 0; }
+
+  const float* x() const { return m_x; }
+  const float* y() const { return m_y; }
+  const float* sizes() const { return m_size; }
+
+  QVector2D pos(size_t i) const { return QVector2D(m_x[i], m_y[i]); }
+  Stipple operator[](size_t i) const { return {pos(i), m_size[i]}; }
+  StippleTag tag(size_t i) const {
+    return m_tag ? m_tag[i] : StippleTag::Kept;
+  }
+
+ private:
+  const float* m_x = nullptr;
+  const float* m_y = nullptr;
+  const float* m_size = nullptr;
+  const StippleTag* m_tag = nullptr;
+  size_t m_count = 0;
+};
+
+// Stipples stored as structure of arrays (x, y and size in separate arrays)
+// to keep the per-stipple footprint at 12 bytes.
+class StippleSet {
+ public:
+  StippleSet() = default;
+
+  size_t size() const { return m_x.size(); }
+  bool empty() const { return m_x.empty(); }
+
+  void reserve(size_t n);
+  void clear();
+  void push_back(const QVector2D& pos, float size,
+                 StippleTag tag = StippleTag::Kept);
+
+  QVector2D pos(size_t i) const { return QVector2D(m_x[i], m_y[i]); }
+  Stipple operator[](size_t i) const { return {pos(i), m_size[i]}; }
+
+  StippleView view() const;
+
+ private:
+  std::vector<float> m_x;
+  std::vector<float> m_y;
+  std::vector<float> m_size;
+#ifdef LBG_DEBUG_STIPPLES
+  std::vector<StippleTag> m_tag;
+#endif
+};
+
+#endif  // STIPPLESET_H
@@ -1,46 +1,12 @@
 #include "stippleviewer.h"
 
 #include <QCoreApplication>
+#include <QGraphicsPixmapItem>
+#include <QOpenGLWidget>
 #include <QPrinter>
 #include <QSvgGenerator>
-#include <QGraphicsItem>
-
-//#define ONLYRECT 
-
-#ifdef ONLYRECT
-class StippleItem : public QGraphicsItem {
-public:
-    std::vector<Stipple> stipples;  // Stipple points to render
-    double imageWidth;
-    double imageHeight;
-
-    // Set the image dimensions, which will be used for scaling
-    void setImageDimensions(double width, double height) {
-        imageWidth = width;
-        imageHeight = height;
-    }
-
-    QRectF boundingRect() const override {
-        // Calculate bounding rect if needed, for better clipping and optimization
-        return QRectF(0, 0, imageWidth, imageHeight);  // Adjust as necessary
-    }
-
-    void paint(QPainter* painter, const QStyleOptionGraphicsItem*, QWidget*) override {
-        painter->setPen(Qt::NoPen);
-
-        // Loop over the stipples and render each one
-        for (const Stipple& s : stipples) {
-            // Apply the coordinate correction based on the image size
-            double x = static_cast<double>(s.pos.x() * imageWidth - s.size / 2.0);
-            double y = static_cast<double>(s.pos.y() * imageHeight - s.size / 2.0);
-            double size = static_cast<double>(s.size);
-
-            painter->setBrush(s.color);
-            painter->drawRect(QRectF(x, y, size, size));
-        }
-    }
-};
-#endif
+
+#include "stippleitem.h"
 
 StippleViewer::StippleViewer(const QImage &img, QWidget *parent)
     : QGraphicsView(parent), m_image(img) {
@@ -52,10 +18,23 @@ StippleViewer::StippleViewer(const QImage &img, QWidget *parent)
   setAttribute(Qt::WA_TranslucentBackground, false);
   setCacheMode(QGraphicsView::CacheBackground);
 
+  // Stipples are drawn with OpenGL, compatibility profile so that QPainter
+  // can still render the remaining scene on the same context.
+  QSurfaceFormat format;
+  format.setVersion(3, 3);
+  format.setProfile(QSurfaceFormat::CompatibilityProfile);
+  format.setSamples(4);
+  QOpenGLWidget *glViewport = new QOpenGLWidget(this);
+  glViewport->setFormat(format);
+  setViewport(glViewport);
+
   setScene(new QGraphicsScene(this));
   this->scene()->setSceneRect(m_image.rect());
   this->scene()->setItemIndexMethod(QGraphicsScene::NoIndex);
-  this->scene()->addPixmap(QPixmap::fromImage(m_image));
+  m_imageItem = this->scene()->addPixmap(QPixmap::fromImage(m_image));
+  m_stippleItem = new StippleItem(m_image.size());
+  m_stippleItem->setVisible(false);
+  this->scene()->addItem(m_stippleItem);
 
   m_stippling = LBGStippling();
   m_stippling.setStatusCallback([this](const auto &status) {
@@ -67,26 +46,10 @@ StippleViewer::StippleViewer(const QImage &img, QWidget *parent)
       [this](const auto &stipples) { displayPoints(stipples); });
 }
 
-void StippleViewer::displayPoints(const std::vector<Stipple> &stipples) {
-  if(this->draw())
-  {
-    this->scene()->clear();
-#ifdef ONLYRECT
-    auto item = new StippleItem();
-    item->stipples = stipples;
-    item->setImageDimensions(m_image.width(), m_image.height());  // Set the image dimensions
-
-    scene()->addItem(item);
-#else
-    for (const auto &s : stipples) {
-      double x = static_cast<double>(s.pos.x() * m_image.width() - s.size / 2.0f);
-      double y =
-          static_cast<double>(s.pos.y() * m_image.height() - s.size / 2.0f);
-      double size = static_cast<double>(s.size);
-      this->scene()->addEllipse(x, y, size, size, Qt::NoPen, s.color);
-    }
-#endif
-  }
+void StippleViewer::displayPoints(const StippleView &stipples) {
+  m_imageItem->setVisible(false);
+  m_stippleItem->setStipples(stipples);
+  m_stippleItem->setVisible(true);
   // TODO: Fix event handling
   QCoreApplication::processEvents();
 }
@@ -133,8 +96,11 @@ void StippleViewer::saveImagePDF(const QString &path) {
 
 void StippleViewer::setInputImage(const QImage &img) {
   m_image = img;
-  this->scene()->clear();
-  this->scene()->addPixmap(QPixmap::fromImage(m_image));
+  m_imageItem->setPixmap(QPixmap::fromImage(m_image));
+  m_imageItem->setVisible(true);
+  m_stippleItem->setVisible(false);
+  m_stippleItem->setStipples(StippleView());
+  m_stippleItem->setImageSize(m_image.size());
   this->scene()->setSceneRect(m_image.rect());
 
   auto w = m_image.width();
@@ -151,16 +117,3 @@ void StippleViewer::stipple(const LBGStippling::Params params) {
   emit finished();
 }
 
-bool StippleViewer::draw() {
-  bool doDraw(false);
-  if(m_stippling.draw())
-    doDraw = true;
-  return(doDraw);
-}
-
-void StippleViewer::invert() {
-  // TODO: Handle return value
-  m_image.invertPixels();
-  this->setInputImage(m_image);
-}
-
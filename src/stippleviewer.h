@@ -5,19 +5,20 @@
 
 #include "lbgstippling.h"
 
+class QGraphicsPixmapItem;
+class StippleItem;
+
 class StippleViewer : public QGraphicsView {
   Q_OBJECT
 
  public:
   StippleViewer(const QImage &img, QWidget *parent);
   void stipple(const LBGStippling::Params params);
-  bool draw();
-  void invert();
   QPixmap getImage();
   void setInputImage(const QImage &img);
   void saveImageSVG(const QString &path);
   void saveImagePDF(const QString &path);
-  void displayPoints(const std::vector<Stipple> &stipples);
+  void displayPoints(const StippleView &stipples);
 
  signals:
   void finished();
@@ -28,6 +29,8 @@ class StippleViewer : public QGraphicsView {
  private:
   LBGStippling m_stippling;
   QImage m_image;
+  QGraphicsPixmapItem *m_imageItem;
+  StippleItem *m_stippleItem;
 };
 
 #endif  // STIPPLEVIEWER_H
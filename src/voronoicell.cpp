@@ -1,102 +1,278 @@
 #include "voronoicell.h"
+#include "densitymap.h"
 #include "voronoidiagram.h"
 
+#include <algorithm>
 #include <cmath>
 #include <omp.h>
 #include <unordered_map>
 #include <vector>
-#include <iostream>
-
-
-struct Moments {
-  float moment00;
-  float moment10;
-  float moment01;
-  float moment11;
-  float moment20;
-  float moment02;
-};
-
-struct LocalAccum {
-  uint32_t area = 0;
-  float sumDensity = 0.0f;
-  Moments m{};
-};
-
-std::vector<VoronoiCell> accumulateCells(const IndexMap& map,
-                                         const QImage& density) {
+
+Moments& Moments::operator+=(const Moments& other) {
+  area += other.area;
+  moment00 += other.moment00;
+  moment10 += other.moment10;
+  moment01 += other.moment01;
+  moment11 += other.moment11;
+  moment20 += other.moment20;
+  moment02 += other.moment02;
+  return *this;
+}
+
+void addTileMoments(const std::vector<TileMoments>& tiles,
+                    std::vector<Moments>& moments) {
+  for (const TileMoments& tile : tiles)
+    for (const auto& [index, part] : tile) moments[index] += part;
+}
+
+std::vector<std::pair<uint32_t, uint32_t>> unpackPairs(
+    std::vector<uint64_t>& packed) {
+  std::sort(packed.begin(), packed.end());
+  packed.erase(std::unique(packed.begin(), packed.end()), packed.end());
+
+  std::vector<std::pair<uint32_t, uint32_t>> pairs(packed.size());
+  std::transform(packed.begin(), packed.end(), pairs.begin(),
+                 [](uint64_t p) {
+                   return std::make_pair(static_cast<uint32_t>(p >> 32),
+                                         static_cast<uint32_t>(p));
+                 });
+  return pairs;
+}
+
+std::vector<VoronoiCell> cellsFromMoments(const std::vector<Moments>& moments,
+                                          const StippleView& sites, int width,
+                                          int height, float sampleArea,
+                                          bool orientation) {
+  std::vector<VoronoiCell> cells = std::vector<VoronoiCell>(moments.size());
+
+  // compute cell quantities
+  for (size_t i = 0; i < cells.size(); ++i) {
+    VoronoiCell& cell = cells[i];
+    cell.area = moments[i].area * sampleArea;
+    cell.sumDensity = moments[i].moment00 * sampleArea;
+    if (cell.sumDensity <= 0.0f) continue;
+
+    const Moments& m = moments[i];
+    const float m00 = m.moment00;
+
+    // centroid, relative to the site
+    cell.centroid.setX(m.moment10 / m00);
+    cell.centroid.setY(m.moment01 / m00);
+
+    // orientation
+    cell.orientation = 0.0f;
+    if (orientation) {
+      const float x = m.moment20 / m00 - cell.centroid.x() * cell.centroid.x();
+      const float y =
+          2.0f * (m.moment11 / m00 - cell.centroid.x() * cell.centroid.y());
+      const float z = m.moment02 / m00 - cell.centroid.y() * cell.centroid.y();
+      cell.orientation = std::atan2(y, x - z) / 2.0f;
+    }
+
+    cell.centroid.setX(sites.x()[i] + cell.centroid.x() / width);
+    cell.centroid.setY(sites.y()[i] + cell.centroid.y() / height);
+  }
+  return cells;
+}
+
+std::vector<VoronoiCell> accumulateCells(
+    const IndexMap& map, const DensityMap& density, const StippleView& sites,
+    int superSampling, const std::vector<uint8_t>* skip, bool orientation,
+    std::vector<std::pair<uint32_t, uint32_t>>* adjacency) {
+  const float scale = 1.0f / superSampling;
+  // only the bounding box of a mask is visited, in index map pixels
+  const QRect bounds = density.bounds();
+  const int x0 = bounds.left() * superSampling;
+  const int y0 = bounds.top() * superSampling;
+  const int x1 = (bounds.right() + 1) * superSampling;
+  const int y1 = (bounds.bottom() + 1) * superSampling;
+
+  // Tiles of the density map's tile size, scanned row by row along the
+  // index map's memory and handed out dynamically, so that tiles outside a
+  // mask or full of skipped cells do not leave threads idle.
+  const int tileSize = DensityMap::TileSize * superSampling;
+  const int tilesX = (x1 - x0 + tileSize - 1) / tileSize;
+  const int tilesY = (y1 - y0 + tileSize - 1) / tileSize;
+
   // compute voronoi cell moments
-  std::vector<VoronoiCell> cells = std::vector<VoronoiCell>(map.count());
   std::vector<Moments> moments = std::vector<Moments>(map.count());
+  const int width = density.width();
+  const int height = density.height();
 
-  #pragma omp parallel
-  {
+  // Every cell sums the samples of a tile on their own, the totals add up
+  // the tiles in their order, so that no float sum runs over more than a
+  // tile and the sums do not depend on the threads.
+  std::vector<TileMoments> tileMoments(tilesX * tilesY);
 
-    //int id = omp_get_thread_num();
-    //std::cout << "Hello from thread " << id << "\n";
+  // cell pairs of all threads, packed
+  std::vector<uint64_t> edges;
 
-    // Thread-local accumulation map
-    std::unordered_map<uint32_t, LocalAccum> local;
+  // one instance per feature set, without per-sample tests in its loops
+  auto kernel = [&](auto supersampledTag, auto maskedTag, auto orientationTag,
+                    auto adjacencyTag) {
+    constexpr bool Supersampled = decltype(supersampledTag)::value;
+    constexpr bool Masked = decltype(maskedTag)::value;
+    constexpr bool Orientation = decltype(orientationTag)::value;
+    constexpr bool Adjacency = decltype(adjacencyTag)::value;
+    const int ss = Supersampled ? superSampling : 1;
 
-    #pragma omp for nowait
-    for (int x = 0; x < map.width; ++x) {
-      for (int y = 0; y < map.height; ++y) {
-        uint32_t index = map.get(x, y);
+    #pragma omp parallel
+    {
+      // moments of the cells of the current tile
+      std::unordered_map<uint32_t, Moments> local;
+      std::vector<uint32_t> touched;
+      // pairs of this thread, and of the current tile before they are
+      // deduplicated
+      std::vector<uint64_t> localEdges;
+      std::vector<uint64_t> tileEdges;
+
+      // pairs with the samples to the right and below, which may lie in the
+      // next tile
+      auto neighbours = [&](int x, int y, uint32_t index) {
+        if (x + 1 < x1 && (!Masked || density.inside((x + 1) / ss, y / ss))) {
+          const uint32_t right = map.get(x + 1, y);
+          if (right != index)
+            tileEdges.push_back(packPair(std::min(index, right),
+                                         std::max(index, right)));
+        }
+        if (y + 1 < y1 && (!Masked || density.inside(x / ss, (y + 1) / ss))) {
+          const uint32_t below = map.get(x, y + 1);
+          if (below != index)
+            tileEdges.push_back(packPair(std::min(index, below),
+                                         std::max(index, below)));
+        }
+      };
+
+      auto scanTile = [&](int tile, int tx0, int ty0, int tx1, int ty1) {
+        if (Masked && !density.occupied(tx0 / ss, ty0 / ss, (tx1 - 1) / ss + 1,
+                                        (ty1 - 1) / ss + 1))
+          return;
 
-        QRgb densityPixel = density.pixel(x, y);
-        float densityVal = std::max(1.0f - qGray(densityPixel) / 255.0f,
-                                    std::numeric_limits<float>::epsilon());
+        // neighbouring samples mostly belong to the same cell
+        uint32_t last = ~uint32_t(0);
+        Moments* acc = nullptr;
+        float originX = 0.0f;
+        float originY = 0.0f;
+        for (int y = ty0; y < ty1; ++y) {
+          const float py = Supersampled ? (y + 0.5f) * scale : y + 0.5f;
+          for (int x = tx0; x < tx1; ++x) {
+            if (Masked && !density.inside(x / ss, y / ss)) continue;
+            const uint32_t index = map.get(x, y);
+            if (Adjacency) neighbours(x, y, index);
+            if (index != last) {
+              last = index;
+              acc = nullptr;
+              if (!skip || !(*skip)[index]) {
+                acc = &local[index];
+                if (acc->area == 0.0f) touched.push_back(index);
+                originX = sites.x()[index] * width;
+                originY = sites.y()[index] * height;
+              }
+            }
+            if (!acc) continue;
 
-        LocalAccum& acc = local[index];
-        acc.area++;
-        acc.sumDensity += densityVal;
+            // sample position in pixels of the density map
+            const float px = Supersampled ? (x + 0.5f) * scale : x + 0.5f;
+            const float densityVal =
+                Supersampled ? density.sample(px, py) : density.at(x, y);
+            acc->add<Orientation>(px - originX, py - originY, densityVal);
+          }
+        }
 
-        acc.m.moment00 += densityVal;
-        acc.m.moment10 += x * densityVal;
-        acc.m.moment01 += y * densityVal;
-        acc.m.moment11 += x * y * densityVal;
-        acc.m.moment20 += x * x * densityVal;
-        acc.m.moment02 += y * y * densityVal;
+        for (uint32_t index : touched) {
+          Moments& acc = local[index];
+          tileMoments[tile].emplace_back(index, acc);
+          acc = Moments();
+        }
+        touched.clear();
+
+        if (Adjacency) {
+          // a border crosses a tile in many samples but a few pairs
+          std::sort(tileEdges.begin(), tileEdges.end());
+          localEdges.insert(localEdges.end(), tileEdges.begin(),
+                            std::unique(tileEdges.begin(), tileEdges.end()));
+          tileEdges.clear();
+        }
+      };
+      #pragma omp for schedule(dynamic) nowait
+      for (int tile = 0; tile < tilesX * tilesY; ++tile) {
+        const int tx = x0 + (tile % tilesX) * tileSize;
+        const int ty = y0 + (tile / tilesX) * tileSize;
+        scanTile(tile, tx, ty, std::min(tx + tileSize, x1),
+                 std::min(ty + tileSize, y1));
       }
-    }
 
-    // Merge thread-local results into global arrays
-    #pragma omp critical
-    {
-      for (const auto& [index, acc] : local) {
-        cells[index].area += acc.area;
-        cells[index].sumDensity += acc.sumDensity;
-
-        Moments& m = moments[index];
-        m.moment00 += acc.m.moment00;
-        m.moment10 += acc.m.moment10;
-        m.moment01 += acc.m.moment01;
-        m.moment11 += acc.m.moment11;
-        m.moment20 += acc.m.moment20;
-        m.moment02 += acc.m.moment02;
+      if (Adjacency) {
+        std::sort(localEdges.begin(), localEdges.end());
+        localEdges.erase(std::unique(localEdges.begin(), localEdges.end()),
+                         localEdges.end());
+        #pragma omp critical
+        edges.insert(edges.end(), localEdges.begin(), localEdges.end());
       }
     }
-  }
+  };
+  // adjacency is rarely asked for, its flag goes on top of the others
+  auto withAdjacency = [&](auto supersampledTag, auto maskedTag,
+                           auto orientationTag) {
+    adjacency ? kernel(supersampledTag, maskedTag, orientationTag,
+                       std::true_type())
+              : kernel(supersampledTag, maskedTag, orientationTag,
+                       std::false_type());
+  };
+  dispatchKernel(superSampling > 1, density.isMasked(), orientation,
+                 withAdjacency);
+  addTileMoments(tileMoments, moments);
+  if (adjacency) *adjacency = unpackPairs(edges);
 
-  // compute cell quantities
-  for (size_t i = 0; i < cells.size(); ++i) {
-    VoronoiCell& cell = cells[i];
-    if (cell.sumDensity <= 0.0f) continue;
+  return cellsFromMoments(moments, sites, width, height, scale * scale,
+                          orientation);
+}
 
-    auto [m00, m10, m01, m11, m20, m02] = moments[i];
+std::vector<std::pair<uint32_t, uint32_t>> findFrozenBorders(
+    const IndexMap& map, const std::vector<uint8_t>& frozen) {
+  // pairs are packed as (frozen << 32 | other) for sorting
+  std::vector<uint64_t> borders;
 
-    // centroid
-    cell.centroid.setX(m10 / m00);
-    cell.centroid.setY(m01 / m00);
+  #pragma omp parallel
+  {
+    std::vector<uint64_t> local;
+    uint64_t last = ~uint64_t(0);
+    auto check = [&](uint32_t a, uint32_t b) {
+      if (a == b || frozen[a] == frozen[b]) return;
+      const uint64_t pair = frozen[a] ? packPair(a, b) : packPair(b, a);
+      // neighbouring pixels mostly repeat the previous pair
+      if (pair != last) local.push_back(pair);
+      last = pair;
+    };
 
-    // orientation
-    float x = m20 / m00 - cell.centroid.x() * cell.centroid.x();
-    float y = 2.0f * (m11 / m00 - cell.centroid.x() * cell.centroid.y());
-    float z = m02 / m00 - cell.centroid.y() * cell.centroid.y();
-    cell.orientation = std::atan2(y, x - z) / 2.0f;
+    // rows follow the memory layout of the index map
+    #pragma omp for nowait
+    for (int y = 0; y < map.height; ++y) {
+      for (int x = 0; x < map.width; ++x) {
+        uint32_t index = map.get(x, y);
+        if (x + 1 < map.width) check(index, map.get(x + 1, y));
+        if (y + 1 < map.height) check(index, map.get(x, y + 1));
+      }
+    }
 
-    cell.centroid.setX((cell.centroid.x() + 0.5f) / density.width());
-    cell.centroid.setY((cell.centroid.y() + 0.5f) / density.height());
+    std::sort(local.begin(), local.end());
+    local.erase(std::unique(local.begin(), local.end()), local.end());
+
+    #pragma omp critical
+    borders.insert(borders.end(), local.begin(), local.end());
   }
-  return cells;
+
+  return unpackPairs(borders);
+}
+
+std::vector<std::pair<uint32_t, uint32_t>> findFrozenBorders(
+    const std::vector<std::pair<uint32_t, uint32_t>>& adjacency,
+    const std::vector<uint8_t>& frozen) {
+  std::vector<std::pair<uint32_t, uint32_t>> borders;
+  for (const auto& [a, b] : adjacency) {
+    if (frozen[a] == frozen[b]) continue;
+    borders.push_back(frozen[a] ? std::make_pair(a, b) : std::make_pair(b, a));
+  }
+  std::sort(borders.begin(), borders.end());
+  return borders;
 }
@@ -1,8 +1,19 @@
 #ifndef VORONOICELL_H
 #define VORONOICELL_H
 
+#include <QImage>
 #include <QVector2D>
 
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "stippleset.h"
+
+class DensityMap;
 class IndexMap;
 
 struct VoronoiCell {
@@ -12,7 +23,109 @@ struct VoronoiCell {
   float sumDensity;
 };
 
-std::vector<VoronoiCell> accumulateCells(const IndexMap& map,
-                                         const QImage& density);
+// Raw moments of a cell, accumulated over its samples (x, y) with density d.
+// Positions are continuous pixel coordinates of the input image (the center
+// of pixel (0, 0) is at (0.5, 0.5)) relative to the cell's site, at x * width
+// and y * height pixels for normalized site coordinates. Sums then stay in
+// the range of the cell's extent whatever the image size, and floats keep
+// enough precision for the second order moments.
+struct Moments {
+  float area = 0.0f;
+  float moment00 = 0.0f;  // sum of d, equals the total density
+  float moment10 = 0.0f;
+  float moment01 = 0.0f;
+  float moment11 = 0.0f;
+  float moment20 = 0.0f;
+  float moment02 = 0.0f;
+
+  // Without Orientation, the second order moments are left out.
+  template <bool Orientation = true>
+  void add(float x, float y, float densityVal) {
+    area += 1.0f;
+    moment00 += densityVal;
+    moment10 += x * densityVal;
+    moment01 += y * densityVal;
+    if (Orientation) {
+      moment11 += x * y * densityVal;
+      moment20 += x * x * densityVal;
+      moment02 += y * y * densityVal;
+    }
+  }
+
+  Moments& operator+=(const Moments& other);
+};
+
+// Moments of the cells whose samples a tile holds, by cell index. The
+// engines sum the parts of all tiles in the order of the tiles, so that the
+// totals do not depend on which thread scanned which tile and seeded runs
+// repeat bit for bit.
+using TileMoments = std::vector<std::pair<uint32_t, Moments>>;
+
+// Adds the parts of `tiles` to `moments` in tile order.
+void addTileMoments(const std::vector<TileMoments>& tiles,
+                    std::vector<Moments>& moments);
+
+// Density of a grayscale pixel: dark pixels are dense, white ones almost
+// empty.
+inline float densityValue(uint8_t gray) {
+  return std::max(1.0f - gray / 255.0f, std::numeric_limits<float>::epsilon());
+}
+
+// Calls `kernel` with std::true_type or std::false_type for each of the
+// flags, so that a kernel written as a generic lambda is instantiated for
+// every combination of features and the choice is made once, outside its
+// loops.
+template <class Kernel>
+void dispatchKernel(bool first, bool second, bool third, Kernel&& kernel) {
+  const auto withThird = [&](auto a, auto b) {
+    third ? kernel(a, b, std::true_type()) : kernel(a, b, std::false_type());
+  };
+  const auto withSecond = [&](auto a) {
+    second ? withThird(a, std::true_type()) : withThird(a, std::false_type());
+  };
+  first ? withSecond(std::true_type()) : withSecond(std::false_type());
+}
+
+// Pairs of cells packed as (first << 32 | second), so that they sort like
+// the pairs.
+inline uint64_t packPair(uint32_t first, uint32_t second) {
+  return uint64_t(first) << 32 | second;
+}
+// Sorts and deduplicates packed pairs and unpacks them.
+std::vector<std::pair<uint32_t, uint32_t>> unpackPairs(
+    std::vector<uint64_t>& packed);
+
+// Computes centroids (normalized by the image size) and orientations from
+// moments taken about `sites`. `sampleArea` is the area of one sample in
+// input pixels, so that areas and densities do not depend on the
+// supersampling. Without `orientation` the moments have no second order
+// terms and all orientations are zero.
+std::vector<VoronoiCell> cellsFromMoments(const std::vector<Moments>& moments,
+                                          const StippleView& sites, int width,
+                                          int height, float sampleArea = 1.0f,
+                                          bool orientation = true);
+
+// Accumulates an index map of `sites` rendered at `superSampling` times the
+// resolution of the density map. Cells with a non-zero entry in `skip` are
+// not accumulated and returned default-initialized. Without `orientation`
+// only areas, densities and centroids are computed. With `adjacency` the
+// same pass collects every pair (i, j), i < j, of cells with horizontally
+// or vertically neighbouring samples, sorted and without duplicates.
+std::vector<VoronoiCell> accumulateCells(
+    const IndexMap& map, const DensityMap& density, const StippleView& sites,
+    int superSampling, const std::vector<uint8_t>* skip = nullptr,
+    bool orientation = true,
+    std::vector<std::pair<uint32_t, uint32_t>>* adjacency = nullptr);
+
+// Returns all (frozen, non-frozen) pairs of cells that share a border in the
+// index map, without duplicates.
+std::vector<std::pair<uint32_t, uint32_t>> findFrozenBorders(
+    const IndexMap& map, const std::vector<uint8_t>& frozen);
+
+// The (frozen, non-frozen) pairs among the pairs of neighbouring cells
+// `adjacency`, sorted.
+std::vector<std::pair<uint32_t, uint32_t>> findFrozenBorders(
+    const std::vector<std::pair<uint32_t, uint32_t>>& adjacency,
+    const std::vector<uint8_t>& frozen);
 
 #endif  // VORONOICELL_H
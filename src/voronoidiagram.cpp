@@ -13,14 +13,9 @@
 ////////////////////////////////////////////////////////////////////////////////
 /// Cell Encoder
 
+// Indices are encoded to colors in the vertex shader, white (cleared)
+// pixels decode to an index beyond the number of sites.
 namespace CellEncoder {
-QVector3D encode(const uint32_t index) {
-  uint32_t r = (index >> 16) & 0xff;
-  uint32_t g = (index >> 8) & 0xff;
-  uint32_t b = (index >> 0) & 0xff;
-  return QVector3D(r / 255.0f, g / 255.0f, b / 255.0f);
-}
-
 uint32_t decode(const uint32_t& r, const uint32_t& g, const uint32_t& b) {
   return 0x00000000 | (r << 16) | (g << 8) | b;
 }
@@ -31,7 +26,7 @@ uint32_t decode(const uint32_t& r, const uint32_t& g, const uint32_t& b) {
 
 IndexMap::IndexMap(int32_t w, int32_t h, int32_t count)
     : width(w), height(h), m_numEncoded(count) {
-  m_data = QVector<uint32_t>(w * h);
+  m_data.resize(static_cast<size_t>(w) * h);
 }
 
 void IndexMap::set(const int32_t x, const int32_t y, const uint32_t value) {
@@ -47,7 +42,7 @@ int32_t IndexMap::count() const { return m_numEncoded; }
 ////////////////////////////////////////////////////////////////////////////////
 /// Voronoi Diagram
 
-VoronoiDiagram::VoronoiDiagram(QImage& density) : m_densityMap(density) {
+VoronoiDiagram::VoronoiDiagram(const QSize& size) : m_fbo(nullptr) {
   m_context = new QOpenGLContext();
   QSurfaceFormat format;
   format.setMajorVersion(3);
@@ -72,11 +67,26 @@ VoronoiDiagram::VoronoiDiagram(QImage& density) : m_densityMap(density) {
                                            voronoiFragment.c_str());
   m_shaderProgram->link();
 
+  resize(size);
+}
+
+VoronoiDiagram::~VoronoiDiagram() {
+  delete m_fbo;
+  delete m_context;
+}
+
+void VoronoiDiagram::resize(const QSize& size) {
+  if (m_fbo && size == m_size) return;
+  m_size = size;
+
+  m_context->makeCurrent(m_surface);
+
+  delete m_fbo;
   QOpenGLFramebufferObjectFormat fboFormat;
-  fboFormat.setAttachment(QOpenGLFramebufferObject::Depth);
-  m_fbo = new QOpenGLFramebufferObject(m_densityMap.width(),
-                                       m_densityMap.height(), fboFormat);
-  QVector<QVector3D> cones = createConeDrawingData(m_densityMap.size());
+  fboFormat.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+  m_fbo = new QOpenGLFramebufferObject(m_size, fboFormat);
+  // the tessellation of the cones depends on the size
+  QVector<QVector3D> cones = createConeDrawingData(m_size);
 
   m_vao->bind();
 
@@ -99,51 +109,20 @@ VoronoiDiagram::VoronoiDiagram(QImage& density) : m_densityMap(density) {
   m_vao->release();
 }
 
-VoronoiDiagram::~VoronoiDiagram() {
-  delete m_fbo;
-  delete m_context;
-}
-
-IndexMap VoronoiDiagram::calculate(const QVector<QVector2D>& points) {
+IndexMap VoronoiDiagram::calculate(const StippleView& points,
+                                   const std::vector<float>& radii,
+                                   int superSampling) {
   assert(!points.empty());
+  assert(radii.empty() || radii.size() == points.size());
 
   m_context->makeCurrent(m_surface);
 
   QOpenGLFunctions_3_3_Core* gl =
       m_context->versionFunctions<QOpenGLFunctions_3_3_Core>();
 
-  m_vao->bind();
-
-  m_shaderProgram->bind();
-
-  QOpenGLBuffer vboPositions = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
-  vboPositions.create();
-  vboPositions.setUsagePattern(QOpenGLBuffer::StaticDraw);
-  vboPositions.bind();
-  vboPositions.allocate(points.constData(), points.size() * sizeof(QVector2D));
-  m_shaderProgram->enableAttributeArray(1);
-  m_shaderProgram->setAttributeBuffer(1, GL_FLOAT, 0, 2);
-  gl->glVertexAttribDivisor(1, 1);
-  vboPositions.release();
-
-  QVector<QVector3D> colors(points.size());
-  uint32_t n = 0;
-  std::generate(colors.begin(), colors.end(),
-                [&n]() mutable { return CellEncoder::encode(n++); });
-
-  QOpenGLBuffer vboColors = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
-  vboColors.create();
-  vboColors.setUsagePattern(QOpenGLBuffer::StaticDraw);
-  vboColors.bind();
-  vboColors.allocate(colors.data(), colors.size() * sizeof(QVector3D));
-  m_shaderProgram->enableAttributeArray(2);
-  m_shaderProgram->setAttributeBuffer(2, GL_FLOAT, 0, 3);
-  gl->glVertexAttribDivisor(2, 1);
-  vboColors.release();
-
   m_fbo->bind();
 
-  gl->glViewport(0, 0, m_densityMap.width(), m_densityMap.height());
+  gl->glViewport(0, 0, m_size.width(), m_size.height());
 
   gl->glDisable(GL_MULTISAMPLE);
   gl->glDisable(GL_DITHER);
@@ -153,14 +132,159 @@ IndexMap VoronoiDiagram::calculate(const QVector<QVector2D>& points) {
   gl->glEnable(GL_DEPTH_TEST);
 
   gl->glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-  gl->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  gl->glClearStencil(0);
+  gl->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT |
+              GL_STENCIL_BUFFER_BIT);
+
+  if (radii.empty()) {
+    drawFullCones(gl, points);
+  } else {
+    // mark every pixel covered by a bounded cone in the stencil buffer
+    gl->glEnable(GL_STENCIL_TEST);
+    gl->glStencilFunc(GL_ALWAYS, 1, 0xff);
+    gl->glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    drawBoundedCones(gl, points, radii);
+    gl->glDisable(GL_STENCIL_TEST);
+  }
+
+  size_t uncovered = 0;
+  IndexMap idxMap = readIndexMap(points.size(), superSampling, uncovered);
+
+  if (!radii.empty() && uncovered > 0) {
+    // fallback: full-size cones, restricted to the uncovered pixels
+    gl->glEnable(GL_STENCIL_TEST);
+    gl->glStencilFunc(GL_EQUAL, 0, 0xff);
+    gl->glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    drawFullCones(gl, points);
+    gl->glDisable(GL_STENCIL_TEST);
+
+    idxMap = readIndexMap(points.size(), superSampling, uncovered);
+  }
+  return idxMap;
+}
+
+void VoronoiDiagram::drawFullCones(QOpenGLFunctions_3_3_Core* gl,
+                                   const StippleView& points) {
+  m_vao->bind();
 
-  gl->glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, m_coneVertices, points.size());
+  m_shaderProgram->bind();
+  m_shaderProgram->setUniformValue("indexFromInstance", 1);
+
+  // positions are stored as separate x and y arrays
+  QOpenGLBuffer vboPositionsX = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+  vboPositionsX.create();
+  vboPositionsX.setUsagePattern(QOpenGLBuffer::StaticDraw);
+  vboPositionsX.bind();
+  vboPositionsX.allocate(points.x(), points.size() * sizeof(float));
+  m_shaderProgram->enableAttributeArray(1);
+  m_shaderProgram->setAttributeBuffer(1, GL_FLOAT, 0, 1);
+  gl->glVertexAttribDivisor(1, 1);
+  vboPositionsX.release();
+
+  QOpenGLBuffer vboPositionsY = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+  vboPositionsY.create();
+  vboPositionsY.setUsagePattern(QOpenGLBuffer::StaticDraw);
+  vboPositionsY.bind();
+  vboPositionsY.allocate(points.y(), points.size() * sizeof(float));
+  m_shaderProgram->enableAttributeArray(3);
+  m_shaderProgram->setAttributeBuffer(3, GL_FLOAT, 0, 1);
+  gl->glVertexAttribDivisor(3, 1);
+  vboPositionsY.release();
+
+  // every cone covers the whole image
+  const ConeLod& full = m_coneLods.back();
+  m_shaderProgram->disableAttributeArray(2);
+  m_shaderProgram->setAttributeValue(2, full.maxRadius);
+  m_shaderProgram->disableAttributeArray(4);
+
+  gl->glDrawArraysInstanced(GL_TRIANGLE_FAN, full.first, full.count,
+                            points.size());
 
   m_shaderProgram->release();
 
   m_vao->release();
+}
+
+void VoronoiDiagram::drawBoundedCones(QOpenGLFunctions_3_3_Core* gl,
+                                      const StippleView& points,
+                                      const std::vector<float>& radii) {
+  struct ConeInstance {
+    float x;
+    float y;
+    float radius;
+    uint32_t index;
+  };
+
+  // sort the cones by level of detail, the index travels along
+  const float toNormalized = 1.0f / m_size.width();
+  std::vector<size_t> lodOf(points.size());
+  std::vector<size_t> lodStart(m_coneLods.size() + 1, 0);
+  for (size_t i = 0; i < points.size(); ++i) {
+    const float radius = radii[i] * toNormalized;
+    size_t lod = 0;
+    while (lod + 1 < m_coneLods.size() && m_coneLods[lod].maxRadius < radius)
+      ++lod;
+    lodOf[i] = lod;
+    ++lodStart[lod + 1];
+  }
+  for (size_t lod = 0; lod < m_coneLods.size(); ++lod)
+    lodStart[lod + 1] += lodStart[lod];
+
+  std::vector<ConeInstance> instances(points.size());
+  std::vector<size_t> next(lodStart.begin(), lodStart.end() - 1);
+  for (size_t i = 0; i < points.size(); ++i) {
+    const float radius = std::min(radii[i] * toNormalized,
+                                  m_coneLods.back().maxRadius);
+    instances[next[lodOf[i]]++] = {points.x()[i], points.y()[i], radius,
+                                   static_cast<uint32_t>(i)};
+  }
+
+  m_vao->bind();
+
+  m_shaderProgram->bind();
+  m_shaderProgram->setUniformValue("indexFromInstance", 0);
+
+  QOpenGLBuffer vboInstances = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+  vboInstances.create();
+  vboInstances.setUsagePattern(QOpenGLBuffer::StaticDraw);
+  vboInstances.bind();
+  vboInstances.allocate(instances.data(),
+                        instances.size() * sizeof(ConeInstance));
 
+  m_shaderProgram->enableAttributeArray(1);
+  m_shaderProgram->enableAttributeArray(2);
+  m_shaderProgram->enableAttributeArray(3);
+  m_shaderProgram->enableAttributeArray(4);
+  for (int location : {1, 2, 3, 4}) gl->glVertexAttribDivisor(location, 1);
+
+  const int stride = sizeof(ConeInstance);
+  for (size_t lod = 0; lod < m_coneLods.size(); ++lod) {
+    const size_t count = lodStart[lod + 1] - lodStart[lod];
+    if (count == 0) continue;
+
+    const size_t offset = lodStart[lod] * sizeof(ConeInstance);
+    m_shaderProgram->setAttributeBuffer(
+        1, GL_FLOAT, offset + offsetof(ConeInstance, x), 1, stride);
+    m_shaderProgram->setAttributeBuffer(
+        3, GL_FLOAT, offset + offsetof(ConeInstance, y), 1, stride);
+    m_shaderProgram->setAttributeBuffer(
+        2, GL_FLOAT, offset + offsetof(ConeInstance, radius), 1, stride);
+    gl->glVertexAttribIPointer(
+        4, 1, GL_UNSIGNED_INT, stride,
+        reinterpret_cast<const void*>(offset + offsetof(ConeInstance, index)));
+
+    const ConeLod& cone = m_coneLods[lod];
+    gl->glDrawArraysInstanced(GL_TRIANGLE_FAN, cone.first, cone.count, count);
+  }
+  vboInstances.release();
+
+  m_shaderProgram->release();
+
+  m_vao->release();
+}
+
+IndexMap VoronoiDiagram::readIndexMap(int32_t count, int superSampling,
+                                      size_t& uncovered) {
   int width = m_fbo->width();
   int height = m_fbo->height();
   int channels = 3; // RGB
@@ -171,23 +295,31 @@ IndexMap VoronoiDiagram::calculate(const QVector<QVector2D>& points) {
   glPixelStorei(GL_PACK_ALIGNMENT, 1);
   glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixelBuffer.data());
 
-  IndexMap idxMap(width, height, points.size());
+  IndexMap idxMap(width, height, count);
 
-  for (int y = 0; y < height; ++y) {
-    for (int x = 0; x < width; ++x) {
-      int flippedY = height - 1 - y;  // flip y axis if needed
-      size_t i = (flippedY * width + x) * channels;
+  // every thread decodes its block of rows, which places them
+  size_t missing = 0;
+  #pragma omp parallel reduction(+ : missing)
+  {
+    const std::pair<int, int> rows = DensityMap::threadRows(
+        height, DensityMap::TileSize * superSampling);
+    for (int y = rows.first; y < rows.second; ++y) {
+      for (int x = 0; x < width; ++x) {
+        int flippedY = height - 1 - y;  // flip y axis if needed
+        size_t i = (static_cast<size_t>(flippedY) * width + x) * channels;
 
-      uint32_t r = pixelBuffer[i];
-      uint32_t g = pixelBuffer[i + 1];
-      uint32_t b = pixelBuffer[i + 2];
+        uint32_t r = pixelBuffer[i];
+        uint32_t g = pixelBuffer[i + 1];
+        uint32_t b = pixelBuffer[i + 2];
 
-      uint32_t index = CellEncoder::decode(r, g, b);
-      assert(index <= points.size());
+        uint32_t index = CellEncoder::decode(r, g, b);
+        if (index >= static_cast<uint32_t>(count)) ++missing;
 
-      idxMap.set(x, y, index); // assuming top-left is (0,0)
+        idxMap.set(x, y, index); // assuming top-left is (0,0)
+      }
     }
   }
+  uncovered = missing;
   return idxMap;
 }
 
@@ -200,28 +332,41 @@ uint calcNumConeSlices(const float radius, const float maxError) {
   return static_cast<uint>(2 * M_PIf32 / alpha + 0.5f);
 }
 
+// Creates unit cones (distance 1 at the rim) for a range of radii, each
+// with just enough slices for one-pixel error at its largest radius. The
+// last level covers the whole image.
 QVector<QVector3D> VoronoiDiagram::createConeDrawingData(const QSize& size) {
-  const float radius = std::sqrt(2.0f);
+  const float fullRadius = std::sqrt(2.0f);
   const float maxError =
       1.0f / (size.width() > size.height() ? size.width() : size.height());
-  const uint numConeSlices = calcNumConeSlices(radius, maxError);
+  const float aspect = static_cast<float>(size.width()) / size.height();
 
-  const float angleIncr = 2.0f * M_PIf32 / numConeSlices;
-  const float height = 1.99f;
+  // bounded levels start at a few pixels and double in radius
+  std::vector<float> radii;
+  for (float r = 4.0f / size.width(); r < fullRadius; r *= 2.0f)
+    radii.push_back(r);
+  radii.push_back(fullRadius);
 
   QVector<QVector3D> conePoints;
-  conePoints.push_back(QVector3D(0.0f, 0.0f, height));
-
-  const float aspect = static_cast<float>(size.width()) / size.height();
+  m_coneLods.clear();
+  for (const float radius : radii) {
+    const uint numConeSlices =
+        std::max(8u, calcNumConeSlices(radius, maxError));
+    const float angleIncr = 2.0f * M_PIf32 / numConeSlices;
+
+    ConeLod lod;
+    lod.maxRadius = radius;
+    lod.first = conePoints.size();
+
+    conePoints.push_back(QVector3D(0.0f, 0.0f, 0.0f));
+    for (uint i = 0; i < numConeSlices; ++i) {
+      conePoints.push_back(QVector3D(std::cos(i * angleIncr),
+                                     aspect * std::sin(i * angleIncr), 1.0f));
+    }
+    conePoints.push_back(QVector3D(1.0f, 0.0f, 1.0f));
 
-  for (uint i = 0; i < numConeSlices; ++i) {
-    conePoints.push_back(QVector3D(radius * std::cos(i * angleIncr),
-                                   aspect * radius * std::sin(i * angleIncr),
-                                   height - radius));
+    lod.count = conePoints.size() - lod.first;
+    m_coneLods.push_back(lod);
   }
-
-  conePoints.push_back(QVector3D(radius, 0.0f, height - radius));
-
-  m_coneVertices = conePoints.size();
   return conePoints;
 }
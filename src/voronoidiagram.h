@@ -8,6 +8,13 @@
 #include <QOpenGLShaderProgram>
 #include <QOpenGLVertexArrayObject>
 
+#include "densitymap.h"
+#include "stippleset.h"
+
+class QOpenGLFunctions_3_3_Core;
+
+// Site index of every sample. The storage is left uninitialized, the
+// readback places it row block by row block, see DensityMap::threadRows().
 class IndexMap {
  public:
   int32_t width;
@@ -20,27 +27,51 @@ class IndexMap {
 
  private:
   int32_t m_numEncoded;
-  QVector<uint32_t> m_data;
+  std::vector<uint32_t, UninitializedAllocator<uint32_t>> m_data;
 };
 
 class VoronoiDiagram {
  public:
-  VoronoiDiagram(QImage& density);
+  // Renders diagrams of the given size in pixels.
+  explicit VoronoiDiagram(const QSize& size);
   ~VoronoiDiagram();
 
-  IndexMap calculate(const QVector<QVector2D>& points);
+  // Switches to diagrams of another size, keeping the context and shaders.
+  void resize(const QSize& size);
+
+  // Renders one distance cone per site. If `radii` (in pixels of the
+  // diagram) are given, each cone is bounded to its radius and drawn with
+  // a matching level of detail; pixels not covered by any bounded cone are
+  // filled by a second, full-size pass. The index map is read back in the
+  // row blocks of DensityMap::threadRows() of a map supersampled by
+  // `superSampling`.
+  IndexMap calculate(const StippleView& points,
+                     const std::vector<float>& radii = {},
+                     int superSampling = 1);
 
  private:
-  int m_coneVertices;
+  // Vertex range of a cone tessellated for radii up to maxRadius (in
+  // normalized units, relative to the width).
+  struct ConeLod {
+    float maxRadius;
+    int first;
+    int count;
+  };
+  std::vector<ConeLod> m_coneLods;
 
   QOpenGLContext* m_context;
   QOffscreenSurface* m_surface;
   QOpenGLVertexArrayObject* m_vao;
   QOpenGLShaderProgram* m_shaderProgram;
   QOpenGLFramebufferObject* m_fbo;
-  QImage m_densityMap;
+  QSize m_size;
 
   QVector<QVector3D> createConeDrawingData(const QSize& size);
+  void drawFullCones(QOpenGLFunctions_3_3_Core* gl, const StippleView& points);
+  void drawBoundedCones(QOpenGLFunctions_3_3_Core* gl,
+                        const StippleView& points,
+                        const std::vector<float>& radii);
+  IndexMap readIndexMap(int32_t count, int superSampling, size_t& uncovered);
 };
 
 #endif  // VORONOIDIAGRAM_H
@@ -0,0 +1,649 @@
+// The CPU, analytic and distributed cell engines against cells accumulated
+// by brute force in double precision.
+
+#include <QImage>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <omp.h>
+
+#include "analyticcellengine.h"
+#include "check.h"
+#include "connection.h"
+#include "densitymap.h"
+#include "distributedcellengine.h"
+#include "fusedcellengine.h"
+#include "lbgstippling.h"
+#include "sitegrid.h"
+#include "voronoicell.h"
+#include "voronoidiagram.h"
+
+namespace {
+
+const int Width = 160;
+const int Height = 120;
+
+std::shared_ptr<const DensityMap> testDensity(bool masked) {
+  QImage image(Width, Height, QImage::Format_Grayscale8);
+  for (int y = 0; y < Height; ++y)
+    for (int x = 0; x < Width; ++x)
+      image.scanLine(y)[x] = static_cast<uint8_t>((x * 255 / Width) ^ (y & 15));
+  auto density = std::make_shared<const DensityMap>(image);
+  if (!masked) return density;
+
+  QImage mask(Width, Height, QImage::Format_Grayscale8);
+  for (int y = 0; y < Height; ++y)
+    for (int x = 0; x < Width; ++x)
+      mask.scanLine(y)[x] = x > 20 && y > 10 && x + y < 200 ? 255 : 0;
+  return density->masked(mask);
+}
+
+StippleSet randomSites(size_t count) {
+  std::mt19937 gen(3);
+  std::uniform_real_distribution<float> dis(0.02f, 0.98f);
+  StippleSet sites;
+  for (size_t i = 0; i < count; ++i) {
+    const float x = dis(gen);
+    sites.push_back(QVector2D(x, dis(gen)), 1.0f);
+  }
+  return sites;
+}
+
+struct Reference {
+  double area = 0.0;
+  double density = 0.0;
+  double x = 0.0;  // density weighted sums, in pixels
+  double y = 0.0;
+};
+
+// Assigns superSampling^2 samples per pixel to their nearest site, the
+// lower index on ties. Densities are interpolated like the CPU engine does
+// with supersampling, or constant over each pixel if `constant` is set.
+std::vector<Reference> referenceCells(const DensityMap& density,
+                                      const StippleView& sites,
+                                      int superSampling, bool constant) {
+  std::vector<Reference> cells(sites.size());
+  const double step = 1.0 / superSampling;
+  for (int y = 0; y < density.height(); ++y)
+    for (int x = 0; x < density.width(); ++x) {
+      if (!density.inside(x, y)) continue;
+      for (int j = 0; j < superSampling; ++j)
+        for (int i = 0; i < superSampling; ++i) {
+          const double px = x + (i + 0.5) * step;
+          const double py = y + (j + 0.5) * step;
+          size_t owner = 0;
+          double best = std::numeric_limits<double>::max();
+          for (size_t s = 0; s < sites.size(); ++s) {
+            const double dx = double(sites.x()[s]) * Width - px;
+            const double dy = double(sites.y()[s]) * Height - py;
+            if (dx * dx + dy * dy < best) {
+              best = dx * dx + dy * dy;
+              owner = s;
+            }
+          }
+          const double d = constant || superSampling == 1
+                               ? density.at(x, y)
+                               : density.sample(float(px), float(py));
+          const double weight = d * step * step;
+          Reference& cell = cells[owner];
+          cell.area += step * step;
+          cell.density += weight;
+          cell.x += px * weight;
+          cell.y += py * weight;
+        }
+    }
+  return cells;
+}
+
+// Areas and densities within `areaTolerance` plus `areaFraction` of the
+// area, centroids within `centroidTolerance` pixels.
+void checkCells(const std::vector<VoronoiCell>& cells,
+                const std::vector<Reference>& reference, double areaFraction,
+                double areaTolerance, double centroidTolerance) {
+  CHECK(cells.size() == reference.size());
+  for (size_t i = 0; i < cells.size() && i < reference.size(); ++i) {
+    const Reference& expected = reference[i];
+    const double tolerance = areaTolerance + areaFraction * expected.area;
+    CHECK_NEAR(cells[i].area, expected.area, tolerance);
+    CHECK_NEAR(cells[i].sumDensity, expected.density, tolerance);
+    // centroids of cells with hardly any samples hinge on single samples
+    if (expected.area < 4.0) continue;
+    CHECK_NEAR(cells[i].centroid.x() * Width, expected.x / expected.density,
+               centroidTolerance);
+    CHECK_NEAR(cells[i].centroid.y() * Height, expected.y / expected.density,
+               centroidTolerance);
+  }
+}
+
+void testFused(bool masked, int superSampling) {
+  const auto density = testDensity(masked);
+  const StippleSet sites = randomSites(200);
+  FusedCellEngine engine(density, superSampling);
+  const CellResult result = engine.compute(sites.view(), CellQuery());
+  checkCells(result.cells,
+             referenceCells(*density, sites.view(), superSampling, false),
+             1e-4, 1e-3, 1e-3);
+}
+
+// The exact polygons against finely sampled cells: samples off by one
+// along the border of a cell make up the difference.
+void testAnalytic(bool masked) {
+  const auto density = testDensity(masked);
+  const StippleSet sites = randomSites(200);
+  AnalyticCellEngine engine(density);
+  const CellResult result = engine.compute(sites.view(), CellQuery());
+  checkCells(result.cells, referenceCells(*density, sites.view(), 8, true),
+             0.02, 0.5, 0.05);
+}
+
+// Two workers on loopback and one that cannot be reached.
+std::vector<std::string> startWorkers() {
+  std::vector<std::string> workers;
+  for (int i = 0; i < 2; ++i) {
+    std::shared_ptr<Listener> listener = Listener::open(0);
+    CHECK(listener != nullptr);
+    if (!listener) return {};
+    workers.push_back("localhost:" + std::to_string(listener->port()));
+    std::thread([listener] { serveStrips(*listener); }).detach();
+  }
+  workers.push_back("localhost:1");
+  return workers;
+}
+
+// The distributed engine, with the strip of the unreachable worker
+// computed locally, against the CPU engine on the whole map. With
+// supersampling, samples next to the strip borders interpolate with the
+// halo rows.
+void testDistributed(bool masked, int superSampling) {
+  const std::vector<std::string> workers = startWorkers();
+  if (workers.empty()) return;
+
+  const auto density = testDensity(masked);
+  const StippleSet sites = randomSites(200);
+  DistributedCellEngine engine(density, superSampling, workers);
+  FusedCellEngine local(density, superSampling);
+  // the second compute reuses the strips sent by the first
+  for (int run = 0; run < 2; ++run) {
+    const CellResult result = engine.compute(sites.view(), CellQuery());
+    const CellResult expected = local.compute(sites.view(), CellQuery());
+    CHECK(result.cells.size() == expected.cells.size());
+    for (size_t i = 0; i < result.cells.size(); ++i) {
+      const VoronoiCell& cell = result.cells[i];
+      const VoronoiCell& reference = expected.cells[i];
+      CHECK_NEAR(cell.area, reference.area, 1e-3);
+      CHECK_NEAR(cell.sumDensity, reference.sumDensity,
+                 1e-4 * reference.sumDensity + 1e-4);
+      if (reference.area < 4.0f) continue;
+      CHECK_NEAR(cell.centroid.x() * Width, reference.centroid.x() * Width,
+                 1e-3);
+      CHECK_NEAR(cell.centroid.y() * Height, reference.centroid.y() * Height,
+                 1e-3);
+      CHECK_NEAR(cell.orientation, reference.orientation, 1e-3);
+    }
+  }
+}
+
+// Owners of the samples of a width x height image, decided like the CPU
+// engine does: by float distances with ties broken in double, then by the
+// lower index.
+IndexMap nearestOwners(const StippleView& sites, int width, int height,
+                       int superSampling) {
+  const SiteGrid grid(sites, width, height, 32.0f);
+  IndexMap map(width * superSampling, height * superSampling,
+               static_cast<int32_t>(sites.size()));
+  std::vector<uint32_t> candidates;
+  const float step = 1.0f / superSampling;
+  for (int y = 0; y < height * superSampling; ++y)
+    for (int x = 0; x < width * superSampling; ++x) {
+      const float px = (x + 0.5f) * step;
+      const float py = (y + 0.5f) * step;
+      float d0 = 0.0f;
+      grid.nearest(px, py, d0);
+      candidates.clear();
+      grid.gather(px, py, d0 + 1.0f, candidates);
+      uint32_t owner = 0;
+      float best = std::numeric_limits<float>::max();
+      double bestDouble = std::numeric_limits<double>::max();
+      for (const uint32_t s : candidates) {
+        const float dx = grid.x(s) - px;
+        const float dy = grid.y(s) - py;
+        const float d = dx * dx + dy * dy;
+        const double ddx = double(grid.x(s)) - px;
+        const double ddy = double(grid.y(s)) - py;
+        const double dd = ddx * ddx + ddy * ddy;
+        if (d < best || (d == best && (dd < bestDouble ||
+                                       (dd == bestDouble && s < owner)))) {
+          best = d;
+          bestDouble = dd;
+          owner = s;
+        }
+      }
+      map.set(x, y, owner);
+    }
+  return map;
+}
+
+using Pairs = std::vector<std::pair<uint32_t, uint32_t>>;
+
+// Frozen cells of `engine` border the non-frozen ones as in `borders`, are
+// complete on such a border and skipped otherwise.
+void checkFrozen(CellEngine& engine, const StippleView& sites,
+                 const std::vector<uint8_t>& frozen, const Pairs& borders) {
+  CellQuery query;
+  query.frozen = &frozen;
+  const CellResult result = engine.compute(sites, query);
+  const CellResult complete = engine.compute(sites, CellQuery());
+  CHECK(!borders.empty());
+  CHECK(result.frozenBorders == borders);
+  std::vector<uint8_t> skipped = frozen;
+  for (const auto& border : borders) skipped[border.first] = 0;
+  CHECK(result.skipped == skipped);
+  for (size_t i = 0; i < sites.size() && i < result.cells.size(); ++i) {
+    const VoronoiCell& cell = result.cells[i];
+    if (skipped[i]) {
+      CHECK(cell.area == 0.0f);
+      continue;
+    }
+    const VoronoiCell& reference = complete.cells[i];
+    CHECK_NEAR(cell.area, reference.area, 1e-3);
+    CHECK_NEAR(cell.sumDensity, reference.sumDensity,
+               1e-4 * reference.sumDensity + 1e-4);
+    CHECK_NEAR(cell.centroid.x() * Width, reference.centroid.x() * Width,
+               1e-3);
+    CHECK_NEAR(cell.centroid.y() * Height, reference.centroid.y() * Height,
+               1e-3);
+  }
+}
+
+// Cells left of 0.6 are frozen. Among random sites one amid them is not,
+// its neighbours border it. A coarse lattice of frozen sites next to dense
+// random ones leaves tiles, sized for the dense sites, within frozen cells
+// that border non-frozen ones far from there. Two rows of sites around the
+// first row of the second strip of the distributed engine, the upper one
+// frozen, only border along that row. The CPU and the distributed engine
+// have to find the borders of the nearest sites of the samples. The analytic
+// engine, which ignores supersampling, finds them along the edges of its
+// polygons, as it does its neighbours.
+void testFrozen(bool masked, int superSampling) {
+  const auto density = testDensity(masked);
+  const std::vector<std::string> workers = startWorkers();
+
+  const StippleSet random = randomSites(1000);
+  StippleSet mixed;
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<float> jitter(-0.01f, 0.01f);
+  for (int j = 0; j < 4; ++j)
+    for (int i = 0; i < 5; ++i)
+      mixed.push_back(QVector2D((i + 0.5f) * 0.12f + jitter(gen),
+                                (j + 0.5f) * 0.25f + jitter(gen)),
+                      1.0f);
+  for (size_t i = 0; i < random.size(); ++i)
+    if (random.pos(i).x() > 0.62f) mixed.push_back(random.pos(i), 1.0f);
+  // three strips, as many as workers
+  const QRect bounds = density->bounds();
+  const float seam = bounds.top() + bounds.height() / 3;
+  StippleSet rows;
+  for (int i = 0; i < Width / 10; ++i)
+    for (const float dy : {-5.0f, 5.0f})
+      rows.push_back(QVector2D((i * 10 + 5.0f) / Width, (seam + dy) / Height),
+                     1.0f);
+
+  const StippleSet* layouts[] = {&random, &mixed, &rows};
+  for (const StippleSet* sites : layouts) {
+    const StippleView view = sites->view();
+    std::vector<uint8_t> frozen(view.size());
+    size_t amid = 0;
+    for (size_t i = 0; i < view.size(); ++i) {
+      frozen[i] = sites == &rows ? view.y()[i] * Height < seam
+                                 : view.x()[i] < 0.6f;
+      if (std::hypot(view.x()[i] - 0.3f, view.y()[i] - 0.6f) <
+          std::hypot(view.x()[amid] - 0.3f, view.y()[amid] - 0.6f))
+        amid = i;
+    }
+    if (sites == &random) frozen[amid] = 0;
+
+    const int ss = superSampling;
+    const IndexMap owners = nearestOwners(view, Width, Height, ss);
+    Pairs pairs;
+    auto pair = [&](int x, int y, int nx, int ny) {
+      if (nx >= owners.width || ny >= owners.height ||
+          !density->inside(nx / ss, ny / ss))
+        return;
+      const uint32_t a = owners.get(x, y);
+      const uint32_t b = owners.get(nx, ny);
+      if (a != b) pairs.emplace_back(std::min(a, b), std::max(a, b));
+    };
+    for (int y = 0; y < owners.height; ++y)
+      for (int x = 0; x < owners.width; ++x) {
+        if (!density->inside(x / ss, y / ss)) continue;
+        pair(x, y, x + 1, y);
+        pair(x, y, x, y + 1);
+      }
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+    const Pairs borders = findFrozenBorders(pairs, frozen);
+
+    FusedCellEngine fused(density, ss);
+    checkFrozen(fused, view, frozen, borders);
+    DistributedCellEngine distributed(density, ss, workers);
+    checkFrozen(distributed, view, frozen, borders);
+
+    if (ss > 1) continue;
+    AnalyticCellEngine analytic(density);
+    CellQuery query;
+    query.adjacency = true;
+    checkFrozen(analytic, view, frozen,
+                findFrozenBorders(analytic.compute(view, query).adjacency,
+                                  frozen));
+  }
+}
+
+// A run freezes cells only once they were stable for freezeIterations
+// iterations. With a constant hysteresis a few cells keep splitting and
+// merging, and the frozen cells next to them thaw: frozen cells are never
+// merged, their count only drops when some thaw. Every engine but the GPU
+// one, each ending up with about as many stipples as without freezing.
+void testFreezing() {
+  QImage image(Width, Height, QImage::Format_Grayscale8);
+  for (int y = 0; y < Height; ++y)
+    for (int x = 0; x < Width; ++x)
+      image.scanLine(y)[x] = static_cast<uint8_t>(x * 255 / Width);
+  LBGStippling::Params params;
+  params.initialPoints = 100;
+  params.initialPointSize = 4.0f;
+  params.hysteresis = 0.5f;
+  params.hysteresisDelta = 0.0f;
+  params.maxIterations = 40;
+  params.seed = 9;
+  for (const CellEngineType engine :
+       {CellEngineType::CPU, CellEngineType::Analytic,
+        CellEngineType::Distributed}) {
+    params.engine = engine;
+    std::vector<LBGStippling::Status> statuses;
+    LBGStippling stippling;
+    stippling.setStatusCallback([&](const LBGStippling::Status& status) {
+      statuses.push_back(status);
+    });
+    params.freezeIterations = 0;
+    const size_t unfrozen = stippling.stipple(image, params).size();
+    statuses.clear();
+    params.freezeIterations = 2;
+    const size_t count = stippling.stipple(image, params).size();
+
+    bool froze = false;
+    bool thawed = false;
+    for (size_t i = 0; i < statuses.size(); ++i) {
+      if (i < params.freezeIterations) CHECK(statuses[i].frozen == 0);
+      froze = froze || statuses[i].frozen > 0;
+      thawed = thawed ||
+               (i > 0 && statuses[i].frozen < statuses[i - 1].frozen);
+    }
+    CHECK(froze);
+    CHECK(thawed);
+    CHECK_NEAR(double(count), double(unfrozen), 0.05 * unfrozen);
+  }
+}
+
+// White inside the mask is as empty as white without one, and only pixels
+// inside the mask count.
+void testMaskedWhite() {
+  QImage image(Width, Height, QImage::Format_Grayscale8);
+  image.fill(255);
+  QImage mask(Width, Height, QImage::Format_Grayscale8);
+  for (int y = 0; y < Height; ++y)
+    for (int x = 0; x < Width; ++x)
+      mask.scanLine(y)[x] = x < Width / 2 ? 255 : 0;
+  const DensityMap plain(image);
+  const auto masked = plain.masked(mask);
+  CHECK(masked->inside(0, 0) && !masked->inside(Width - 1, 0));
+  CHECK(masked->at(0, 0) == plain.at(0, 0));
+  CHECK(masked->sample(Width - 1.5f, 5.0f) == 0.0f);
+  CHECK(masked->area() == size_t(Width / 2) * Height);
+  CHECK_NEAR(masked->total(), plain.total() / 2, 1e-6 * plain.total());
+}
+
+// Moments about the sites keep float precision far from the origin. A map
+// 16000 pixels wide with cells stretched along x, sampled twice per pixel,
+// against centroids and orientations accumulated in double: the CPU engine
+// and accumulateCells on the index map of the same cells. With absolute
+// coordinates, centroids were off by 0.17 px and orientations by up to
+// pi / 2.
+void testPrecision() {
+  const int width = 16000;
+  const int height = 64;
+  const int superSampling = 2;
+  QImage image(width, height, QImage::Format_Grayscale8);
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x)
+      image.scanLine(y)[x] = static_cast<uint8_t>(40 + (x * 7 + y * 13) % 180);
+  const auto density = std::make_shared<const DensityMap>(image);
+
+  // jittered lattice of 32 x 16 px cells
+  std::mt19937 gen(5);
+  std::uniform_real_distribution<float> jitter(-3.0f, 3.0f);
+  StippleSet sites;
+  for (int j = 0; j < height / 16; ++j)
+    for (int i = 0; i < width / 32; ++i)
+      sites.push_back(QVector2D((i * 32 + 16 + jitter(gen)) / width,
+                                (j * 16 + 8 + jitter(gen)) / height),
+                      1.0f);
+  const StippleView view = sites.view();
+
+  // It is the moments that are under test here, not the nearest site
+  // search. Moments are summed about the centroids in double.
+  const IndexMap map = nearestOwners(view, width, height, superSampling);
+  std::vector<double> m00(view.size()), m10(view.size()), m01(view.size());
+  const double step = 1.0 / superSampling;
+  for (int y = 0; y < height * superSampling; ++y)
+    for (int x = 0; x < width * superSampling; ++x) {
+      const uint32_t owner = map.get(x, y);
+      const float px = (x + 0.5f) * float(step);
+      const float py = (y + 0.5f) * float(step);
+      const double weight = density->sample(px, py);
+      m00[owner] += weight;
+      m10[owner] += px * weight;
+      m01[owner] += py * weight;
+    }
+  std::vector<double> m20(view.size()), m11(view.size()), m02(view.size());
+  for (int y = 0; y < height * superSampling; ++y)
+    for (int x = 0; x < width * superSampling; ++x) {
+      const uint32_t owner = map.get(x, y);
+      const double sx = (x + 0.5) * step;
+      const double sy = (y + 0.5) * step;
+      const double weight = density->sample(float(sx), float(sy));
+      const double px = sx - m10[owner] / m00[owner];
+      const double py = sy - m01[owner] / m00[owner];
+      m20[owner] += px * px * weight;
+      m11[owner] += px * py * weight;
+      m02[owner] += py * py * weight;
+    }
+
+  const CellResult fused =
+      FusedCellEngine(density, superSampling).compute(view, CellQuery());
+  const std::vector<VoronoiCell> accumulated =
+      accumulateCells(map, *density, view, superSampling);
+  for (const std::vector<VoronoiCell>* cells : {&fused.cells, &accumulated}) {
+    CHECK(cells->size() == view.size());
+    for (size_t i = 0; i < cells->size() && i < view.size(); ++i) {
+      const VoronoiCell& cell = (*cells)[i];
+      // the resolution of normalized float centroids is about 1e-3 px
+      CHECK_NEAR(cell.centroid.x() * width, m10[i] / m00[i], 5e-3);
+      CHECK_NEAR(cell.centroid.y() * height, m01[i] / m00[i], 5e-3);
+      const double orientation =
+          std::atan2(2.0 * m11[i], m20[i] - m02[i]) / 2.0;
+      CHECK_NEAR(cell.orientation, orientation, 1e-3);
+    }
+  }
+}
+
+// Neighbours of three sites on a uniform map: in a row only the middle one
+// borders the others, in a triangle all of them border each other. Every
+// engine but the GPU one, which needs an OpenGL context.
+void testNeighbours() {
+  QImage image(Width, Height, QImage::Format_Grayscale8);
+  image.fill(128);
+  const auto density = std::make_shared<const DensityMap>(image);
+  const struct {
+    float x[3];
+    float y[3];
+    Pairs pairs;
+  } layouts[] = {
+      {{0.25f, 0.5f, 0.75f}, {0.5f, 0.5f, 0.5f}, {{0, 1}, {1, 2}}},
+      {{0.3f, 0.7f, 0.5f}, {0.3f, 0.3f, 0.7f}, {{0, 1}, {0, 2}, {1, 2}}},
+  };
+
+  CellQuery query;
+  query.adjacency = true;
+  for (const auto& layout : layouts) {
+    StippleSet sites;
+    for (int i = 0; i < 3; ++i)
+      sites.push_back(QVector2D(layout.x[i], layout.y[i]), 1.0f);
+    for (const CellEngineType engine :
+         {CellEngineType::CPU, CellEngineType::Analytic,
+          CellEngineType::Distributed}) {
+      for (const int superSampling : {1, 2}) {
+        CHECK(createCellEngine(engine, density, superSampling)
+                  ->compute(sites.view(), query)
+                  .adjacency == layout.pairs);
+      }
+    }
+  }
+}
+
+// The graph a run returns: the neighbours of the cells of its last
+// iteration when that is the last by maxIterations, else those of the
+// cells of its final stipples. Where the last iteration neither split nor
+// merged, its cells are those of the stipples the run before ended with.
+void testGraph() {
+  const auto density = testDensity(false);
+  LBGStippling::Params params;
+  params.initialPoints = 20;
+  params.initialPointSize = 4.0f;
+  params.maxIterations = 100;
+  params.seed = 4;
+  CellQuery query;
+  query.adjacency = true;
+  for (const CellEngineType engine :
+       {CellEngineType::CPU, CellEngineType::Analytic}) {
+    params.engine = engine;
+    std::vector<LBGStippling::Status> statuses;
+    LBGStippling stippling;
+    stippling.setStatusCallback([&](const LBGStippling::Status& status) {
+      statuses.push_back(status);
+    });
+
+    // stopped early, by the lack of splits and merges
+    LBGStippling::Graph graph;
+    const StippleSet converged = stippling.stipple(density, params, &graph);
+    const size_t iterations = statuses.size();
+    CHECK(iterations < params.maxIterations);
+    CHECK(!graph.empty());
+    CHECK(graph == createCellEngine(engine, density)
+                       ->compute(converged.view(), query)
+                       .adjacency);
+
+    // the same run, stopped by maxIterations in its converged iteration
+    params.maxIterations = iterations;
+    const StippleSet last = stippling.stipple(density, params, &graph);
+    CHECK(last.size() == converged.size());
+    params.maxIterations = iterations - 1;
+    const StippleSet before = stippling.stipple(density, params);
+    CHECK(before.size() == last.size());
+    CHECK(graph == createCellEngine(engine, density)
+                       ->compute(before.view(), query)
+                       .adjacency);
+
+    // stopped while cells still split: sorted pairs of the final stipples,
+    // every one of which has a neighbour
+    statuses.clear();
+    params.maxIterations = 3;
+    const StippleSet splitting = stippling.stipple(density, params, &graph);
+    CHECK(!statuses.empty() && statuses.back().splits > 0);
+    CHECK(std::is_sorted(graph.begin(), graph.end()));
+    CHECK(std::adjacent_find(graph.begin(), graph.end()) == graph.end());
+    std::vector<uint8_t> bordered(splitting.size(), 0);
+    for (const auto& [i, j] : graph) {
+      CHECK(i < j && j < splitting.size());
+      if (j < splitting.size()) bordered[i] = bordered[j] = 1;
+    }
+    CHECK(std::count(bordered.begin(), bordered.end(), 0) == 0);
+    params.maxIterations = 100;
+  }
+}
+
+// Bitwise equality of two sets of cells.
+bool sameCells(const std::vector<VoronoiCell>& a,
+               const std::vector<VoronoiCell>& b) {
+  return a.size() == b.size() &&
+         std::memcmp(a.data(), b.data(), a.size() * sizeof(VoronoiCell)) == 0;
+}
+
+// Cells and seeded runs come out bit for bit the same on any number of
+// threads, whichever thread takes which tile.
+void testThreads() {
+  const auto density = testDensity(true);
+  const StippleSet sites = randomSites(500);
+  const IndexMap owners = nearestOwners(sites.view(), Width, Height, 2);
+  LBGStippling::Params params;
+  params.engine = CellEngineType::CPU;
+  params.initialPoints = 50;
+  params.initialPointSize = 2.0f;
+  params.maxIterations = 10;
+  params.seed = 2;
+
+  const int threads = omp_get_max_threads();
+  std::vector<VoronoiCell> fused;
+  std::vector<VoronoiCell> accumulated;
+  StippleSet stipples;
+  for (const int count : {1, 2, 5}) {
+    omp_set_num_threads(count);
+    const CellResult result =
+        FusedCellEngine(density, 2).compute(sites.view(), CellQuery());
+    const std::vector<VoronoiCell> cells =
+        accumulateCells(owners, *density, sites.view(), 2);
+    const StippleSet run = LBGStippling().stipple(density, params);
+    if (count == 1) {
+      fused = result.cells;
+      accumulated = cells;
+      stipples = run;
+      continue;
+    }
+    CHECK(sameCells(result.cells, fused));
+    CHECK(sameCells(cells, accumulated));
+    const StippleView a = run.view();
+    const StippleView b = stipples.view();
+    CHECK(a.size() == b.size() && std::equal(a.x(), a.x() + a.size(), b.x()) &&
+          std::equal(a.y(), a.y() + a.size(), b.y()));
+  }
+  omp_set_num_threads(threads);
+}
+
+}  // namespace
+
+int main() {
+  testMaskedWhite();
+  testPrecision();
+  testNeighbours();
+  testGraph();
+  testThreads();
+  testFreezing();
+  for (const bool masked : {false, true}) {
+    testFrozen(masked, 1);
+    testFrozen(masked, 2);
+    testFused(masked, 1);
+    testFused(masked, 2);
+    testAnalytic(masked);
+    testDistributed(masked, 1);
+    testDistributed(masked, 2);
+  }
+  return testResult();
+}
@@ -0,0 +1,40 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cmath>
+#include <cstdio>
+
+// Minimal checks for the test programs. A failed check is reported and the
+// test carries on, main() returns testResult().
+inline int& testFailures() {
+  static int failures = 0;
+  return failures;
+}
+
+#define CHECK(condition)                                                \
+  do {                                                                  \
+    if (!(condition)) {                                                 \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__,       \
+                   __LINE__, #condition);                               \
+      ++testFailures();                                                 \
+    }                                                                   \
+  } while (0)
+
+#define CHECK_NEAR(actual, expected, tolerance)                         \
+  do {                                                                  \
+    const double a_ = (actual), e_ = (expected);                        \
+    if (!(std::abs(a_ - e_) <= (tolerance))) {                          \
+      std::fprintf(stderr, "%s:%d: %s = %g, expected %g +- %g\n",       \
+                   __FILE__, __LINE__, #actual, a_, e_,                 \
+                   static_cast<double>(tolerance));                     \
+      ++testFailures();                                                 \
+    }                                                                   \
+  } while (0)
+
+inline int testResult() {
+  if (testFailures() > 0)
+    std::fprintf(stderr, "%d check(s) failed\n", testFailures());
+  return testFailures() > 0 ? 1 : 0;
+}
+
+#endif  // CHECK_H
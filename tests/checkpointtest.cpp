@@ -0,0 +1,68 @@
+// Checkpoints written and read back, and the damaged ones a resume refuses.
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "check.h"
+#include "checkpoint.h"
+
+namespace {
+
+Checkpoint testCheckpoint(size_t count) {
+  Checkpoint checkpoint;
+  checkpoint.key = 7;
+  checkpoint.random = "generator state";
+  for (size_t i = 0; i < count; ++i) {
+    checkpoint.stipples.push_back(QVector2D(0.01f * i, 0.02f * i), 2.0f);
+    checkpoint.stableIterations.push_back(static_cast<uint8_t>(i));
+    checkpoint.cells.push_back(VoronoiCell{});
+  }
+  return checkpoint;
+}
+
+}  // namespace
+
+int main() {
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "lbgcheckpointtest").string();
+
+  const Checkpoint expected = testCheckpoint(10);
+  CHECK(expected.write(path));
+  Checkpoint loaded;
+  CHECK(loaded.read(path));
+  CHECK(loaded.key == expected.key && loaded.random == expected.random);
+  CHECK(loaded.stipples.size() == 10 && loaded.stableIterations.size() == 10);
+
+  // the arrays have to match the modes of the run that resumes
+  LBGStippling::Params params;
+  CHECK(!loaded.fits(params));
+  params.freezeIterations = 3;
+  CHECK(loaded.fits(params));
+  params.coneRadiusFactor = 2.0f;
+  CHECK(!loaded.fits(params));
+
+  // a count beyond the end of the file
+  const auto size = std::filesystem::file_size(path);
+  {
+    std::fstream stream(path, std::ios::in | std::ios::out | std::ios::binary);
+    const uint64_t count = uint64_t(1) << 62;
+    stream.seekp(size - expected.random.size() - sizeof(count));
+    stream.write(reinterpret_cast<const char*>(&count), sizeof(count));
+  }
+  CHECK(!loaded.read(path));
+
+  // per-stipple arrays of another length
+  Checkpoint shorter = testCheckpoint(10);
+  shorter.stableIterations.resize(9);
+  shorter.cells.resize(9);
+  CHECK(shorter.write(path));
+  CHECK(!loaded.read(path));
+  Checkpoint radii = testCheckpoint(10);
+  radii.radii.resize(4, 1.0f);
+  CHECK(radii.write(path));
+  CHECK(!loaded.read(path));
+
+  std::filesystem::remove(path);
+  return testResult();
+}
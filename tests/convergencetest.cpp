@@ -0,0 +1,136 @@
+// The convergence criteria and the time budget: each ends a run on its
+// own, and converged() only holds once every enabled criterion does.
+
+#include <QImage>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "check.h"
+#include "lbgstippling.h"
+
+namespace {
+
+using Params = LBGStippling::Params;
+using Status = LBGStippling::Status;
+
+// radial gradient, dark in the center
+QImage testImage() {
+  const int width = 200, height = 160;
+  QImage image(width, height, QImage::Format_Grayscale8);
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x) {
+      const float dx = x - 100.0f, dy = y - 80.0f;
+      image.scanLine(y)[x] = static_cast<uint8_t>(
+          std::min(255.0f, 2.0f * std::sqrt(dx * dx + dy * dy)));
+    }
+  return image;
+}
+
+Params baseParams() {
+  Params params;
+  params.engine = CellEngineType::CPU;
+  params.initialPoints = 50;
+  params.initialPointSize = 3.0f;
+  params.maxIterations = 200;
+  params.seed = 5;
+  return params;
+}
+
+std::vector<Status> run(const QImage& image, const Params& params) {
+  std::vector<Status> statuses;
+  LBGStippling engine;
+  engine.setStatusCallback(
+      [&](const Status& status) { statuses.push_back(status); });
+  engine.stipple(image, params);
+  return statuses;
+}
+
+void testConverged() {
+  Status status{};
+  status.pointChange = 0.01f;
+  status.meanDisplacement = 0.2f;
+  status.maxDisplacement = 1.0f;
+  status.stableFraction = 0.9f;
+
+  // nothing enabled never converges
+  Params params;
+  CHECK(!LBGStippling::converged(status, params));
+
+  // every criterion alone, met and missed
+  params.minPointChange = 0.02f;
+  CHECK(LBGStippling::converged(status, params));
+  params.minPointChange = 0.005f;
+  CHECK(!LBGStippling::converged(status, params));
+
+  params = Params();
+  params.maxMeanDisplacement = 0.3f;
+  CHECK(LBGStippling::converged(status, params));
+  params.maxMeanDisplacement = 0.1f;
+  CHECK(!LBGStippling::converged(status, params));
+
+  params = Params();
+  params.maxMaxDisplacement = 2.0f;
+  CHECK(LBGStippling::converged(status, params));
+  params.maxMaxDisplacement = 0.5f;
+  CHECK(!LBGStippling::converged(status, params));
+
+  params = Params();
+  params.minStableFraction = 0.8f;
+  CHECK(LBGStippling::converged(status, params));
+  params.minStableFraction = 0.95f;
+  CHECK(!LBGStippling::converged(status, params));
+
+  // all enabled criteria have to hold
+  params.minPointChange = 0.02f;
+  params.minStableFraction = 0.95f;
+  CHECK(!LBGStippling::converged(status, params));
+  params.minStableFraction = 0.8f;
+  CHECK(LBGStippling::converged(status, params));
+
+  // the first iteration has no previous one to compare with
+  CHECK(!LBGStippling::converged(Status{}, params));
+}
+
+// Each criterion ends a run that would go on without it: the last
+// iteration still splits or merges, and the criterion holds there and
+// not before.
+void testEndsRun(const QImage& image, void (*enable)(Params&)) {
+  Params params = baseParams();
+  const std::vector<Status> reference = run(image, params);
+  enable(params);
+  const std::vector<Status> statuses = run(image, params);
+  CHECK(!statuses.empty());
+  if (statuses.empty()) return;
+  CHECK(statuses.size() < reference.size());
+  const Status& last = statuses.back();
+  CHECK(last.splits + last.merges > 0);
+  CHECK(LBGStippling::converged(last, params));
+  for (size_t i = 0; i + 1 < statuses.size(); ++i)
+    CHECK(!LBGStippling::converged(statuses[i], params));
+}
+
+void testTimeBudget(const QImage& image) {
+  Params params = baseParams();
+  // any iteration exceeds a microsecond
+  params.timeBudget = 1e-6f;
+  const std::vector<Status> statuses = run(image, params);
+  CHECK(statuses.size() == 1);
+  CHECK(!statuses.empty() && statuses.back().elapsed >= params.timeBudget);
+}
+
+}  // namespace
+
+int main() {
+  testConverged();
+  const QImage image = testImage();
+  testEndsRun(image, [](Params& params) { params.minPointChange = 0.02f; });
+  testEndsRun(image,
+              [](Params& params) { params.maxMeanDisplacement = 0.3f; });
+  testEndsRun(image, [](Params& params) { params.maxMaxDisplacement = 2.0f; });
+  testEndsRun(image, [](Params& params) { params.minStableFraction = 0.7f; });
+  testTimeBudget(image);
+  return testResult();
+}
@@ -0,0 +1,104 @@
+// Density maps stored on disk by DensityCache, and what a later process
+// accepts of them.
+
+#include <QImage>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "check.h"
+#include "densitycache.h"
+
+namespace {
+
+QImage testImage(int width, int height) {
+  QImage image(width, height, QImage::Format_Grayscale8);
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x)
+      image.scanLine(y)[x] = static_cast<uint8_t>(x * 7 ^ y * 3);
+  return image;
+}
+
+bool samePixels(const DensityMap& a, const DensityMap& b) {
+  if (a.width() != b.width() || a.height() != b.height()) return false;
+  return std::equal(a.gray().begin(), a.gray().end(), b.gray().begin());
+}
+
+// The only file in `directory`.
+std::filesystem::path storedFile(const std::filesystem::path& directory) {
+  std::filesystem::path path;
+  for (const auto& entry : std::filesystem::directory_iterator(directory))
+    path = entry.path();
+  return path;
+}
+
+}  // namespace
+
+int main() {
+  const std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "lbgdensitycachetest";
+  std::filesystem::remove_all(directory);
+  const QString path = QString::fromStdString(directory.string());
+
+  const QImage image = testImage(50, 40);
+  DensityTransform transform;
+  const DensityMap expected(image, transform);
+
+  {
+    DensityCache cache;
+    cache.setDirectory(path);
+    const auto map = cache.get(image, transform);
+    CHECK(map && samePixels(*map, expected));
+  }
+  const std::filesystem::path file = storedFile(directory);
+  CHECK(!file.empty());
+  const auto fileSize = std::filesystem::file_size(file);
+
+  // another process picks the plane up from disk
+  {
+    DensityCache cache;
+    cache.setDirectory(path);
+    const auto map = cache.get(image, transform);
+    CHECK(map && samePixels(*map, expected));
+  }
+
+  // a truncated plane is not taken, the map is built again and stored
+  std::filesystem::resize_file(file, fileSize - 10);
+  {
+    DensityCache cache;
+    cache.setDirectory(path);
+    const auto map = cache.get(image, transform);
+    CHECK(map && samePixels(*map, expected));
+  }
+  CHECK(std::filesystem::file_size(file) == fileSize);
+
+  // neither is a plane of another size, even if the file is consistent
+  {
+    std::fstream stream(file, std::ios::in | std::ios::out | std::ios::binary);
+    const int32_t size[2] = {40, 50};
+    stream.seekp(8);
+    stream.write(reinterpret_cast<const char*>(size), sizeof(size));
+  }
+  {
+    DensityCache cache;
+    cache.setDirectory(path);
+    const auto map = cache.get(image, transform);
+    CHECK(map && samePixels(*map, expected));
+  }
+
+  // the same pixels with another transform are another map
+  transform.gamma = 2.0f;
+  {
+    DensityCache cache;
+    cache.setDirectory(path);
+    const auto map = cache.get(image, transform);
+    CHECK(map && samePixels(*map, DensityMap(image, transform)));
+    CHECK(map && !samePixels(*map, expected));
+  }
+
+  std::filesystem::remove_all(directory);
+  return testResult();
+}
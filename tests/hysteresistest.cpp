@@ -0,0 +1,99 @@
+// The adaptive hysteresis schedule: it holds its value while splits grow
+// the point count and widens by growing steps while splits and merges
+// oscillate.
+
+#include "check.h"
+#include "checkpoint.h"
+#include "hysteresis.h"
+
+namespace {
+
+using Params = LBGStippling::Params;
+using Status = LBGStippling::Status;
+
+Status iteration(size_t index, size_t size, size_t splits, size_t merges) {
+  Status status{};
+  status.iteration = index;
+  status.size = size;
+  status.splits = splits;
+  status.merges = merges;
+  status.pointChange = static_cast<float>(splits + merges) / size;
+  return status;
+}
+
+Params scheduleParams() {
+  Params params;
+  params.hysteresis = 0.6f;
+  params.hysteresisDelta = 0.01f;
+  params.hysteresisSchedule = HysteresisSchedule::Adaptive;
+  return params;
+}
+
+void testHoldsWhileGrowing() {
+  const Params params = scheduleParams();
+  AdaptiveHysteresis hysteresis(params);
+  CHECK(hysteresis.next(iteration(0, 100, 0, 0)) == params.hysteresis);
+  // the count doubles, then grows by 20%, with some merges on the way
+  size_t size = 100;
+  for (size_t i = 1; i < 8; ++i) {
+    const size_t splits = i < 3 ? size : size / 4;
+    const size_t merges = i < 3 ? 0 : size / 20;
+    size += splits - merges;
+    CHECK(hysteresis.next(iteration(i, size, splits, merges)) ==
+          params.hysteresis);
+  }
+}
+
+void testWidensWhileOscillating() {
+  const Params params = scheduleParams();
+  const float delta = params.hysteresisDelta;
+  AdaptiveHysteresis hysteresis(params);
+  hysteresis.next(iteration(0, 1000, 0, 0));
+
+  // splits and merges that cancel add delta, then 2 delta, then 3 delta
+  CHECK_NEAR(hysteresis.next(iteration(1, 1000, 20, 20)), 0.6f + delta, 1e-6f);
+  CHECK_NEAR(hysteresis.next(iteration(2, 1000, 15, 14)), 0.6f + 3 * delta,
+             1e-6f);
+  CHECK_NEAR(hysteresis.next(iteration(3, 1000, 12, 10)), 0.6f + 6 * delta,
+             1e-6f);
+
+  // a trend (slow growth, no merges) holds the value and resets the step
+  CHECK_NEAR(hysteresis.next(iteration(4, 1010, 10, 0)), 0.6f + 6 * delta,
+             1e-6f);
+  CHECK_NEAR(hysteresis.next(iteration(5, 1020, 10, 0)), 0.6f + 6 * delta,
+             1e-6f);
+  // a net change that flips sign oscillates, although it does not cancel
+  CHECK_NEAR(hysteresis.next(iteration(6, 1010, 0, 10)), 0.6f + 7 * delta,
+             1e-6f);
+
+  // nothing left to split or merge holds the value
+  CHECK_NEAR(hysteresis.next(iteration(7, 1010, 0, 0)), 0.6f + 7 * delta,
+             1e-6f);
+}
+
+void testCheckpoint() {
+  const Params params = scheduleParams();
+  AdaptiveHysteresis hysteresis(params);
+  hysteresis.next(iteration(0, 1000, 0, 0));
+  hysteresis.next(iteration(1, 1000, 20, 20));
+  hysteresis.next(iteration(2, 1000, 20, 20));
+  Checkpoint checkpoint;
+  hysteresis.save(checkpoint);
+
+  // a resumed schedule carries on with the same step
+  AdaptiveHysteresis resumed(params);
+  resumed.restore(checkpoint);
+  const Status next = iteration(3, 1000, 20, 20);
+  CHECK(resumed.next(next) == hysteresis.next(next));
+  CHECK_NEAR(resumed.next(iteration(4, 1000, 20, 20)),
+             0.6f + 10 * params.hysteresisDelta, 1e-6f);
+}
+
+}  // namespace
+
+int main() {
+  testHoldsWhileGrowing();
+  testWidensWhileOscillating();
+  testCheckpoint();
+  return testResult();
+}
@@ -0,0 +1,154 @@
+// Pen plotter output: the tour of planPlotPath and the coordinates that
+// writePlot puts into G-code and HPGL files.
+
+#include <QSize>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "plotpath.h"
+#include "stippleexport.h"
+#include "stippleset.h"
+
+namespace {
+
+struct Point {
+  double x;
+  double y;
+};
+
+double length(const std::vector<float>& x, const std::vector<float>& y,
+              const std::vector<uint32_t>& order) {
+  double travel = 0.0;
+  double px = 0.0;
+  double py = 0.0;
+  for (const uint32_t i : order) {
+    travel += std::hypot(x[i] - px, y[i] - py);
+    px = x[i];
+    py = y[i];
+  }
+  return travel;
+}
+
+bool isPermutation(std::vector<uint32_t> order, size_t count) {
+  if (order.size() != count) return false;
+  std::sort(order.begin(), order.end());
+  for (size_t i = 0; i < count; ++i)
+    if (order[i] != i) return false;
+  return true;
+}
+
+// Improving the nearest neighbour tour never makes the pen travel longer.
+void testPlan() {
+  std::mt19937 gen(11);
+  std::uniform_real_distribution<float> dis(0.0f, 100.0f);
+  for (const size_t count : {0, 1, 2, 3, 10, 500, 5000}) {
+    std::vector<float> x(count);
+    std::vector<float> y(count);
+    for (size_t i = 0; i < count; ++i) {
+      x[i] = dis(gen);
+      y[i] = dis(gen);
+    }
+    for (const float timeBudget : {0.0f, 1.0f}) {
+      const PlotPath path = planPlotPath(x, y, timeBudget);
+      CHECK(isPermutation(path.order, count));
+      CHECK_NEAR(path.travel, length(x, y, path.order), 1e-6 * path.travel);
+      if (count < 3) continue;
+      CHECK(path.travel <= path.nearestTravel);
+      CHECK(path.nearestTravel <= path.initialTravel);
+      // random points leave 2-opt plenty to remove
+      if (timeBudget > 0.0f && count >= 500)
+        CHECK(path.travel < 0.95 * path.nearestTravel);
+    }
+  }
+}
+
+// Pen down positions of a G-code file, in mm.
+std::vector<Point> readGCode(const std::string& path) {
+  std::ifstream in(path);
+  std::vector<Point> points;
+  std::string line;
+  Point last = {0.0, 0.0};
+  while (std::getline(in, line)) {
+    double x = 0.0;
+    double y = 0.0;
+    double z = 0.0;
+    if (std::sscanf(line.c_str(), "G0 X%lf Y%lf", &x, &y) == 2)
+      last = {x, y};
+    else if (std::sscanf(line.c_str(), "G1 Z%lf", &z) == 1)
+      points.push_back(last);
+  }
+  return points;
+}
+
+// Pen down positions of an HPGL file, in plotter units.
+std::vector<Point> readHPGL(const std::string& path) {
+  std::ifstream in(path);
+  std::vector<Point> points;
+  std::string line;
+  while (std::getline(in, line)) {
+    long x = 0;
+    long y = 0;
+    // the pen up at the end moves without a PD
+    int end = 0;
+    if (std::sscanf(line.c_str(), "PU%ld,%ld;PD;%n", &x, &y, &end) == 2 &&
+        end > 0)
+      points.push_back({double(x), double(y)});
+  }
+  return points;
+}
+
+// Both formats give back the stipples in the planned order, scaled to the
+// plot width with y pointing up.
+void testRoundTrip() {
+  std::mt19937 gen(13);
+  std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+  StippleSet stipples;
+  for (int i = 0; i < 300; ++i) {
+    const float x = dis(gen);
+    stipples.push_back(QVector2D(x, dis(gen)), 2.0f);
+  }
+  const StippleView view = stipples.view();
+  const QSize size(400, 300);
+  PlotSettings settings;
+  settings.width = 200.0f;
+  settings.timeBudget = 0.5f;
+  const double height = 150.0;
+
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "lbgplotpathtest").string();
+  for (const PlotFormat format : {PlotFormat::GCode, PlotFormat::HPGL}) {
+    PlotPath plan;
+    CHECK(writePlot(path, format, view, size, settings, &plan));
+    CHECK(isPermutation(plan.order, view.size()));
+    const bool gcode = format == PlotFormat::GCode;
+    const std::vector<Point> points = gcode ? readGCode(path) : readHPGL(path);
+    // three decimals in G-code, 0.025 mm units in HPGL
+    const double unit = gcode ? 1.0 : 40.0;
+    const double tolerance = gcode ? 5e-4 + 1e-5 : 0.5 + 1e-3;
+    CHECK(points.size() == plan.order.size());
+    for (size_t k = 0; k < points.size() && k < plan.order.size(); ++k) {
+      const uint32_t i = plan.order[k];
+      CHECK_NEAR(points[k].x, view.x()[i] * settings.width * unit,
+                 tolerance);
+      CHECK_NEAR(points[k].y, (1.0f - view.y()[i]) * height * unit,
+                 tolerance);
+    }
+  }
+  std::filesystem::remove(path);
+}
+
+}  // namespace
+
+int main() {
+  testPlan();
+  testRoundTrip();
+  return testResult();
+}
@@ -0,0 +1,76 @@
+// Stipple sets stored on disk by ResultCache, and the files a later lookup
+// refuses.
+#include <QString>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+
+#include "check.h"
+#include "resultcache.h"
+
+namespace {
+
+StippleSet testStipples(size_t count) {
+  StippleSet stipples;
+  for (size_t i = 0; i < count; ++i)
+    stipples.push_back(QVector2D(0.001f * i, 1.0f - 0.001f * i), 1.0f + i);
+  return stipples;
+}
+
+bool sameStipples(const StippleSet& a, const StippleSet& b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); ++i)
+    if (a.pos(i) != b.pos(i) || a[i].size != b[i].size) return false;
+  return true;
+}
+
+// The only file in `directory`.
+std::filesystem::path storedFile(const std::filesystem::path& directory) {
+  std::filesystem::path path;
+  for (const auto& entry : std::filesystem::directory_iterator(directory))
+    path = entry.path();
+  return path;
+}
+
+void writeCount(const std::filesystem::path& file, uint64_t count) {
+  std::fstream stream(file, std::ios::in | std::ios::out | std::ios::binary);
+  stream.seekp(8);
+  stream.write(reinterpret_cast<const char*>(&count), sizeof(count));
+}
+
+}  // namespace
+
+int main() {
+  const std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "lbgresultcachetest";
+  std::filesystem::remove_all(directory);
+  ResultCache cache(QString::fromStdString(directory.string()));
+
+  const uint64_t key = 42;
+  const StippleSet expected = testStipples(100);
+  cache.store(key, expected.view());
+  StippleSet loaded;
+  CHECK(cache.load(key, loaded) && sameStipples(loaded, expected));
+  const std::filesystem::path file = storedFile(directory);
+  CHECK(!file.empty());
+
+  // a count past the end of the file is refused before anything is
+  // allocated for it
+  writeCount(file, uint64_t(1) << 60);
+  CHECK(!cache.load(key, loaded));
+  writeCount(file, 101);
+  CHECK(!cache.load(key, loaded));
+  // and so are trailing bytes
+  writeCount(file, 99);
+  CHECK(!cache.load(key, loaded));
+
+  writeCount(file, 100);
+  CHECK(cache.load(key, loaded) && sameStipples(loaded, expected));
+  std::filesystem::resize_file(file, std::filesystem::file_size(file) - 4);
+  CHECK(!cache.load(key, loaded));
+  CHECK(cache.hits() == 2 && cache.misses() == 4);
+
+  std::filesystem::remove_all(directory);
+  return testResult();
+}
@@ -0,0 +1,133 @@
+// StippleSet and StippleView, and the order of the stipples a run hands out
+// after splitting and merging cells.
+
+#include <QImage>
+
+#include <cstdint>
+#include <vector>
+
+#include "check.h"
+#include "lbgstippling.h"
+#include "stippleset.h"
+
+namespace {
+
+void testPushBack() {
+  StippleSet set;
+  CHECK(set.empty());
+  set.reserve(4);
+  for (int i = 0; i < 4; ++i)
+    set.push_back(QVector2D(0.1f * i, 0.2f * i), 1.0f + i,
+                  i % 2 ? StippleTag::Split : StippleTag::Kept);
+  CHECK(set.size() == 4);
+
+  const StippleView view = set.view();
+  CHECK(view.size() == 4);
+  for (size_t i = 0; i < view.size(); ++i) {
+    CHECK(view.x()[i] == 0.1f * i);
+    CHECK(view.y()[i] == 0.2f * i);
+    CHECK(view.sizes()[i] == 1.0f + i);
+    CHECK(view.pos(i) == set.pos(i));
+    CHECK(view[i].size == set[i].size);
+#ifdef LBG_DEBUG_STIPPLES
+    CHECK(view.tag(i) == (i % 2 ? StippleTag::Split : StippleTag::Kept));
+#else
+    CHECK(view.tag(i) == StippleTag::Kept);
+#endif
+  }
+
+  set.clear();
+  CHECK(set.empty());
+  CHECK(set.view().empty());
+}
+
+struct Iteration {
+  std::vector<float> x, y, size;
+  std::vector<StippleTag> tags;
+  LBGStippling::Status status;
+};
+
+std::vector<Iteration> recordRun(const QImage& image,
+                                 const LBGStippling::Params& params,
+                                 StippleSet& result) {
+  std::vector<Iteration> iterations;
+  LBGStippling engine;
+  engine.setStippleCallback([&](const StippleView& view) {
+    Iteration iteration;
+    iteration.x.assign(view.x(), view.x() + view.size());
+    iteration.y.assign(view.y(), view.y() + view.size());
+    iteration.size.assign(view.sizes(), view.sizes() + view.size());
+    for (size_t i = 0; i < view.size(); ++i)
+      iteration.tags.push_back(view.tag(i));
+    iterations.push_back(std::move(iteration));
+  });
+  engine.setStatusCallback([&](const LBGStippling::Status& status) {
+    iterations.back().status = status;
+  });
+  result = engine.stipple(image, params);
+  return iterations;
+}
+
+void testRunOrder() {
+  // dark disc on white, the run splits and merges plenty
+  const int width = 120, height = 90;
+  QImage image(width, height, QImage::Format_Grayscale8);
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x) {
+      const float dx = x - 60.0f, dy = y - 45.0f;
+      image.scanLine(y)[x] = dx * dx + dy * dy < 35.0f * 35.0f ? 40 : 230;
+    }
+
+  LBGStippling::Params params;
+  params.engine = CellEngineType::CPU;
+  params.initialPoints = 10;
+  params.initialPointSize = 3.0f;
+  params.maxIterations = 25;
+  params.seed = 7;
+
+  StippleSet result;
+  const std::vector<Iteration> run = recordRun(image, params, result);
+  CHECK(!run.empty());
+
+  size_t previous = params.initialPoints;
+  size_t splits = 0, merges = 0;
+  for (const Iteration& iteration : run) {
+    const LBGStippling::Status& status = iteration.status;
+    CHECK(iteration.x.size() == status.size);
+    CHECK(status.size == previous - status.merges + status.splits);
+    splits += status.splits;
+    merges += status.merges;
+    previous = status.size;
+#ifdef LBG_DEBUG_STIPPLES
+    // both halves of a split cell follow each other, in the place of the
+    // split cell among the kept ones
+    size_t tagged = 0;
+    for (size_t i = 0; i < iteration.tags.size(); ++i) {
+      if (iteration.tags[i] != StippleTag::Split) continue;
+      CHECK(i + 1 < iteration.tags.size());
+      CHECK(iteration.tags[i + 1] == StippleTag::Split);
+      tagged += 2;
+      ++i;
+    }
+    CHECK(tagged == 2 * status.splits);
+#endif
+  }
+  CHECK(splits > 0);
+  CHECK(merges > 0);
+
+  // the result is the set of the last report, in the same order
+  const Iteration& last = run.back();
+  CHECK(result.size() == last.x.size());
+  for (size_t i = 0; i < result.size() && i < last.x.size(); ++i) {
+    CHECK(result.pos(i) == QVector2D(last.x[i], last.y[i]));
+    CHECK(result[i].size == last.size[i]);
+  }
+}
+
+}  // namespace
+
+int main() {
+  testPushBack();
+  testRunOrder();
+  return testResult();
+}
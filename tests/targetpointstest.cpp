@@ -0,0 +1,57 @@
+// Runs with a target point count end within the target tolerance.
+
+#include <QImage>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "check.h"
+#include "lbgstippling.h"
+
+namespace {
+
+// radial gradient, dark in the center
+QImage testImage() {
+  const int width = 300, height = 240;
+  QImage image(width, height, QImage::Format_Grayscale8);
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x) {
+      const float dx = x - 150.0f, dy = y - 120.0f;
+      image.scanLine(y)[x] = static_cast<uint8_t>(
+          std::min(255.0f, 1.5f * std::sqrt(dx * dx + dy * dy)));
+    }
+  return image;
+}
+
+}  // namespace
+
+int main() {
+  const QImage image = testImage();
+  for (const size_t target : {300, 1000, 3000})
+    for (const bool adaptive : {false, true})
+      for (const HysteresisSchedule schedule :
+           {HysteresisSchedule::Linear, HysteresisSchedule::Adaptive}) {
+        LBGStippling::Params params;
+        params.engine = CellEngineType::CPU;
+        params.initialPointSize = 2.0f;
+        params.adaptivePointSize = adaptive;
+        params.pointSizeMin = 1.0f;
+        params.pointSizeMax = 3.0f;
+        params.hysteresisSchedule = schedule;
+        params.targetPoints = target;
+        params.targetTolerance = 0.01f;
+        params.maxIterations = 60;
+        params.seed = 1;
+
+        size_t iterations = 0;
+        LBGStippling engine;
+        engine.setStatusCallback(
+            [&](const LBGStippling::Status&) { ++iterations; });
+        const StippleSet stipples = engine.stipple(image, params);
+        // on target before the iteration limit ends the run
+        CHECK(iterations < params.maxIterations);
+        CHECK_NEAR(stipples.size(), target, params.targetTolerance * target);
+      }
+  return testResult();
+}